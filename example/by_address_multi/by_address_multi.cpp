@@ -3,6 +3,7 @@
  * SesameのBluetoothアドレスがわかっている場合
  */
 #include <Arduino.h>
+#include <ConnectScheduler.h>
 #include <Sesame.h>
 #include <SesameClient.h>
 #include <algorithm>
@@ -58,9 +59,24 @@ const NimBLEAddress sesame_address[] = {NimBLEAddress(SESAME0_ADDRESS, BLE_ADDR_
 constexpr const Sesame::model_t sesame_model[] = {SESAME0_MODEL, SESAME1_MODEL};
 
 SesameClient clients[std::size(sesame_secret)];
+// 接続要求をまとめて受け付け、1台ずつ続けて接続・認証する
+libsesame3bt::ConnectScheduler<> scheduler;
 SesameClient::Status sesame_status[std::size(sesame_secret)];
 SesameClient::state_t sesame_state[std::size(sesame_secret)];
 
+// 全クライアントのイベントを1つのオブジェクトで受け取る
+class StateListener : public SesameClient::Listener {
+ public:
+	void on_state(SesameClient& client, SesameClient::state_t state) override { sesame_state[&client - clients] = state; }
+	void on_status(SesameClient& client, SesameClient::Status status) override {
+		size_t i = &client - clients;
+		// Serial.printf("%u: Setting lock=%d,unlock=%d\n", i, status.lock_position(), status.unlock_position());
+		Serial.printf("%u: Status in_lock=%u,in_unlock=%u,is_crit=%u,pos=%d,volt=%.2f,volt_crit=%u\n", i, status.in_lock(),
+		              status.in_unlock(), status.is_critical(), status.position(), status.voltage(), status.battery_critical());
+		sesame_status[i] = status;
+	}
+} listener;
+
 void
 setup() {
 	Serial.begin(115200);
@@ -79,15 +95,13 @@ setup() {
 			Serial.printf("%u: Failed to set keys\n", i);
 			return;
 		}
-		clients[i].set_state_callback([i](auto& client, auto state) { sesame_state[i] = state; });
-		clients[i].set_status_callback([i](auto& client, auto status) {
-			if (status != sesame_status[i]) {
-				// Serial.printf("%u: Setting lock=%d,unlock=%d\n", i, status.lock_position(), status.unlock_position());
-				Serial.printf("%u: Status in_lock=%u,in_unlock=%u,is_crit=%u,pos=%d,volt=%.2f,volt_crit=%u\n", i, status.in_lock(),
-				              status.in_unlock(), status.is_critical(), status.position(), status.voltage(), status.battery_critical());
-				sesame_status[i] = status;
-			}
-		});
+		clients[i].set_listener(&listener);
+		// 電圧の小さな揺れや位置の微小な変化では通知しない
+		SesameClient::StatusFilter filter;
+		filter.voltage_hysteresis = 0.05f;
+		filter.position_hysteresis = 16;
+		filter.min_interval_ms = 10'000;
+		clients[i].set_status_filter(filter);
 	}
 }
 
@@ -101,6 +115,11 @@ int count = 0;
 // を実行する(電源を切るまで繰り返し)
 void
 loop() {
+	// フィルタで保留されたステータスは各クライアントのloop()から通知される
+	for (auto& client : clients) {
+		client.loop();
+	}
+	scheduler.loop();
 	switch (op) {
 		case op_t::connect:
 			if (std::all_of(std::begin(sesame_state), std::end(sesame_state),
@@ -113,10 +132,11 @@ loop() {
 				count++;
 				Serial.println("Connecting...");
 				for (size_t i = 0; i < std::size(clients); i++) {
-					if (sesame_state[i] == SesameClient::state_t::idle) {
-						if (!clients[i].connect(3)) {
-							Serial.printf("%u: Failed to connect\n", i);
-						}
+					if (sesame_state[i] == SesameClient::state_t::idle || sesame_state[i] == SesameClient::state_t::connect_failed) {
+						scheduler.request(clients[i], [](SesameClient& client, const auto& report) {
+							Serial.printf("%u: result=%u wait=%ums connect=%ums auth=%ums\n", &client - clients,
+							              static_cast<uint8_t>(report.result), report.wait_ms, report.connect_ms, report.authenticate_ms);
+						});
 					}
 				}
 				last_operated = millis();
@@ -6,6 +6,7 @@
 #include <Sesame.h>
 #include <SesameClient.h>
 #include <SesameScanner.h>
+#include <iterator>
 #include <string>
 // Sesame鍵情報設定用インクルードファイル
 // 数行下で SESAME_SECRET 等を直接定義する場合は別ファイルを用意する必要はない
@@ -82,14 +83,14 @@ model_str(Sesame::model_t model) {
 	}
 }
 
-// Bluetoothスキャンを実行し、最初に見つけたSESAME向けに接続設定を実行する
+// Bluetoothスキャンを実行し、最も電波状態の良いSESAME向けに接続設定を実行する
 void
 scan_and_init() {
 	// SesameScannerはシングルトン
 	SesameScanner& scanner = SesameScanner::get();
 
 	Serial.println("Scanning 10 seconds");
-	std::vector<SesameInfo> results;
+	size_t found_count = 0;
 
 	// SesameScanner::scanはスキャン完了までブロックする
 	// コールバック関数には SesameScanner& と、スキャンによって得られた情報 SesameInfo* が渡される
@@ -98,23 +99,29 @@ scan_and_init() {
 	// コールバック中に _scanner.stop() を呼び出すと、そこでスキャンは終了する
 	// スキャン結果には WiFiモジュール2が含まれるが本ライブラリでは対応していない
 	// 非同期スキャンを実行する SesameScanner::scan_async()もある
-	scanner.scan(10'000, [&results](SesameScanner& _scanner, const SesameInfo* _info) {
+	scanner.scan(10'000, [&found_count](SesameScanner& _scanner, const SesameInfo* _info) {
 		if (_info) {  // nullptrの検査を実施
-			// 結果をコピーして results vector に格納する
-			Serial.printf("model=%s,addr=%s,UUID=%s,registered=%u\n", model_str(_info->model).c_str(), _info->address.toString().c_str(),
-			              _info->uuid.toString().c_str(), _info->flags.registered);
-			results.push_back(*_info);
+			Serial.printf("model=%s,addr=%s,UUID=%s,registered=%u,rssi=%d\n", model_str(_info->model).c_str(),
+			              _info->address().toString().c_str(), _info->uuid().toString().c_str(), _info->flags.registered, _info->rssi);
+			found_count++;
 			// _scanner.stop(); // スキャンを停止させたくなったらstop()を呼び出す
 		}
 	});
-	Serial.printf("%u devices found\n", results.size());
-	auto found =
-	    std::find_if(results.cbegin(), results.cend(), [](auto& it) { return it.model == SESAME_MODEL && it.flags.registered; });
-	if (found != results.cend()) {
-		Serial.printf("Using %s (%s)\n", found->uuid.toString().c_str(), model_str(found->model).c_str());
-		// 最初に見つけた SESAME_MODEL のデバイスに接続する
+	Serial.printf("%u advertisements received\n", found_count);
+	// スキャン中に受信したRSSIの平均と広告間隔から、電波状態の良い順に候補を取得する
+	// 電波の弱いデバイスへの接続はタイムアウトしやすいので、先頭の候補に接続する
+	SesameScanner::Candidate candidates[4];
+	size_t count =
+	    scanner.get_candidates(candidates, std::size(candidates), libsesame3bt::ScanFilter{}.model(SESAME_MODEL).registered());
+	for (size_t i = 0; i < count; i++) {
+		Serial.printf("#%u %s rssi=%.1f interval=%ums score=%.1f\n", i + 1, candidates[i].info.uuid().toString().c_str(),
+		              candidates[i].rssi, candidates[i].interval_ms, candidates[i].score);
+	}
+	if (count > 0) {
+		const SesameInfo& found = candidates[0].info;
+		Serial.printf("Using %s (%s)\n", found.uuid().toString().c_str(), model_str(found.model).c_str());
 		// 本サンプルでは認証用の鍵と見つかったSESAMEの組合せ確認は実施していないので、複数のSESAMEがある環境では接続に失敗することがある
-		if (!client.begin(found->address, found->model)) {
+		if (!client.begin(found.address(), found.model)) {
 			Serial.println("Failed to begin");
 			return;
 		}
@@ -129,6 +136,8 @@ scan_and_init() {
 
 bool connected = false;
 SesameClient::state_t sesame_state;
+volatile bool unlock_done = false;
+SesameClient::command_result_t unlock_result;
 
 // SesameClientの状態変化コールバック
 // Sesameとの切断を検知した場合は idle ステートへ遷移する
@@ -170,6 +179,14 @@ setup() {
 	scan_and_init();
 	client.set_state_callback(state_update);
 
+	// 開錠コマンドをキューに入れておくと、認証完了と同時に送信される(状態をポーリングする必要はない)
+	// コールバックはBLEタスクから呼ばれるので、ここでdisconnect()を呼ばないこと
+	client.enqueue(SesameClient::Command::unlock("ラベルは21バイトまたは30バイトに収まるように(勝手に切ります)"),
+	               [](SesameClient& client, SesameClient::command_result_t result) {
+		               unlock_result = result;
+		               unlock_done = true;
+	               });
+
 	// connectはたまに失敗するようなので3回リトライする
 	Serial.print("Connecting...");
 	connected = client.connect(3);
@@ -177,9 +194,7 @@ setup() {
 	Serial.println(connected ? "done" : "failed");
 }
 
-bool unlock_requested = false;
-
-// setup()内で接続に成功していたら unlock を一回実行する
+// setup()内で接続に成功していたら unlock 送信完了後に切断する
 void
 loop() {
 	if (!connected) {
@@ -193,17 +208,11 @@ loop() {
 		// このサンプルではリトライは実装していない
 		return;
 	}
-	// 認証完了してSesameを制御可能になるまで待つ
-	if (sesame_state != SesameClient::state_t::active) {
-		delay(100);
-		return;
-	}
-	if (!unlock_requested) {
-		Serial.println("Unlocking");
-		client.unlock("ラベルは21バイトまたは30バイトに収まるように(勝手に切ります)");
+	if (unlock_done) {
+		Serial.println(unlock_result == SesameClient::command_result_t::sent ? "Unlocked" : "Failed to unlock");
 		client.disconnect();
 		Serial.println("Disconnected");
 		connected = false;
 	}
-	delay(1000);
+	delay(10);
 }
@@ -83,22 +83,27 @@ std::vector<SesameInfo> results;
 void
 loop() {
 	if (scanning) {
-		delay(10);
+		// スキャン結果はBLEタスクでバッファに格納される。アプリのタスク(loop)で取り出して処理する
+		// Serial出力等の遅い処理をしてもBLEタスクは止まらない
+		SesameInfo info;
+		while (scanner->pop(info, 100)) {
+			Serial.printf("model=%s,addr=%s,UUID=%s,registered=%u,rssi=%d\n", model_str(info.model).c_str(),
+			              info.address().toString().c_str(), info.uuid().toString().c_str(), info.flags.registered, info.rssi);
+			results.push_back(info);
+		}
+		if (scanner->is_scanning()) {
+			return;
+		}
+		// バッファが溢れた場合は結果が捨てられる(捨てられた数を取得可能)
+		Serial.printf("%u devices found (%u dropped)\n", results.size(), scanner->get_dropped_count());
+		results.clear();
+		scanning = false;
 		return;
 	}
-	scanning = true;
 	Serial.printf("Start scan\n");
-	scanner->scan_async(10'000, [](SesameScanner& _scanner, const SesameInfo* _info) {
-		if (_info) {  // nullptrの検査を実施
-			// 結果をコピーして results vector に格納する
-			Serial.printf("model=%s,addr=%s,UUID=%s,registered=%u\n", model_str(_info->model).c_str(), _info->address.toString().c_str(),
-			              _info->uuid.toString().c_str(), _info->flags.registered);
-			results.push_back(*_info);
-			// _scanner.stop(); // スキャンを停止させたくなったらstop()を呼び出す
-		} else {
-			Serial.printf("%u devices found\n", results.size());
-			results.clear();
-			scanning = false;
-		}
-	});
+	scanning = scanner->scan_buffered(10'000);
+	if (!scanning) {
+		Serial.println("Failed to start scan");
+		delay(1000);
+	}
 }
@@ -0,0 +1,248 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <vector>
+#include "SesameClient.h"
+#include "clock.h"
+
+namespace libsesame3bt {
+
+/**
+ * @brief Serializes connection establishment of many clients
+ * @details BLE controllers create one connection at a time, so SesameClient::connect_async() must not be called while
+ * another connection is being established. The scheduler accepts any number of connect requests and issues them
+ * back-to-back, at most `max_concurrent` at a time. Authentication of an established connection is started after the
+ * next connection has been issued, so it overlaps with the establishment of the next one.
+ * Call loop() periodically from the application task (not from client callbacks), results are reported from it.
+ * loop() also calls loop() of the clients being connected, which starts their connection retries (SesameClient
+ * RetryPolicy).
+ * @tparam Client SesameClient compatible class (connect_async(), start_authenticate(), disconnect(), get_state(),
+ * loop())
+ */
+template <typename Client = SesameClient>
+class ConnectScheduler {
+ public:
+	using state_t = typename Client::state_t;
+	enum class result_t : uint8_t {
+		/** session is active */
+		active,
+		connect_failed,
+		auth_failed,
+		/** not active within the session timeout */
+		timeout,
+		/** removed by cancel() */
+		cancelled,
+	};
+	/**
+	 * @brief Result of a request
+	 * @details Times are in milliseconds, 0 for stages not reached.
+	 */
+	struct Report {
+		result_t result;
+		/** from request() to connect_async() */
+		uint32_t wait_ms;
+		uint32_t connect_ms;
+		uint32_t authenticate_ms;
+		uint32_t total_ms;
+	};
+	using callback_t = std::function<void(Client& client, const Report& report)>;
+	struct Metrics {
+		uint32_t requested;
+		uint32_t succeeded;
+		uint32_t failed;
+		uint32_t cancelled;
+		/** largest number of queued requests */
+		uint32_t max_depth;
+		/** sum / maximum of queue wait (ms) */
+		uint64_t total_wait_ms;
+		uint32_t max_wait_ms;
+
+		uint32_t mean_wait_ms() const { return succeeded + failed ? total_wait_ms / (succeeded + failed) : 0; }
+	};
+
+	/**
+	 * @param max_concurrent connections established at the same time (1 for NimBLE, more only if the controller
+	 * accepts several pending connections)
+	 */
+	explicit ConnectScheduler(size_t max_concurrent = 1) : max_concurrent(std::max<size_t>(max_concurrent, 1)) {}
+	ConnectScheduler(const ConnectScheduler&) = delete;
+	ConnectScheduler& operator=(const ConnectScheduler&) = delete;
+
+	/**
+	 * @brief Queue connection and authentication of `client`
+	 * @param client client with address and keys set, must outlive the request
+	 * @param callback called from loop() when the session is active or failed
+	 * @return false if `client` is not idle or already requested
+	 */
+	bool request(Client& client, callback_t callback = nullptr) {
+		auto st = client.get_state();
+		if ((st != state_t::idle && st != state_t::connect_failed) || is_requested(client)) {
+			return false;
+		}
+		queue.push_back({&client, std::move(callback), stage_t::queued, false, sysclock::now_ms(), 0, 0});
+		metrics.requested++;
+		metrics.max_depth = std::max<uint32_t>(metrics.max_depth, queue.size());
+		return true;
+	}
+
+	/**
+	 * @brief Remove a queued request, the callback is called with `cancelled`
+	 * @return false if not queued (connection already started)
+	 */
+	bool cancel(Client& client) {
+		auto it = std::find_if(queue.begin(), queue.end(), [&client](const auto& e) { return e.client == &client; });
+		if (it == queue.end()) {
+			return false;
+		}
+		auto entry = std::move(*it);
+		queue.erase(it);
+		finish(entry, result_t::cancelled, sysclock::now_ms());
+		return true;
+	}
+
+	/**
+	 * @brief Advance requests, call periodically
+	 */
+	void loop() {
+		for (auto& e : running) {
+			e.client->loop();
+		}
+		auto now = sysclock::now_ms();
+		for (size_t i = 0; i < running.size();) {
+			if (auto result = update(running[i], now)) {
+				auto entry = std::move(running[i]);
+				running.erase(running.begin() + i);
+				finish(entry, *result, now);
+			} else {
+				i++;
+			}
+		}
+		admit(now);
+		// authentication (service discovery, subscription) of established connections overlaps with the next connection
+		for (size_t i = 0; i < running.size();) {
+			auto& e = running[i];
+			if (e.stage == stage_t::authenticating && !e.auth_started) {
+				e.auth_started = true;
+				if (!e.client->start_authenticate()) {
+					auto entry = std::move(e);
+					running.erase(running.begin() + i);
+					entry.client->disconnect();
+					finish(entry, result_t::auth_failed, sysclock::now_ms());
+					continue;
+				}
+			}
+			i++;
+		}
+	}
+
+	bool is_requested(const Client& client) const {
+		auto match = [&client](const auto& e) { return e.client == &client; };
+		return std::any_of(queue.cbegin(), queue.cend(), match) || std::any_of(running.cbegin(), running.cend(), match);
+	}
+	/** Requests waiting for connection */
+	size_t get_queued_count() const { return queue.size(); }
+	/** Requests connecting or authenticating */
+	size_t get_running_count() const { return running.size(); }
+	const Metrics& get_metrics() const { return metrics; }
+	void reset_metrics() { metrics = {}; }
+	/** Time limit of connection and authentication of each request (ms) */
+	void set_session_timeout(uint32_t timeout_ms) { session_timeout_ms = timeout_ms; }
+
+ private:
+	enum class stage_t : uint8_t { queued, connecting, authenticating };
+	struct Entry {
+		Client* client;
+		callback_t callback;
+		stage_t stage;
+		bool auth_started;
+		uint32_t requested_at;
+		uint32_t started_at;
+		uint32_t connected_at;
+	};
+
+	std::deque<Entry> queue;
+	std::vector<Entry> running;
+	size_t max_concurrent;
+	uint32_t session_timeout_ms = 15'000;
+	Metrics metrics{};
+
+	size_t connecting_count() const {
+		return std::count_if(running.cbegin(), running.cend(), [](const auto& e) { return e.stage == stage_t::connecting; });
+	}
+
+	/** @return result if the request is done */
+	std::optional<result_t> update(Entry& e, uint32_t now) {
+		auto st = e.client->get_state();
+		switch (e.stage) {
+			case stage_t::connecting:
+				if (st == state_t::connected) {
+					e.stage = stage_t::authenticating;
+					e.connected_at = now;
+					return std::nullopt;
+				}
+				if (st == state_t::connect_failed || st == state_t::idle) {
+					return result_t::connect_failed;
+				}
+				break;
+			case stage_t::authenticating:
+				if (st == state_t::active) {
+					return result_t::active;
+				}
+				if (e.auth_started && (st == state_t::idle || st == state_t::connect_failed)) {
+					return result_t::auth_failed;
+				}
+				break;
+			default:
+				break;
+		}
+		if (now - e.started_at > session_timeout_ms) {
+			e.client->disconnect();
+			return result_t::timeout;
+		}
+		return std::nullopt;
+	}
+
+	void admit(uint32_t now) {
+		while (!queue.empty() && connecting_count() < max_concurrent) {
+			auto entry = std::move(queue.front());
+			queue.pop_front();
+			entry.started_at = now;
+			if (!entry.client->connect_async()) {
+				finish(entry, result_t::connect_failed, now);
+				continue;
+			}
+			entry.stage = stage_t::connecting;
+			running.push_back(std::move(entry));
+		}
+	}
+
+	void finish(Entry& e, result_t result, uint32_t now) {
+		Report report{result, 0, 0, 0, now - e.requested_at};
+		if (result != result_t::cancelled) {
+			report.wait_ms = e.started_at - e.requested_at;
+			metrics.total_wait_ms += report.wait_ms;
+			metrics.max_wait_ms = std::max(metrics.max_wait_ms, report.wait_ms);
+		}
+		if (e.stage == stage_t::authenticating) {
+			report.connect_ms = e.connected_at - e.started_at;
+			if (result == result_t::active) {
+				report.authenticate_ms = now - e.connected_at;
+			}
+		}
+		if (result == result_t::active) {
+			metrics.succeeded++;
+		} else if (result == result_t::cancelled) {
+			metrics.cancelled++;
+		} else {
+			metrics.failed++;
+		}
+		if (e.callback) {
+			e.callback(*e.client, report);
+		}
+	}
+};
+
+}  // namespace libsesame3bt
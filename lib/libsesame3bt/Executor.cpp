@@ -0,0 +1,197 @@
+#include "Executor.h"
+#include <algorithm>
+#include "clock.h"
+
+#ifndef LIBSESAME3BT_DEBUG
+#define LIBSESAME3BT_DEBUG 0
+#endif
+#include "debug.h"
+
+namespace libsesame3bt {
+
+QueueExecutor::QueueExecutor(size_t capacity) : items(capacity ? capacity : 1) {}
+
+bool
+QueueExecutor::post(task_t task) {
+	{
+		std::lock_guard lock{mutex};
+		if (count >= items.size()) {
+			stats.dropped++;
+			return false;
+		}
+		items[(head + count) % items.size()] = {std::move(task), sysclock::now_us()};
+		count++;
+		stats.posted++;
+		stats.max_depth = std::max<uint16_t>(stats.max_depth, count);
+	}
+	wake();
+	return true;
+}
+
+/**
+ * @brief Run queued tasks in posted order
+ * @details Tasks posted while running are also run (up to `max_count`).
+ * @param max_count maximum number of tasks to run
+ * @return number of tasks run
+ */
+size_t
+QueueExecutor::run_pending(size_t max_count) {
+	size_t n = 0;
+	for (; n < max_count; n++) {
+		Item item;
+		{
+			std::lock_guard lock{mutex};
+			if (count == 0) {
+				break;
+			}
+			item = std::move(items[head]);
+			items[head] = {};
+			head = (head + 1) % items.size();
+			count--;
+			stats.executed++;
+			stats.latency.add(static_cast<uint32_t>(sysclock::now_us() - item.posted_at));
+		}
+		item.task();
+	}
+	return n;
+}
+
+size_t
+QueueExecutor::get_depth() const {
+	std::lock_guard lock{mutex};
+	return count;
+}
+
+QueueExecutor::Stats
+QueueExecutor::get_stats() const {
+	std::lock_guard lock{mutex};
+	return stats;
+}
+
+void
+QueueExecutor::reset_stats() {
+	std::lock_guard lock{mutex};
+	stats = {};
+}
+
+#if defined(ESP_PLATFORM)
+
+/**
+ * @brief Start the worker task
+ * @param name task name
+ * @param stack_size stack size of the task (bytes)
+ * @param priority task priority
+ * @return false if already started or failed to create the task
+ */
+bool
+TaskExecutor::start(const char* name, uint32_t stack_size, unsigned priority) {
+	if (running) {
+		return false;
+	}
+	if (!stopped && !(stopped = xSemaphoreCreateBinary())) {
+		DEBUG_PRINTLN("Failed to create semaphore");
+		return false;
+	}
+	running = true;
+	TaskHandle_t handle = nullptr;
+	if (xTaskCreate(worker_main, name, stack_size, this, priority, &handle) != pdPASS) {
+		DEBUG_PRINTLN("Failed to create executor task");
+		running = false;
+		return false;
+	}
+	worker = handle;
+	// run tasks posted before start()
+	xTaskNotifyGive(handle);
+	return true;
+}
+
+/**
+ * @brief Stop the worker task after the running task, queued tasks are kept (see run_pending())
+ * @note Do not call from a task run by this executor.
+ */
+void
+TaskExecutor::stop() {
+	if (!running.exchange(false)) {
+		return;
+	}
+	xTaskNotifyGive(worker.load());
+	xSemaphoreTake(stopped, portMAX_DELAY);
+	worker = nullptr;
+	vSemaphoreDelete(stopped);
+	stopped = nullptr;
+}
+
+void
+TaskExecutor::wake() {
+	if (auto handle = worker.load(); running && handle) {
+		xTaskNotifyGive(handle);
+	}
+}
+
+void
+TaskExecutor::worker_main(void* arg) {
+	auto* self = static_cast<TaskExecutor*>(arg);
+	while (self->running) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		while (self->running && self->run_pending(1)) {
+		}
+	}
+	xSemaphoreGive(self->stopped);
+	vTaskDelete(nullptr);
+}
+
+#else
+
+/**
+ * @brief Start the worker thread
+ * @details `name`, `stack_size` and `priority` are used on ESP32 only.
+ * @return false if already started
+ */
+bool
+TaskExecutor::start(const char* /* name */, uint32_t /* stack_size */, unsigned /* priority */) {
+	if (running) {
+		return false;
+	}
+	running = true;
+	worker = std::thread{[this]() { worker_main(); }};
+	return true;
+}
+
+/**
+ * @brief Stop the worker thread after the running task, queued tasks are kept (see run_pending())
+ * @note Do not call from a task run by this executor.
+ */
+void
+TaskExecutor::stop() {
+	{
+		std::lock_guard lock{mutex};
+		if (!running.exchange(false)) {
+			return;
+		}
+	}
+	cv.notify_all();
+	worker.join();
+}
+
+void
+TaskExecutor::wake() {
+	cv.notify_one();
+}
+
+void
+TaskExecutor::worker_main() {
+	std::unique_lock lock{mutex};
+	while (running) {
+		if (depth_locked() == 0) {
+			cv.wait(lock);
+			continue;
+		}
+		lock.unlock();
+		run_pending(1);
+		lock.lock();
+	}
+}
+
+#endif
+
+}  // namespace libsesame3bt
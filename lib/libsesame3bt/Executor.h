@@ -0,0 +1,204 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "SessionStats.h"
+#if defined(ESP_PLATFORM)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#else
+#include <condition_variable>
+#include <thread>
+#endif
+
+#ifndef LIBSESAME3BT_EXECUTOR_TASK_SIZE
+#define LIBSESAME3BT_EXECUTOR_TASK_SIZE 64
+#endif
+
+namespace libsesame3bt {
+
+/**
+ * @brief Callable queued to an executor (move only)
+ * @details Closures up to LIBSESAME3BT_EXECUTOR_TASK_SIZE bytes are stored in the task itself, larger ones on the heap.
+ * QueueExecutor keeps tasks in preallocated slots, so events of the scanner (per advertisement) and of clients (state,
+ * status) are queued without memory allocation.
+ */
+class Task {
+ public:
+	static constexpr size_t INLINE_SIZE = LIBSESAME3BT_EXECUTOR_TASK_SIZE;
+
+	Task() = default;
+	Task(std::nullptr_t) {}
+	template <typename F,
+	          typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task> && std::is_invocable_r_v<void, std::decay_t<F>&>>>
+	Task(F&& f) {
+		using Fn = std::decay_t<F>;
+		if constexpr (is_inline<Fn>()) {
+			new (storage) Fn(std::forward<F>(f));
+			ops = &inline_ops<Fn>;
+		} else {
+			new (storage) Fn*(new Fn(std::forward<F>(f)));
+			ops = &heap_ops<Fn>;
+		}
+	}
+	Task(Task&& other) noexcept { take(other); }
+	Task& operator=(Task&& other) noexcept {
+		if (this != &other) {
+			reset();
+			take(other);
+		}
+		return *this;
+	}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	~Task() { reset(); }
+
+	void operator()() { ops->invoke(storage); }
+	explicit operator bool() const { return ops != nullptr; }
+	/** true if the closure is stored without heap allocation */
+	bool is_inline() const { return ops && !ops->heap; }
+	template <typename Fn>
+	static constexpr bool is_inline() {
+		return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<Fn>;
+	}
+
+ private:
+	struct Ops {
+		void (*invoke)(void* p);
+		/** move constructs at `dst` and destroys `src` */
+		void (*relocate)(void* dst, void* src);
+		void (*destroy)(void* p);
+		bool heap;
+	};
+	template <typename Fn>
+	static constexpr Ops inline_ops{
+	    [](void* p) { (*static_cast<Fn*>(p))(); },
+	    [](void* dst, void* src) {
+		    new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+		    static_cast<Fn*>(src)->~Fn();
+	    },
+	    [](void* p) { static_cast<Fn*>(p)->~Fn(); },
+	    false,
+	};
+	template <typename Fn>
+	static constexpr Ops heap_ops{
+	    [](void* p) { (**static_cast<Fn**>(p))(); },
+	    [](void* dst, void* src) { new (dst) Fn*(*static_cast<Fn**>(src)); },
+	    [](void* p) { delete *static_cast<Fn**>(p); },
+	    true,
+	};
+
+	alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+	const Ops* ops = nullptr;
+
+	void take(Task& other) {
+		if (other.ops) {
+			other.ops->relocate(storage, other.storage);
+			ops = std::exchange(other.ops, nullptr);
+		}
+	}
+	void reset() {
+		if (ops) {
+			std::exchange(ops, nullptr)->destroy(storage);
+		}
+	}
+};
+
+/**
+ * @brief Runs application callbacks outside of the BLE host task
+ * @details SesameClient::set_executor() / SesameScanner::set_executor() post events to an executor instead of calling
+ * listeners on the BLE host task.
+ */
+class Executor {
+ public:
+	using task_t = Task;
+
+	virtual ~Executor() = default;
+	/**
+	 * @brief Queue a task
+	 * @return false if the task was not accepted (dropped)
+	 */
+	virtual bool post(task_t task) = 0;
+};
+
+/**
+ * @brief Bounded FIFO executor, tasks are run by run_pending()
+ * @details Call run_pending() from the application loop, or use TaskExecutor to run tasks on a dedicated task.
+ */
+class QueueExecutor : public Executor {
+ public:
+	struct Stats {
+		uint32_t posted;
+		uint32_t executed;
+		/** tasks rejected because the queue was full */
+		uint32_t dropped;
+		/** largest number of queued tasks */
+		uint16_t max_depth;
+		/** time from post() to start of execution (us) */
+		LatencyHistogram latency;
+	};
+
+	explicit QueueExecutor(size_t capacity = 16);
+	QueueExecutor(const QueueExecutor&) = delete;
+	QueueExecutor& operator=(const QueueExecutor&) = delete;
+	virtual bool post(task_t task) override;
+	size_t run_pending(size_t max_count = SIZE_MAX);
+	size_t get_depth() const;
+	Stats get_stats() const;
+	void reset_stats();
+
+ protected:
+	/** Called after a task is queued, without lock */
+	virtual void wake() {}
+	/** Number of queued tasks (mutex must be held) */
+	size_t depth_locked() const { return count; }
+	mutable std::mutex mutex;
+
+ private:
+	struct Item {
+		task_t task;
+		uint64_t posted_at;
+	};
+	std::vector<Item> items;
+	size_t head = 0;
+	size_t count = 0;
+	Stats stats{};
+};
+
+/**
+ * @brief Executor running tasks on its own task (FreeRTOS task on ESP32, std::thread on host)
+ * @details Callbacks run on the executor task may call any SesameClient function, including start_authenticate() and
+ * disconnect().
+ */
+class TaskExecutor : public QueueExecutor {
+ public:
+	explicit TaskExecutor(size_t capacity = 16) : QueueExecutor(capacity) {}
+	virtual ~TaskExecutor() { stop(); }
+	bool start(const char* name = "sesame_exec", uint32_t stack_size = 4096, unsigned priority = 1);
+	void stop();
+	bool is_running() const { return running; }
+
+ protected:
+	virtual void wake() override;
+
+ private:
+	std::atomic<bool> running{false};
+#if defined(ESP_PLATFORM)
+	/** set after the task is created, wake() before that is covered by the notification of start() */
+	std::atomic<TaskHandle_t> worker{nullptr};
+	SemaphoreHandle_t stopped = nullptr;
+	static void worker_main(void* arg);
+#else
+	std::thread worker;
+	std::condition_variable cv;
+	void worker_main();
+#endif
+};
+
+}  // namespace libsesame3bt
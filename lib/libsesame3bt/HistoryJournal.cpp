@@ -0,0 +1,224 @@
+#include "HistoryJournal.h"
+#include <unistd.h>
+#include <cstddef>
+
+#ifndef LIBSESAME3BT_DEBUG
+#define LIBSESAME3BT_DEBUG 0
+#endif
+#include "debug.h"
+
+namespace libsesame3bt {
+
+namespace {
+
+constexpr char MAGIC[4] = {'S', '3', 'H', 'J'};
+constexpr uint16_t VERSION = 1;
+
+uint32_t
+crc32(const uint8_t* data, size_t size) {
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) {
+			crc = (crc >> 1) ^ (0xedb88320 & (0u - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+}  // namespace
+
+uint32_t
+HistoryJournal::crc_of(const Entry& entry) {
+	return crc32(reinterpret_cast<const uint8_t*>(&entry), offsetof(Entry, crc));
+}
+
+/**
+ * @brief Open (or create) a journal file
+ * @details Torn or corrupted entries at the tail are removed (see get_recovered_count()). A file shorter than the header
+ * whose content matches the start of the header (creation interrupted by power loss) is initialized again.
+ * @param path file path
+ * @return false if the file cannot be opened or is not a journal of this version
+ */
+bool
+HistoryJournal::open(const char* path) {
+	close();
+	recovered = 0;
+	count = 0;
+	index.clear();
+	file = std::fopen(path, "r+b");
+	if (!file && !(file = std::fopen(path, "w+b"))) {
+		DEBUG_PRINTLN("Failed to create %s", path);
+		return false;
+	}
+	Header expected{};
+	std::memcpy(expected.magic, MAGIC, sizeof(MAGIC));
+	expected.version = VERSION;
+	expected.entry_size = sizeof(Entry);
+	Header header{};
+	size_t header_size = std::fread(&header, 1, sizeof(header), file);
+	if (header_size < sizeof(header)) {
+		if (std::memcmp(&header, &expected, header_size) != 0) {
+			DEBUG_PRINTLN("%s is not a journal", path);
+			close();
+			return false;
+		}
+		// new or torn header
+		if (std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&expected, sizeof(expected), 1, file) != 1 ||
+		    std::fflush(file) != 0 || (sync && fsync(fileno(file)) != 0)) {
+			DEBUG_PRINTLN("Failed to write journal header");
+			close();
+			return false;
+		}
+		return true;
+	}
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+	    header.entry_size != sizeof(Entry)) {
+		DEBUG_PRINTLN("%s is not a journal of this version", path);
+		close();
+		return false;
+	}
+	if (std::fseek(file, 0, SEEK_END) != 0) {
+		close();
+		return false;
+	}
+	auto file_size = std::ftell(file);
+	if (file_size < 0 || !recover_tail(static_cast<size_t>(file_size))) {
+		close();
+		return false;
+	}
+	Entry entry;
+	for (size_t i = 0; i < count; i += INDEX_STRIDE) {
+		if (!read_at(i, entry)) {
+			close();
+			return false;
+		}
+		index.push_back(entry.time);
+	}
+	return true;
+}
+
+void
+HistoryJournal::close() {
+	if (file) {
+		std::fclose(file);
+		file = nullptr;
+	}
+}
+
+/** Drop a partial entry and entries with bad CRC at the end of file */
+bool
+HistoryJournal::recover_tail(size_t file_size) {
+	size_t data_size = file_size - sizeof(Header);
+	count = data_size / sizeof(Entry);
+	recovered = data_size % sizeof(Entry) ? 1 : 0;
+	Entry entry;
+	while (count > 0 && !(read_at(count - 1, entry) && entry.crc == crc_of(entry))) {
+		count--;
+		recovered++;
+	}
+	size_t valid_size = sizeof(Header) + count * sizeof(Entry);
+	if (valid_size == file_size) {
+		return true;
+	}
+	DEBUG_PRINTLN("Journal tail recovered, %u entries dropped", static_cast<unsigned>(recovered));
+	std::fflush(file);
+	return ftruncate(fileno(file), valid_size) == 0;
+}
+
+/**
+ * @brief Append an entry
+ * @details CRC of `entry` is computed here.
+ * @return false on write error (the journal keeps the previous entries)
+ */
+bool
+HistoryJournal::append(const Entry& entry) {
+	if (!file) {
+		return false;
+	}
+	Entry e = entry;
+	e.crc = crc_of(e);
+	if (std::fseek(file, sizeof(Header) + count * sizeof(Entry), SEEK_SET) != 0 || std::fwrite(&e, sizeof(e), 1, file) != 1 ||
+	    std::fflush(file) != 0) {
+		DEBUG_PRINTLN("Failed to append journal entry");
+		return false;
+	}
+	if (sync && fsync(fileno(file)) != 0) {
+		DEBUG_PRINTLN("Failed to sync journal");
+		return false;
+	}
+	if (count % INDEX_STRIDE == 0) {
+		index.push_back(e.time);
+	}
+	count++;
+	return true;
+}
+
+bool
+HistoryJournal::read_at(size_t index, Entry& entry) {
+	return std::fseek(file, sizeof(Header) + index * sizeof(Entry), SEEK_SET) == 0 &&
+	       std::fread(&entry, sizeof(entry), 1, file) == 1;
+}
+
+/**
+ * @brief Read an entry
+ * @param index entry number (0: oldest)
+ * @return false if out of range, read error or CRC mismatch
+ */
+bool
+HistoryJournal::read(size_t index, Entry& entry) {
+	return file && index < count && read_at(index, entry) && entry.crc == crc_of(entry);
+}
+
+/**
+ * @brief Find the first entry at or after `time`
+ * @details Binary search on the sparse index, then reads at most INDEX_STRIDE entries.
+ * @return entry number, size() if none
+ */
+size_t
+HistoryJournal::lower_bound(time_t time) {
+	if (!file) {
+		return 0;
+	}
+	auto bucket = std::lower_bound(index.cbegin(), index.cend(), static_cast<int64_t>(time)) - index.cbegin();
+	size_t i = bucket > 0 ? (bucket - 1) * INDEX_STRIDE : 0;
+	Entry entry;
+	for (; i < count; i++) {
+		if (!read_at(i, entry) || entry.time >= time) {
+			break;
+		}
+	}
+	return i;
+}
+
+/**
+ * @brief Visit entries in time range
+ * @param from start time (inclusive)
+ * @param to end time (inclusive)
+ * @param visitor called for each entry in order, return false to stop (do not call the journal from it)
+ * @return number of visited entries (entries with CRC mismatch are skipped)
+ */
+size_t
+HistoryJournal::query(time_t from, time_t to, const visitor_t& visitor) {
+	size_t visited = 0;
+	auto i = lower_bound(from);
+	if (i >= count || std::fseek(file, sizeof(Header) + i * sizeof(Entry), SEEK_SET) != 0) {
+		return 0;
+	}
+	Entry entry;
+	for (; i < count && std::fread(&entry, sizeof(entry), 1, file) == 1; i++) {
+		if (entry.crc != crc_of(entry)) {
+			continue;
+		}
+		if (entry.time > to) {
+			break;
+		}
+		visited++;
+		if (!visitor(entry)) {
+			break;
+		}
+	}
+	return visited;
+}
+
+}  // namespace libsesame3bt
@@ -0,0 +1,119 @@
+#pragma once
+#include <Sesame.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#ifndef LIBSESAME3BT_JOURNAL_EXTRA_SIZE
+#define LIBSESAME3BT_JOURNAL_EXTRA_SIZE 16
+#endif
+#ifndef LIBSESAME3BT_JOURNAL_INDEX_STRIDE
+#define LIBSESAME3BT_JOURNAL_INDEX_STRIDE 64
+#endif
+
+namespace libsesame3bt {
+
+/**
+ * @brief Append-only file of history records
+ * @details Records are stored as fixed-size binary entries with CRC. Every INDEX_STRIDE-th record time is kept in
+ * memory, so range queries read only the entries around the range. A torn entry at the tail (power loss while writing)
+ * is removed by open().
+ * Any stdio path works: a plain file on Linux, `/littlefs/...` after `LittleFS.begin()` on ESP32.
+ * Range queries expect records in time order (as delivered by HistoryReader).
+ */
+class HistoryJournal {
+ public:
+	static constexpr size_t EXTRA_SIZE = LIBSESAME3BT_JOURNAL_EXTRA_SIZE;
+	static constexpr size_t INDEX_STRIDE = LIBSESAME3BT_JOURNAL_INDEX_STRIDE;
+	static constexpr uint8_t NO_TAG_TYPE = 0xff;
+
+	/** Stored history record */
+	struct Entry {
+		int64_t time;
+		int32_t record_id;
+		Sesame::history_type_t type;
+		/** history_tag_type_t, NO_TAG_TYPE if none */
+		uint8_t tag_type;
+		uint8_t tag_len;
+		/** stored bytes of `extra` (longer data is truncated to EXTRA_SIZE) */
+		uint8_t extra_len;
+		float scaled_voltage;
+		float scaled_voltage2;
+		char tag[Sesame::MAX_HISTORY_TAG_SIZE];
+		uint8_t extra[EXTRA_SIZE];
+		uint32_t crc;
+
+		/**
+		 * @brief Make an entry from a history record
+		 * @tparam History SesameClient::History compatible type
+		 */
+		template <typename History>
+		static Entry from(const History& history) {
+			Entry e{};
+			e.time = history.time;
+			e.record_id = history.record_id;
+			e.type = history.type;
+			e.tag_type = history.history_tag_type ? static_cast<uint8_t>(*history.history_tag_type) : NO_TAG_TYPE;
+			e.tag_len = static_cast<uint8_t>(std::min<size_t>(history.tag_len, sizeof(e.tag)));
+			std::memcpy(e.tag, history.tag, e.tag_len);
+			e.scaled_voltage = history.scaled_voltage;
+			e.scaled_voltage2 = history.scaled_voltage2;
+			e.extra_len = static_cast<uint8_t>(std::min(history.extra.size(), sizeof(e.extra)));
+			std::memcpy(e.extra, history.extra.data(), e.extra_len);
+			return e;
+		}
+	};
+	static_assert(std::is_trivially_copyable_v<Entry>, "Entry is written as is");
+
+	/** Called for each entry by query(), return false to stop */
+	using visitor_t = std::function<bool(const Entry& entry)>;
+
+	HistoryJournal() = default;
+	HistoryJournal(const HistoryJournal&) = delete;
+	HistoryJournal& operator=(const HistoryJournal&) = delete;
+	~HistoryJournal() { close(); }
+
+	bool open(const char* path);
+	void close();
+	bool is_open() const { return file != nullptr; }
+	bool append(const Entry& entry);
+	template <typename History>
+	bool append(const History& history) {
+		return append(Entry::from(history));
+	}
+	bool read(size_t index, Entry& entry);
+	size_t query(time_t from, time_t to, const visitor_t& visitor);
+	size_t lower_bound(time_t time);
+	/** Number of stored entries */
+	size_t size() const { return count; }
+	/** Number of torn or corrupted entries removed by the last open() */
+	size_t get_recovered_count() const { return recovered; }
+	/** Make appended entries durable on each append() (slower, default on) */
+	void set_sync(bool sync) { this->sync = sync; }
+
+ private:
+	struct Header {
+		char magic[4];
+		uint16_t version;
+		uint16_t entry_size;
+		uint32_t reserved[2];
+	};
+	std::FILE* file = nullptr;
+	size_t count = 0;
+	size_t recovered = 0;
+	bool sync = true;
+	/** time of entries 0, INDEX_STRIDE, 2 * INDEX_STRIDE, ... */
+	std::vector<int64_t> index;
+
+	bool recover_tail(size_t file_size);
+	bool read_at(size_t index, Entry& entry);
+	static uint32_t crc_of(const Entry& entry);
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,395 @@
+#pragma once
+#include <Sesame.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "SesameClient.h"
+#include "clock.h"
+
+#ifndef LIBSESAME3BT_HISTORY_DEDUP_WINDOW
+#define LIBSESAME3BT_HISTORY_DEDUP_WINDOW 256
+#endif
+
+namespace libsesame3bt {
+
+/**
+ * @brief Set of recently seen record IDs
+ * @details Remembers IDs in a window of `WINDOW` consecutive IDs (1 bit each). An ID outside of the window slides the
+ * window to it, IDs falling out of the window are forgotten.
+ */
+class RecordIdWindow {
+ public:
+	static constexpr size_t WINDOW = LIBSESAME3BT_HISTORY_DEDUP_WINDOW;
+	static_assert(WINDOW >= 32 && WINDOW % 32 == 0, "window must be a multiple of 32");
+
+	/**
+	 * @brief Record an ID
+	 * @return false if the ID is already in the set
+	 */
+	bool insert(int32_t id) {
+		if (used == 0) {
+			low = static_cast<int64_t>(id) - WINDOW / 2;
+		} else if (id < low) {
+			slide(id);
+		} else if (id >= low + static_cast<int64_t>(WINDOW)) {
+			slide(static_cast<int64_t>(id) - WINDOW + 1);
+		}
+		size_t pos = static_cast<size_t>(id - low);
+		uint32_t mask = 1u << (pos % 32);
+		if (bits[pos / 32] & mask) {
+			return false;
+		}
+		bits[pos / 32] |= mask;
+		used++;
+		return true;
+	}
+	bool contains(int32_t id) const {
+		if (used == 0 || id < low || id >= low + static_cast<int64_t>(WINDOW)) {
+			return false;
+		}
+		size_t pos = static_cast<size_t>(id - low);
+		return bits[pos / 32] & (1u << (pos % 32));
+	}
+	void clear() {
+		bits = {};
+		used = 0;
+	}
+
+ private:
+	std::array<uint32_t, WINDOW / 32> bits{};
+	int64_t low = 0;
+	/** IDs in the window */
+	size_t used = 0;
+
+	void slide(int64_t new_low) {
+		std::array<uint32_t, WINDOW / 32> moved{};
+		size_t n = 0;
+		for (size_t i = 0; i < WINDOW; i++) {
+			int64_t src = static_cast<int64_t>(i) + new_low - low;
+			if (src >= 0 && src < static_cast<int64_t>(WINDOW) && (bits[src / 32] & (1u << (src % 32)))) {
+				moved[i / 32] |= 1u << (i % 32);
+				n++;
+			}
+		}
+		bits = moved;
+		low = new_low;
+		used = n;
+	}
+};
+
+/**
+ * @brief Read all history records of a device
+ * @details SESAME returns one record per request_history(). The reader keeps up to `depth` requests in flight until the
+ * device answers `not_found` (no more records), and requests again when no answer arrives within the timeout. Other
+ * error answers (`busy` and the like) are retried like a timeout, after a backoff of `retry_delay_ms` doubled on each
+ * consecutive retry.
+ * Records already delivered (same `record_id`) are dropped. Records are delivered in ascending `record_id` order: a
+ * record is held until it follows the last delivered one or the drain ends. Ordering is relaxed beyond MAX_HELD held
+ * records: the lowest one is delivered, and a record arriving later with a lower `record_id` is delivered at once,
+ * out of order, and counted in Stats::late.
+ * Start with an active session. While reading, the reader is the listener of the client and passes every event,
+ * including history, to the previous listener (or callbacks); the previous one is restored when reading ends. Do not
+ * change the listener or callbacks of the client while reading. Record and completion callbacks are called from
+ * loop().
+ * @tparam Client SesameClient compatible class (request_history(), get_state(), get_listener(), set_listener(),
+ * Listener)
+ */
+template <typename Client = SesameClient>
+class HistoryReader {
+ public:
+	using History = typename Client::History;
+	using state_t = typename Client::state_t;
+	enum class result_t : uint8_t {
+		/** device has no more records */
+		drained,
+		/** no answer after retries */
+		timeout,
+		/** error answers (other than `not_found`) after retries */
+		error,
+		/** session lost */
+		disconnected,
+		/** request_history() failed */
+		send_failed,
+		cancelled,
+	};
+	using record_callback_t = std::function<void(Client& client, const History& history)>;
+	using done_callback_t = std::function<void(Client& client, result_t result)>;
+	static constexpr size_t MAX_HELD = 16;
+
+	struct Stats {
+		uint32_t requests;
+		/** requests sent again after timeout or error answer */
+		uint32_t retries;
+		uint32_t records;
+		uint32_t duplicates;
+		/** records delivered out of order (lower `record_id` than a delivered record) */
+		uint32_t late;
+	};
+
+	explicit HistoryReader(Client& client) : client(client), tap(*this) {}
+	HistoryReader(const HistoryReader&) = delete;
+	HistoryReader& operator=(const HistoryReader&) = delete;
+	~HistoryReader() { detach(); }
+
+	/**
+	 * @brief Start reading
+	 * @param on_record called for each new record
+	 * @param on_done called once when reading ends
+	 * @return false if already running or the session is not active
+	 */
+	bool start(record_callback_t on_record, done_callback_t on_done = nullptr) {
+		if (running || client.get_state() != state_t::active) {
+			return false;
+		}
+		if (!attached) {
+			tap.next = client.get_listener();
+			client.set_listener(&tap);
+			attached = true;
+		}
+		{
+			std::lock_guard lock{mutex};
+			inbox.clear();
+		}
+		this->on_record = std::move(on_record);
+		this->on_done = std::move(on_done);
+		held.clear();
+		stats = {};
+		in_flight = 0;
+		attempts = 0;
+		resume_at = sysclock::now_ms();
+		end_seen = false;
+		error_seen = false;
+		has_last = false;
+		running = true;
+		last_activity = sysclock::now_ms();
+		return true;
+	}
+
+	/**
+	 * @brief Process answers and send requests, call periodically
+	 */
+	void loop() {
+		if (!running) {
+			return;
+		}
+		std::deque<History> received;
+		{
+			std::lock_guard lock{mutex};
+			received.swap(inbox);
+		}
+		auto now = sysclock::now_ms();
+		for (const auto& history : received) {
+			receive(history, now);
+		}
+		if (client.get_state() != state_t::active) {
+			finish(result_t::disconnected);
+			return;
+		}
+		if (in_flight > 0 && now - last_activity > timeout_ms) {
+			error_seen = false;
+			if (++attempts > max_retries) {
+				finish(result_t::timeout);
+				return;
+			}
+			// answers may be lost, send the requests again
+			stats.retries += in_flight;
+			in_flight = 0;
+			last_activity = now;
+		}
+		if (error_seen && attempts > max_retries) {
+			finish(result_t::error);
+			return;
+		}
+		if (end_seen) {
+			if (in_flight == 0) {
+				finish(result_t::drained);
+			}
+			return;
+		}
+		if (static_cast<int32_t>(now - resume_at) < 0) {
+			return;  // backing off after an error answer
+		}
+		while (in_flight < depth) {
+			if (!client.request_history()) {
+				finish(result_t::send_failed);
+				return;
+			}
+			if (in_flight++ == 0) {
+				last_activity = now;
+			}
+			stats.requests++;
+		}
+	}
+
+	/** Stop reading, records held for ordering are delivered */
+	void cancel() {
+		if (running) {
+			finish(result_t::cancelled);
+		}
+	}
+	bool is_running() const { return running; }
+	const Stats& get_stats() const { return stats; }
+	/** Forget delivered record IDs (records are delivered again) */
+	void clear_seen() { seen.clear(); }
+	/** Number of requests in flight (1 to send one by one) */
+	void set_depth(uint8_t depth) { this->depth = std::max<uint8_t>(depth, 1); }
+	/** Wait for an answer before requesting again (ms) */
+	void set_timeout(uint32_t timeout_ms) { this->timeout_ms = timeout_ms; }
+	/** Give up after this number of consecutive timeouts or error answers */
+	void set_max_retries(uint8_t retries) { max_retries = retries; }
+	/** Wait before requesting again after the first error answer, doubled on each consecutive one (ms) */
+	void set_retry_delay(uint32_t delay_ms) { retry_delay_ms = delay_ms; }
+
+ private:
+	using Listener = typename Client::Listener;
+	/** Takes history answers and passes all events to the listener of the application */
+	class Tap : public Listener {
+	 public:
+		explicit Tap(HistoryReader& reader) : reader(reader) {}
+		void on_state(Client& client, state_t state) override {
+			if (next) {
+				next->on_state(client, state);
+			}
+		}
+		void on_status(Client& client, typename Client::Status status) override {
+			if (next) {
+				next->on_status(client, status);
+			}
+		}
+		void on_history(Client& client, const History& history) override {
+			{
+				std::lock_guard lock{reader.mutex};
+				reader.inbox.push_back(history);
+			}
+			if (next) {
+				next->on_history(client, history);
+			}
+		}
+		void on_registered_devices(Client& client, const std::vector<typename Client::RegisteredDevice>& devices) override {
+			if (next) {
+				next->on_registered_devices(client, devices);
+			}
+		}
+
+		HistoryReader& reader;
+		Listener* next = nullptr;
+	};
+
+	Client& client;
+	Tap tap;
+	std::mutex mutex;
+	std::deque<History> inbox;
+	/** out of order records, sorted by record_id */
+	std::vector<History> held;
+	RecordIdWindow seen;
+	record_callback_t on_record{};
+	done_callback_t on_done{};
+	Stats stats{};
+	bool attached = false;
+	bool running = false;
+	bool end_seen = false;
+	/** the last retry was caused by an error answer */
+	bool error_seen = false;
+	bool has_last = false;
+	int32_t last_id = 0;
+	uint8_t depth = 3;
+	uint8_t in_flight = 0;
+	uint8_t attempts = 0;
+	uint8_t max_retries = 3;
+	uint32_t timeout_ms = 3'000;
+	uint32_t retry_delay_ms = 200;
+	uint32_t last_activity = 0;
+	/** no request is sent before this time */
+	uint32_t resume_at = 0;
+
+	void receive(const History& history, uint32_t now) {
+		if (in_flight > 0) {
+			in_flight--;
+		}
+		last_activity = now;
+		if (history.result == Sesame::result_code_t::not_found) {
+			end_seen = true;
+			return;
+		}
+		if (history.result != Sesame::result_code_t::success) {
+			// busy or other temporary error: the record is still on the device, request it again later
+			stats.retries++;
+			error_seen = true;
+			if (++attempts <= max_retries) {
+				resume_at = now + (retry_delay_ms << std::min<uint8_t>(attempts - 1, 15));
+			}
+			return;
+		}
+		attempts = 0;
+		error_seen = false;
+		if (!seen.insert(history.record_id)) {
+			stats.duplicates++;
+			return;
+		}
+		stats.records++;
+		if (has_last && history.record_id < last_id) {
+			// a higher record was delivered for exceeding MAX_HELD, cannot be delivered in order
+			stats.late++;
+			if (on_record) {
+				on_record(client, history);
+			}
+			return;
+		}
+		auto it = std::upper_bound(held.begin(), held.end(), history.record_id,
+		                           [](int32_t id, const History& h) { return id < h.record_id; });
+		held.insert(it, history);
+		release(false);
+	}
+
+	/**
+	 * @brief Deliver held records
+	 * @param all deliver all, otherwise the records following the last delivered one and the lowest ones exceeding
+	 * MAX_HELD
+	 */
+	void release(bool all) {
+		size_t n = 0;
+		for (; n < held.size(); n++) {
+			int32_t id = held[n].record_id;
+			if (!all && held.size() - n <= MAX_HELD && !(has_last && id == last_id + 1)) {
+				break;
+			}
+			last_id = id;
+			has_last = true;
+			if (on_record) {
+				on_record(client, held[n]);
+			}
+		}
+		held.erase(held.begin(), held.begin() + n);
+	}
+
+	/** Give the listener back to the application */
+	void detach() {
+		if (!attached) {
+			return;
+		}
+		attached = false;
+		if (client.get_listener() == &tap) {
+			client.set_listener(tap.next);
+		}
+		tap.next = nullptr;
+	}
+
+	void finish(result_t result) {
+		running = false;
+		detach();
+		release(true);
+		auto done = std::move(on_done);
+		on_done = nullptr;
+		on_record = nullptr;
+		if (done) {
+			done(client, result);
+		}
+	}
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,111 @@
+#include "RetryPolicy.h"
+#include <NimBLEDevice.h>
+#include <algorithm>
+#if defined(ESP_PLATFORM)
+#include <esp_random.h>
+#else
+#include <random>
+#endif
+
+namespace libsesame3bt {
+
+namespace {
+
+uint32_t
+random32() {
+#if defined(ESP_PLATFORM)
+	return esp_random();
+#else
+	static std::minstd_rand engine{1};
+	return engine();
+#endif
+}
+
+}  // namespace
+
+uint32_t
+RetryPolicy::backoff_ms(uint8_t retry) const {
+	uint64_t delay = initial_delay_ms;
+	for (uint8_t i = 1; i < retry && delay < max_delay_ms; i++) {
+		delay *= std::max<uint8_t>(multiplier, 1);
+	}
+	return static_cast<uint32_t>(std::min<uint64_t>(delay, max_delay_ms));
+}
+
+std::optional<uint32_t>
+RetryPolicy::next_delay(uint8_t failed_attempts, int reason, uint32_t elapsed_ms) const {
+	if (failed_attempts >= max_attempts || classify(reason) == reason_class_t::fatal) {
+		return std::nullopt;
+	}
+	uint32_t delay = backoff_ms(failed_attempts);
+	if (jitter_pct && delay) {
+		uint32_t span = static_cast<uint64_t>(delay) * std::min<uint8_t>(jitter_pct, 100) / 100;
+		delay -= span ? random32() % (span + 1) : 0;
+	}
+	if (deadline_ms && elapsed_ms + delay >= deadline_ms) {
+		return std::nullopt;
+	}
+	return delay;
+}
+
+/**
+ * @details Codes not listed as fatal (including 0 and unknown codes) are retryable. ENOMEM on connect means all
+ * connection slots of the host are in use, which a retry does not change. EALREADY means another connection attempt is
+ * in progress and is retryable; EDONE means the device is already connected.
+ */
+RetryPolicy::reason_class_t
+RetryPolicy::classify(int reason) {
+	if (reason >= BLE_HS_ERR_HCI_BASE && reason < BLE_HS_ERR_HCI_BASE + 0x100) {
+		switch (reason - BLE_HS_ERR_HCI_BASE) {
+			case BLE_ERR_AUTH_FAIL:
+			case BLE_ERR_CONN_LIMIT:
+			case BLE_ERR_ACL_CONN_EXISTS:
+			case BLE_ERR_UNSUPPORTED:
+			case BLE_ERR_INV_HCI_CMD_PARMS:
+			case BLE_ERR_CONN_PARMS:
+				return reason_class_t::fatal;
+			default:
+				return reason_class_t::retryable;
+		}
+	}
+	switch (reason) {
+		case BLE_HS_EDONE:
+		case BLE_HS_EINVAL:
+		case BLE_HS_ENOMEM:
+		case BLE_HS_ENOTSUP:
+		case BLE_HS_EAUTHEN:
+		case BLE_HS_EAUTHOR:
+		case BLE_HS_EENCRYPT:
+		case BLE_HS_EDISABLED:
+			return reason_class_t::fatal;
+		default:
+			return reason_class_t::retryable;
+	}
+}
+
+void
+FailureCounter::add(int reason) {
+	failures++;
+	if (RetryPolicy::classify(reason) == RetryPolicy::reason_class_t::fatal) {
+		fatals++;
+	}
+	for (size_t i = 0; i < used; i++) {
+		if (entries[i].reason == reason) {
+			entries[i].count++;
+			return;
+		}
+	}
+	if (used < entries.size()) {
+		entries[used++] = {reason, 1};
+	} else {
+		others++;
+	}
+}
+
+uint32_t
+FailureCounter::count(int reason) const {
+	auto it = std::find_if(begin(), end(), [reason](const Entry& e) { return e.reason == reason; });
+	return it != end() ? it->count : 0;
+}
+
+}  // namespace libsesame3bt
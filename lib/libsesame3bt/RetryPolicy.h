@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#ifndef LIBSESAME3BT_FAILURE_REASON_SLOTS
+#define LIBSESAME3BT_FAILURE_REASON_SLOTS 8
+#endif
+
+namespace libsesame3bt {
+
+/**
+ * @brief When and how often a failed connection is retried
+ * @details The delay before retry n (1 for the first retry) is `initial_delay_ms * multiplier^(n-1)`, capped at
+ * `max_delay_ms` and shortened by a random amount of up to `jitter_pct` percent, so clients failing together do not
+ * retry together. Failures with a fatal reason (see classify()) are not retried.
+ */
+struct RetryPolicy {
+	enum class reason_class_t : uint8_t {
+		/** may succeed later (timeout, device out of range, controller busy, connection attempt in progress) */
+		retryable,
+		/** fails again (invalid parameters, unsupported, no free connection, authentication, already connected) */
+		fatal,
+	};
+
+	/** attempts including the first one, 1 not to retry */
+	uint8_t max_attempts = 1;
+	uint32_t initial_delay_ms = 200;
+	uint32_t max_delay_ms = 5'000;
+	uint8_t multiplier = 2;
+	uint8_t jitter_pct = 25;
+	/** no retry is started later than this from the first attempt (ms), 0 for no limit */
+	uint32_t deadline_ms = 0;
+
+	/** single attempt (default) */
+	static constexpr RetryPolicy none() { return {}; }
+	/** 4 attempts within 10 seconds, for devices at the edge of the range */
+	static constexpr RetryPolicy standard() { return {4, 200, 5'000, 2, 25, 10'000}; }
+
+	/**
+	 * @brief Delay before the next attempt
+	 * @param failed_attempts attempts made so far (all failed)
+	 * @param reason NimBLE error code of the last failure
+	 * @param elapsed_ms time since the first attempt
+	 * @return delay in milliseconds, std::nullopt to give up
+	 */
+	std::optional<uint32_t> next_delay(uint8_t failed_attempts, int reason, uint32_t elapsed_ms) const;
+	/** Delay before retry `retry` (1-based) without jitter */
+	uint32_t backoff_ms(uint8_t retry) const;
+	/** Classify a NimBLE host (BLE_HS_*) or HCI (BLE_HS_ERR_HCI_BASE + BLE_ERR_*) error code */
+	static reason_class_t classify(int reason);
+};
+
+/**
+ * @brief Connection failures by NimBLE reason code
+ * @details Keeps counts of the first LIBSESAME3BT_FAILURE_REASON_SLOTS (default 8) distinct reasons, failures with
+ * other reasons are counted by other().
+ */
+class FailureCounter {
+ public:
+	struct Entry {
+		int reason;
+		uint32_t count;
+	};
+	static constexpr size_t REASON_SLOTS = LIBSESAME3BT_FAILURE_REASON_SLOTS;
+
+	void add(int reason);
+	/** A failure was followed by another attempt */
+	void add_retry() { retried++; }
+	uint32_t count(int reason) const;
+	/** All failures */
+	uint32_t total() const { return failures; }
+	/** Failures with fatal reasons */
+	uint32_t fatal() const { return fatals; }
+	/** Failures followed by another attempt */
+	uint32_t retries() const { return retried; }
+	/** Failures not in the reason table */
+	uint32_t other() const { return others; }
+	/** Counted reasons in order of first occurrence */
+	const Entry* begin() const { return entries.data(); }
+	const Entry* end() const { return entries.data() + used; }
+	void clear() { *this = {}; }
+
+ private:
+	std::array<Entry, REASON_SLOTS> entries{};
+	size_t used = 0;
+	uint32_t failures = 0;
+	uint32_t fatals = 0;
+	uint32_t retried = 0;
+	uint32_t others = 0;
+};
+
+}  // namespace libsesame3bt
@@ -1,6 +1,10 @@
 #include "SesameClient.h"
 #include <libsesame3bt/ServerCore.h>
+#include <libsesame3bt/util.h>
+#include <algorithm>
 #include <cinttypes>
+#include <cstring>
+#include "clock.h"
 
 #ifndef LIBSESAME3BT_DEBUG
 #define LIBSESAME3BT_DEBUG 0
@@ -11,30 +15,166 @@ namespace libsesame3bt {
 
 using SesameClientCore = core::SesameClientCore;
 
+class SesameClient::CallbackListener : public Listener {
+ public:
+	status_callback_t status_callback{};
+	state_callback_t state_callback{};
+	history_callback_t history_callback{};
+	registered_devices_callback_t registered_devices_callback{};
+
+	void on_state(SesameClient& client, state_t state) override {
+		if (state_callback) {
+			state_callback(client, state);
+		}
+	}
+	void on_status(SesameClient& client, Status status) override {
+		if (status_callback) {
+			status_callback(client, status);
+		}
+	}
+	void on_history(SesameClient& client, const History& history) override {
+		if (history_callback) {
+			history_callback(client, history);
+		}
+	}
+	void on_registered_devices(SesameClient& client, const std::vector<RegisteredDevice>& devices) override {
+		if (registered_devices_callback) {
+			registered_devices_callback(client, devices);
+		}
+	}
+};
+
+/**
+ * @brief Call the listener now or from the executor
+ * @details Arguments are copied only when posted to the executor. The listener is looked up when the event is
+ * delivered.
+ */
+template <typename... Args>
+void
+SesameClient::emit(void (Listener::*event)(SesameClient&, Args...), const std::decay_t<Args>&... args) {
+	if (!executor) {
+		if (listener) {
+			(listener->*event)(*this, args...);
+		}
+		return;
+	}
+	if (!executor->post([this, event, args...]() {
+		    if (listener) {
+			    (listener->*event)(*this, args...);
+		    }
+	    })) {
+		DEBUG_PRINTLN("Executor queue full, event dropped");
+	}
+}
+
 SesameClient::SesameClient() : SesameClientCore(static_cast<SesameBLEBackend&>(*this)) {
+	ble.set_handler(this);
 	SesameClientCore::set_state_callback([this](auto& core, auto state) { core_state_callback(core, state); });
 	SesameClientCore::set_status_callback([this](auto&, Status status) {
-		if (status_callback)
-			status_callback(*this, status);
+		if (state == state_t::active && timing.first_status_us == 0) {
+			timing_mark(timing.first_status_us);
+			timing_record();
+		}
+		if (op_command.type != Command::type_t::request_history && (op_events & OP_SENT)) {
+			op_mark(OP_CONFIRMED, op_confirmed_at);
+		}
+		filter_status(status);
 	});
 	SesameClientCore::set_history_callback([this](auto&, const History& history) {
-		if (history_callback)
-			history_callback(*this, history);
+		if (op_command.type == Command::type_t::request_history && (op_events & OP_SENT)) {
+			op_mark(OP_CONFIRMED, op_confirmed_at);
+		}
+		emit(&Listener::on_history, history);
 	});
 	SesameClientCore::set_registered_devices_callback([this](auto&, const auto& devs) {
-		if (registered_devices_callback) {
-			registered_devices_callback(*this, devs);
-		}
+		emit(&Listener::on_registered_devices, devs);
 	});
 }
 
 SesameClient::~SesameClient() {
-	if (blec) {
-		blec->setClientCallbacks(nullptr, false);
-		NimBLEDevice::deleteClient(blec);
+	if (transport != &ble) {
+		transport->disconnect();
+		transport->set_handler(nullptr);
 	}
 }
 
+/**
+ * The callbacks are kept out of the client until used, set_listener() users do not pay for them.
+ */
+SesameClient::CallbackListener&
+SesameClient::use_callbacks() {
+	if (!callbacks) {
+		callbacks = std::make_unique<CallbackListener>();
+	}
+	listener = callbacks.get();
+	return *callbacks;
+}
+
+/** Deliver `status` if it passes the status filter, otherwise keep it for flush_status() */
+void
+SesameClient::filter_status(const Status& status) {
+	std::lock_guard lock{status_mutex};
+	if (status_filter) {
+		auto now = sysclock::now_ms();
+		if (delivered_status && !status_filter->is_changed(*delivered_status, status, now - delivered_status_at)) {
+			suppressed_statuses++;
+			pending_status = status;
+			status_pending = true;
+			return;
+		}
+		delivered_status = status;
+		delivered_status_at = now;
+		pending_status.reset();
+	}
+	// under the lock, a status flushed by loop() cannot overtake a newer one
+	emit(&Listener::on_status, status);
+}
+
+/** Deliver the last suppressed status if it is a change once min_interval_ms has passed */
+void
+SesameClient::flush_status() {
+	std::lock_guard lock{status_mutex};
+	if (!pending_status || !status_filter) {
+		status_pending = false;
+		return;
+	}
+	auto now = sysclock::now_ms();
+	auto elapsed = now - delivered_status_at;
+	if (elapsed < status_filter->min_interval_ms) {
+		return;
+	}
+	status_pending = false;
+	auto status = *pending_status;
+	pending_status.reset();
+	if (!status_filter->is_changed(*delivered_status, status, elapsed)) {
+		return;
+	}
+	delivered_status = status;
+	delivered_status_at = now;
+	suppressed_statuses--;
+	emit(&Listener::on_status, status);
+}
+
+void
+SesameClient::set_status_callback(status_callback_t callback) {
+	use_callbacks().status_callback = std::move(callback);
+}
+
+void
+SesameClient::set_state_callback(state_callback_t callback) {
+	use_callbacks().state_callback = std::move(callback);
+}
+
+void
+SesameClient::set_history_callback(history_callback_t callback) {
+	use_callbacks().history_callback = std::move(callback);
+}
+
+void
+SesameClient::set_registered_devices_callback(registered_devices_callback_t callback) {
+	use_callbacks().registered_devices_callback = std::move(callback);
+}
+
 void
 SesameClient::core_state_callback(core::SesameClientCore& core, core::state_t state) {
 	switch (state) {
@@ -45,32 +185,38 @@ SesameClient::core_state_callback(core::SesameClientCore& core, core::state_t st
 			set_state(state_t::authenticating);
 			break;
 		case core::state_t::active:
+			transport->on_authenticated();
 			set_state(state_t::active);
+			op_send();
+			flush_commands();
 			break;
 	}
 }
 
 bool
 SesameClient::write_to_tx(const uint8_t* data, size_t size) {
-	if (!blec || !tx) {
-		DEBUG_PRINTLN("ble or tx not initialized");
+	// the built-in NimBLETransport (final) is called directly, without virtual dispatch
+	if (!(transport == &ble ? ble.write(data, size) : transport->write(data, size))) {
 		return false;
 	}
-	return tx->writeValue(data, size, false);
+	tx_fragments.add(data, size);
+	return true;
 }
 
 void
 SesameClient::disconnect() {
-	if (!blec) {
+	bool retrying = connect_retry_pending.exchange(false);
+	if (!transport->disconnect()) {
+		if (retrying) {
+			set_state(state_t::idle);
+		}
 		return;
 	}
-	// prevent disconnect callback loop
-	blec->setClientCallbacks(nullptr, false);
-	if (!NimBLEDevice::deleteClient(blec)) {
-		DEBUG_PRINTLN("Failed to delete NimBLE client");
-	}
-	blec = nullptr;
+	timing_mark(timing.disconnected_us);
+	timing_record();
 	on_disconnected();
+	// core stays idle (no callback) when disconnected before authentication
+	set_state(state_t::idle);
 }
 
 bool
@@ -100,9 +246,75 @@ SesameClient::set_state(state_t state) {
 	if (state == this->state) {
 		return;
 	}
+	if (state == state_t::idle && this->state == state_t::authenticating) {
+		// authentication did not complete, do not trust cached attributes
+		transport->on_authentication_failed();
+	}
 	this->state = state;
-	if (state_callback) {
-		state_callback(*this, this->state);
+	switch (state) {
+		case state_t::connected: {
+			timing_mark(timing.connected_us);
+			std::lock_guard lock{status_mutex};
+			delivered_status.reset();
+			pending_status.reset();
+			break;
+		}
+		case state_t::authenticating:
+			timing_mark(timing.authenticating_us);
+			break;
+		case state_t::active:
+			timing_mark(timing.active_us);
+			break;
+		default:
+			break;
+	}
+	if (op_stage != op_stage_t::none) {
+		switch (state) {
+			case state_t::connected:
+				op_mark(OP_CONNECTED, op_connected_at);
+				break;
+			case state_t::connect_failed:
+				op_mark(OP_CONNECT_FAILED, op_lost_at);
+				break;
+			case state_t::active:
+				op_mark(OP_ACTIVE, op_active_at);
+				break;
+			case state_t::idle:
+				op_mark(OP_IDLE, op_lost_at);
+				break;
+			default:
+				break;
+		}
+	}
+	emit(&Listener::on_state, this->state);
+}
+
+void
+SesameClient::timing_start() {
+	timing = {};
+	timing.started_at = sysclock::now_us();
+	timing_recorded = false;
+}
+
+void
+SesameClient::timing_mark(uint32_t& phase_us) {
+	// phases after timing_record() (disconnection) are still marked, only the statistics are updated once
+	if (phase_us) {
+		return;
+	}
+	// never 0 (not reached)
+	phase_us = std::max<uint32_t>(static_cast<uint32_t>(sysclock::now_us() - timing.started_at), 1);
+}
+
+/** Add the session to the statistics once (at first status or at disconnection) */
+void
+SesameClient::timing_record() {
+	if (timing_recorded) {
+		return;
+	}
+	timing_recorded = true;
+	if (session_stats) {
+		session_stats->record(timing);
 	}
 }
 
@@ -122,15 +334,84 @@ SesameClient::uuid_to_ble_address(const NimBLEUUID& uuid) {
 	return {reinterpret_cast<const uint8_t*>(b_addr.data()), BLE_ADDR_RANDOM};
 }
 
+/**
+ * @brief Set connection parameters and preferred PHY
+ * @details Used for following connections. If connected, an update is requested, use it to switch between a short
+ * interval for authentication and commands and a relaxed one for idle sessions. The device may reject the update or
+ * choose other values in the range.
+ * @param params connection parameters
+ * @return false if `params` is invalid or the update request failed
+ */
+bool
+SesameClient::set_connection_params(const ConnectionParams& params) {
+	return ble.set_connection_params(params);
+}
+
+/**
+ * @brief Negotiate larger ATT MTU and data length after authentication
+ * @details Long messages (history, registered devices) are then received in fewer notifications. Negotiation runs in
+ * loop() once the session is active, so call loop() periodically. If the exchange fails, the session continues with the
+ * default MTU and negotiation is skipped in later sessions. Disabled by default, some devices / controllers (vanilla
+ * ESP32) are unstable with it; enable it for the models known to work.
+ * @param enable true to negotiate
+ * @param data_len LL data length (octets) requested after MTU exchange, 0 to keep the default
+ */
+void
+SesameClient::set_mtu_exchange(bool enable, uint16_t data_len) {
+	ble.set_mtu_exchange(enable, data_len);
+}
+
+/**
+ * @brief Keep GATT attributes (service, characteristic handles) of the device between sessions
+ * @details With the cache, reconnection skips service discovery. The NimBLE client is kept after disconnect(). If the
+ * cached attributes do not work (subscription fails or the session ends during authentication), they are discovered
+ * again.
+ * NimBLE creates at most CONFIG_BT_NIMBLE_MAX_CONNECTIONS clients and a kept client counts even while disconnected:
+ * enable the cache on fewer clients than that, or connections of the other clients fail. Disabling the cache releases
+ * the NimBLE client of an idle client.
+ * @param enable true to enable cache
+ */
+void
+SesameClient::set_attribute_cache(bool enable) {
+	ble.set_attribute_cache(enable);
+	if (!enable && (state == state_t::idle || state == state_t::connect_failed)) {
+		// deletes the kept NimBLE client
+		ble.disconnect();
+	}
+}
+
+/**
+ * @brief Use `transport` instead of NimBLE
+ * @details Connection parameters, MTU exchange and attribute cache settings apply to the NimBLE transport only.
+ * @param transport transport (must outlive the client), nullptr to return to NimBLE
+ * @return false if a session or an operation is in progress
+ */
+bool
+SesameClient::set_transport(Transport* transport) {
+	if ((state != state_t::idle && state != state_t::connect_failed) || is_operating()) {
+		DEBUG_PRINTLN("Cannot change transport during a session");
+		return false;
+	}
+	if (this->transport != &ble) {
+		this->transport->set_handler(nullptr);
+	}
+	this->transport = transport ? transport : &ble;
+	this->transport->set_handler(this);
+	return true;
+}
+
 /***
  * @brief Connect to the device asynchronously
- * @return true if start connecting successfully
+ * @return true if start connecting successfully, or if the attempt was rejected at once and a retry is scheduled by
+ * the retry policy (see set_retry_policy())
  * @note This function will return immediately, and the connection result will be notified by the state callback.
+ * Retries are started by loop(), call it periodically while connecting.
  * If the connection fails, state callback will be called with state_t::connect_failed.
  * If the connection is successful, state callback will be called with state_t::connected.
  * To authenticate, call start_authenticate() after the state is state_t::connected.
- * DO NOT CALL start_authenticate() or disconnect() from the state callback, it will cause a deadlock.
- * Do not call while other connection is in progress.
+ * DO NOT CALL start_authenticate() or disconnect() from the state callback, it will cause a deadlock (unless the
+ * callback is run by an executor, see set_executor()).
+ * Do not call while other connection is in progress, ConnectScheduler queues connections of many clients.
  */
 bool
 SesameClient::connect_async() {
@@ -138,44 +419,47 @@ SesameClient::connect_async() {
 		DEBUG_PRINTLN("Keys are not set");
 		return false;
 	}
-	if (!blec) {
-		blec = NimBLEDevice::createClient();
-		if (!blec) {
-			DEBUG_PRINTLN("Failed to create BLE client");
+	connect_retry_pending = false;
+	timing_start();
+	connect_attempts = 1;
+	connect_started_at = sysclock::now_ms();
+	if (!transport->connect(address, true)) {
+		int reason = transport->get_last_error();
+		DEBUG_PRINTLN("BLE connect async failed rc=%d", reason);
+		if (!schedule_connect_retry(reason)) {
 			return false;
 		}
-		blec->setClientCallbacks(this, false);
-	}
-	is_async_connect = true;
-	blec->setConnectTimeout(connect_timeout);
-	if (blec->connect(address, true, true, false)) {
-		set_state(state_t::connecting);
-		return true;
-	} else {
-		DEBUG_PRINTLN("BLE connect async failed rc=%d", blec->getLastError());
-		return false;
 	}
+	set_state(state_t::connecting);
+	return true;
 }
 
+/**
+ * @param retry retries after the first attempt, 0 to use the retry policy (see set_retry_policy())
+ * @details Waits between attempts as the retry policy tells, failures with fatal reasons are not retried.
+ */
 bool
 SesameClient::connect(int retry) {
 	if (!is_key_set()) {
 		DEBUG_PRINTLN("Keys are not set, cannot connect");
 		return false;
 	}
-	if (!blec) {
-		blec = NimBLEDevice::createClient();
-		blec->setClientCallbacks(this, false);
+	auto policy = retry_policy;
+	if (retry > 0) {
+		policy.max_attempts = std::min(retry, 254) + 1;
 	}
-	blec->setConnectTimeout(connect_timeout);
-	for (int t = 0; t < 100; t++) {
-		if (blec->connect(address, true, false, false)) {
-			break;
-		}
-		if (retry <= 0 || t >= retry) {
-			DEBUG_PRINTF("BLE connect failed rc=%d (retry=%d)\n", blec->getLastError(), retry);
+	timing_start();
+	auto started = sysclock::now_ms();
+	for (uint8_t attempts = 1; !transport->connect(address, false); attempts++) {
+		int reason = transport->get_last_error();
+		connect_failures.add(reason);
+		auto delay = policy.next_delay(attempts, reason, sysclock::now_ms() - started);
+		if (!delay) {
+			DEBUG_PRINTF("BLE connect failed rc=%d (attempts=%u)\n", reason, attempts);
 			return false;
 		}
+		connect_failures.add_retry();
+		sysclock::sleep_ms(*delay);
 	}
 	set_state(state_t::connected);
 	return start_authenticate();
@@ -189,77 +473,479 @@ SesameClient::connect(int retry) {
  */
 bool
 SesameClient::start_authenticate() {
-	if (!blec) {
-		DEBUG_PRINTLN("BLE client not initialized (already disconnected?)");
+	if (!transport->open()) {
+		return false;
+	}
+	timing_mark(timing.subscribed_us);
+	return true;
+}
+
+void
+SesameClient::on_transport_discovered() {
+	timing_mark(timing.discovered_us);
+}
+
+void
+SesameClient::on_transport_received(uint8_t* data, size_t size) {
+	rx_fragments.add(data, size);
+	on_received(reinterpret_cast<std::byte*>(data), size);
+}
+
+void
+SesameClient::on_transport_disconnected(int reason) {
+	timing_mark(timing.disconnected_us);
+	timing_record();
+	on_disconnected();
+	set_state(state_t::idle);
+}
+
+void
+SesameClient::on_transport_connected() {
+	set_state(state_t::connected);
+}
+
+void
+SesameClient::on_transport_connect_failed(int reason) {
+	if (!schedule_connect_retry(reason)) {
+		set_state(state_t::connect_failed);
+	}
+}
+
+/**
+ * @brief Count a failed asynchronous attempt and schedule the next one as the retry policy tells
+ * @return false if the policy gives up
+ */
+bool
+SesameClient::schedule_connect_retry(int reason) {
+	connect_failures.add(reason);
+	auto now = sysclock::now_ms();
+	auto delay = retry_policy.next_delay(connect_attempts, reason, now - connect_started_at);
+	if (!delay) {
 		return false;
 	}
-	auto srv = blec->getService(Sesame::SESAME3_SRV_UUID);
-	if (srv && (tx = srv->getCharacteristic(Sesame::TxUUID)) && (rx = srv->getCharacteristic(Sesame::RxUUID))) {
-		if (rx->subscribe(
-		        true,
-		        [this](NimBLERemoteCharacteristic* ch, uint8_t* data, size_t size, bool isNotify) {
-			        if (!isNotify || size <= 1)
-				        return;
-			        on_received(reinterpret_cast<std::byte*>(data), size);
-		        },
-		        true)) {
-			return true;
+	// stay connecting until loop() starts the next attempt
+	DEBUG_PRINTLN("BT connect failed rc=%d, retrying in %ums", reason, *delay);
+	connect_failures.add_retry();
+	connect_retry_at = now + *delay;
+	connect_retry_pending = true;
+	return true;
+}
+
+/** Start a connection attempt delayed by the retry policy */
+void
+SesameClient::retry_connect() {
+	if (static_cast<int32_t>(sysclock::now_ms() - connect_retry_at) < 0 || !connect_retry_pending.exchange(false)) {
+		return;
+	}
+	connect_attempts++;
+	if (!transport->connect(address, true)) {
+		on_transport_connect_failed(transport->get_last_error());
+	}
+}
+
+SesameClient::Command
+SesameClient::Command::with_tag(type_t type, const char* tag) {
+	return with_tag(type, Tag::text(tag));
+}
+
+SesameClient::Command
+SesameClient::Command::with_uuid(type_t type, history_tag_type_t tag_type, const NimBLEUUID& uuid) {
+	return with_tag(type, Tag::uuid(tag_type, uuid));
+}
+
+SesameClient::Command
+SesameClient::Command::with_tag(type_t type, const Tag& tag) {
+	Command cmd{type, tag.get_type()};
+	if (!tag.is_valid() || (type == type_t::click && tag.is_uuid())) {
+		cmd.valid = false;
+		return cmd;
+	}
+	if (tag.is_uuid()) {
+		cmd.tag_uuid = tag.get_uuid();
+	} else {
+		cmd.has_tag = tag.get_text_size() > 0;
+		std::memcpy(cmd.tag, tag.get_text(), tag.get_text_size() + 1);
+	}
+	return cmd;
+}
+
+/**
+ * @brief Make a text tag
+ * @param tag UTF-8 string, truncated to MAX_CMD_TAG_SIZE bytes (nullptr for empty tag)
+ */
+SesameClient::Tag
+SesameClient::Tag::text(const char* tag) {
+	Tag t;
+	if (tag) {
+		size_t len = util::truncate_utf8(tag, MAX_CMD_TAG_SIZE);
+		std::memcpy(t.text_tag, tag, len);
+		t.text_len = static_cast<uint8_t>(util::cleanup_tail_utf8(t.text_tag, len));
+		t.text_tag[t.text_len] = 0;
+	}
+	return t;
+}
+
+/**
+ * @brief Make a UUID tag
+ * @param type tag type, must not be `none`
+ * @param uuid 128 bits UUID
+ * @return tag, is_valid() is false if `uuid` is not 128 bits or `type` is `none`
+ */
+SesameClient::Tag
+SesameClient::Tag::uuid(history_tag_type_t type, const NimBLEUUID& uuid) {
+	Tag t;
+	t.type = type;
+	if (type == history_tag_type_t::none) {
+		DEBUG_PRINTLN("Tag type must be specified for UUID tag");
+		t.valid = false;
+		return t;
+	}
+	if (uuid.bitSize() != 128) {
+		DEBUG_PRINTLN("Invalid UUID size, must be 128 bits");
+		t.valid = false;
+		return t;
+	}
+	const uint8_t* data = uuid.getValue();
+	std::reverse_copy(data, data + 16, reinterpret_cast<uint8_t*>(t.uuid_tag.data()));
+	return t;
+}
+
+/**
+ * @brief Send a command now or when the session becomes active
+ * @details Commands are kept in a bounded queue (LIBSESAME3BT_CMD_QUEUE_SIZE) in any state, including while
+ * disconnected, and written back-to-back as soon as authentication completes. Commands older than the command timeout
+ * are discarded instead of being sent. The callback is called from the task which sends the command (the caller of
+ * enqueue() if the session is active, otherwise the BLE host task); do not call disconnect() in it.
+ * @param cmd command to send
+ * @param callback called once with the result of the command
+ * @return false if the queue is full or the command is invalid (callback is not called)
+ */
+bool
+SesameClient::enqueue(const Command& cmd, command_callback_t callback) {
+	if (!cmd.valid) {
+		return false;
+	}
+	std::array<QueuedCommand, CMD_QUEUE_SIZE> expired;
+	size_t n_expired;
+	bool queued = false;
+	auto now = sysclock::now_ms();
+	{
+		std::lock_guard lock{cmd_mutex};
+		n_expired = take_expired(expired, now);
+		if (cmd_count < cmd_queue.size()) {
+			cmd_queue[(cmd_head + cmd_count) % cmd_queue.size()] = {cmd, std::move(callback), now};
+			cmd_count++;
+			queued = true;
+		}
+	}
+	for (size_t i = 0; i < n_expired; i++) {
+		if (expired[i].callback) {
+			expired[i].callback(*this, command_result_t::expired);
+		}
+	}
+	if (!queued) {
+		DEBUG_PRINTLN("Command queue full");
+		return false;
+	}
+	if (state == state_t::active) {
+		flush_commands();
+	}
+	return true;
+}
+
+size_t
+SesameClient::get_queued_count() const {
+	std::lock_guard lock{cmd_mutex};
+	return cmd_count;
+}
+
+/**
+ * @brief Discard all queued commands, callbacks are called with `cancelled`
+ */
+void
+SesameClient::clear_queue() {
+	std::array<QueuedCommand, CMD_QUEUE_SIZE> removed;
+	size_t n;
+	{
+		std::lock_guard lock{cmd_mutex};
+		for (n = 0; cmd_count > 0; n++) {
+			removed[n] = std::move(cmd_queue[cmd_head]);
+			cmd_queue[cmd_head] = {};
+			cmd_head = (cmd_head + 1) % cmd_queue.size();
+			cmd_count--;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (removed[i].callback) {
+			removed[i].callback(*this, command_result_t::cancelled);
+		}
+	}
+}
+
+/** Move expired commands at the head of the queue to `out` (cmd_mutex must be held) */
+size_t
+SesameClient::take_expired(std::array<QueuedCommand, CMD_QUEUE_SIZE>& out, uint32_t now) {
+	size_t n = 0;
+	while (cmd_count > 0 && now - cmd_queue[cmd_head].queued_at > command_timeout) {
+		out[n++] = std::move(cmd_queue[cmd_head]);
+		cmd_queue[cmd_head] = {};
+		cmd_head = (cmd_head + 1) % cmd_queue.size();
+		cmd_count--;
+	}
+	return n;
+}
+
+/**
+ * Only one task sends at a time so that commands are written in queued order.
+ */
+void
+SesameClient::flush_commands() {
+	{
+		std::lock_guard lock{cmd_mutex};
+		if (cmd_flushing) {
+			return;
+		}
+		cmd_flushing = true;
+	}
+	for (;;) {
+		QueuedCommand item;
+		{
+			std::lock_guard lock{cmd_mutex};
+			if (cmd_count == 0 || state != state_t::active) {
+				cmd_flushing = false;
+				return;
+			}
+			item = std::move(cmd_queue[cmd_head]);
+			cmd_queue[cmd_head] = {};
+			cmd_head = (cmd_head + 1) % cmd_queue.size();
+			cmd_count--;
+		}
+		command_result_t result;
+		if (sysclock::now_ms() - item.queued_at > command_timeout) {
+			result = command_result_t::expired;
 		} else {
-			DEBUG_PRINTLN("Failed to subscribe RX char, rc=%d", blec->getLastError());
+			result = send_command(item.cmd) ? command_result_t::sent : command_result_t::failed;
+		}
+		if (item.callback) {
+			item.callback(*this, result);
 		}
-	} else {
-		DEBUG_PRINTLN("The device does not have TX or RX chars, rc=%d", blec->getLastError());
 	}
-	return false;
+}
+
+/**
+ * @brief Connect, authenticate, send a command, wait for the response and disconnect in one call
+ * @details Stages are chained as soon as possible: the command is written from the BLE host task the moment the
+ * session becomes active. Stages which must not run on the BLE host task (start_authenticate(), disconnect()) are
+ * executed by loop(), call it frequently (every 10ms or so) while is_operating(). If the session is already active,
+ * the command is sent immediately and the session is kept. The callback is called once from loop().
+ * @param cmd command to send
+ * @param callback receives the result and per-stage times
+ * @param timeout deadline of the whole operation (ms)
+ * @return false if another operation or connection is in progress or the command is invalid (callback is not called)
+ */
+bool
+SesameClient::operate_async(const Command& cmd, operation_callback_t callback, uint32_t timeout) {
+	if (!cmd.valid || is_operating() || (state != state_t::idle && state != state_t::active && state != state_t::connect_failed)) {
+		return false;
+	}
+	op_command = cmd;
+	op_callback = callback;
+	op_timeout = timeout;
+	op_started_at = sysclock::now_ms();
+	op_events = 0;
+	op_connected_at = op_active_at = op_sent_at = op_confirmed_at = op_started_at;
+	if (state == state_t::active) {
+		op_owns_connection = false;
+		op_events = OP_CONNECTED | OP_ACTIVE;
+		op_stage = op_stage_t::sending;
+		op_send();
+		return true;
+	}
+	op_owns_connection = true;
+	op_stage = op_stage_t::connecting;
+	if (!connect_async()) {
+		op_stage = op_stage_t::none;
+		return false;
+	}
+	return true;
 }
 
 void
-SesameClient::onDisconnect(NimBLEClient* pClient, int reason) {
-	DEBUG_PRINTLN("BT disconnected by peer, rc=%d", reason);
-	on_disconnected();
+SesameClient::op_mark(op_event_t event, uint32_t& at) {
+	at = sysclock::now_ms();
+	op_events.fetch_or(event, std::memory_order_release);
 }
 
 void
-SesameClient::onConnect(NimBLEClient* pClient) {
-	if (!is_async_connect) {
+SesameClient::op_send() {
+	if (op_stage == op_stage_t::none || (op_events & (OP_SENT | OP_SEND_FAILED))) {
 		return;
 	}
-	DEBUG_PRINTLN("BT connected");
-	set_state(state_t::connected);
+	if (send_command(op_command)) {
+		op_mark(OP_SENT, op_sent_at);
+	} else {
+		op_mark(OP_SEND_FAILED, op_sent_at);
+	}
 }
 
+/**
+ * @brief Advance operate_async() and the transport (MTU negotiation), call periodically from application task
+ */
 void
-SesameClient::onConnectFail(NimBLEClient* pClient, int reason) {
-	if (!is_async_connect) {
+SesameClient::loop() {
+	transport->loop();
+	if (connect_retry_pending) {
+		retry_connect();
+	}
+	if (status_pending) {
+		flush_status();
+	}
+	auto stage = op_stage.load();
+	if (stage == op_stage_t::none) {
 		return;
 	}
-	DEBUG_PRINTLN("BT connect failed, rc=%d", reason);
-	blec->setClientCallbacks(nullptr, false);
-	set_state(state_t::connect_failed);
+	uint8_t events = op_events.load(std::memory_order_acquire);
+	switch (stage) {
+		case op_stage_t::connecting:
+			if (events & (OP_CONNECT_FAILED | OP_IDLE)) {
+				op_finish(operation_result_t::connect_failed);
+				return;
+			}
+			if (!(events & OP_CONNECTED)) {
+				break;
+			}
+			if (!start_authenticate()) {
+				op_finish(operation_result_t::auth_failed);
+				return;
+			}
+			op_stage = op_stage_t::authenticating;
+			[[fallthrough]];
+		case op_stage_t::authenticating:
+			if (!(events & (OP_SENT | OP_SEND_FAILED))) {
+				if (events & OP_IDLE) {
+					op_finish(operation_result_t::auth_failed);
+					return;
+				}
+				break;
+			}
+			op_stage = op_stage_t::sending;
+			[[fallthrough]];
+		case op_stage_t::sending:
+			if (events & OP_SEND_FAILED) {
+				op_finish(operation_result_t::send_failed);
+				return;
+			}
+			if (!(events & OP_SENT)) {
+				break;
+			}
+			op_stage = op_stage_t::confirming;
+			[[fallthrough]];
+		case op_stage_t::confirming:
+			if (events & OP_CONFIRMED) {
+				op_finish(operation_result_t::success);
+				return;
+			}
+			break;
+		default:
+			break;
+	}
+	if (sysclock::now_ms() - op_started_at > op_timeout) {
+		op_finish(op_stage == op_stage_t::confirming ? operation_result_t::unconfirmed : operation_result_t::timeout);
+	}
+}
+
+void
+SesameClient::op_finish(operation_result_t result) {
+	uint8_t events = op_events;
+	auto now = sysclock::now_ms();
+	OperationReport report{result, 0, 0, 0, 0, now - op_started_at};
+	if (events & OP_CONNECTED) {
+		report.connect_ms = op_connected_at - op_started_at;
+	}
+	if (events & OP_ACTIVE) {
+		report.authenticate_ms = op_active_at - op_connected_at;
+	}
+	if (events & OP_SENT) {
+		report.send_ms = op_sent_at - op_active_at;
+	}
+	if (events & OP_CONFIRMED) {
+		report.confirm_ms = op_confirmed_at - op_sent_at;
+	}
+	op_stage = op_stage_t::none;
+	if (op_owns_connection) {
+		disconnect();
+	}
+	auto callback = std::move(op_callback);
+	op_callback = nullptr;
+	if (callback) {
+		callback(*this, report);
+	}
+}
+
+bool
+SesameClient::send_command(const Command& cmd) {
+	switch (cmd.type) {
+		case Command::type_t::lock:
+			return cmd.tag_type != history_tag_type_t::none ? SesameClientCore::lock(cmd.tag_type, cmd.tag_uuid)
+			                                                : SesameClientCore::lock(cmd.tag);
+		case Command::type_t::unlock:
+			return cmd.tag_type != history_tag_type_t::none ? SesameClientCore::unlock(cmd.tag_type, cmd.tag_uuid)
+			                                                : SesameClientCore::unlock(cmd.tag);
+		case Command::type_t::click:
+			if (cmd.script >= 0) {
+				return SesameClientCore::click(std::optional<uint8_t>{static_cast<uint8_t>(cmd.script)});
+			}
+			return cmd.has_tag ? SesameClientCore::click(cmd.tag) : SesameClientCore::click();
+		case Command::type_t::request_status:
+			return SesameClientCore::request_status();
+		case Command::type_t::request_history:
+			return SesameClientCore::request_history();
+	}
+	return false;
 }
 
 bool
 SesameClient::unlock(history_tag_type_t type, const NimBLEUUID& uuid) {
-	if (uuid.bitSize() != 128) {
-		DEBUG_PRINTLN("Invalid UUID size, must be 128 bits");
+	return unlock(Tag::uuid(type, uuid));
+}
+
+bool
+SesameClient::lock(history_tag_type_t type, const NimBLEUUID& uuid) {
+	return lock(Tag::uuid(type, uuid));
+}
+
+/**
+ * @details A UUID tag is passed to the core as encoded. A text tag is passed as a C string and the core truncates it
+ * again (see Tag).
+ */
+bool
+SesameClient::unlock(const Tag& tag) {
+	if (!tag.is_valid()) {
 		return false;
 	}
-	std::array<std::byte, HISTORY_TAG_UUID_SIZE> tag_uuid{};
-	const uint8_t* data = uuid.getValue();
-	std::reverse_copy(data, data + 16, reinterpret_cast<uint8_t*>(tag_uuid.data()));
-	return SesameClientCore::unlock(type, tag_uuid);
+	return tag.is_uuid() ? SesameClientCore::unlock(tag.get_type(), tag.get_uuid()) : SesameClientCore::unlock(tag.get_text());
 }
 
+/** @details Same as unlock(const Tag&): a text tag is truncated again by the core. */
 bool
-SesameClient::lock(history_tag_type_t type, const NimBLEUUID& uuid) {
-	if (uuid.bitSize() != 128) {
-		DEBUG_PRINTLN("Invalid UUID size, must be 128 bits");
+SesameClient::lock(const Tag& tag) {
+	if (!tag.is_valid()) {
 		return false;
 	}
-	std::array<std::byte, HISTORY_TAG_UUID_SIZE> tag_uuid{};
-	const uint8_t* data = uuid.getValue();
-	std::reverse_copy(data, data + 16, reinterpret_cast<uint8_t*>(tag_uuid.data()));
-	return SesameClientCore::lock(type, tag_uuid);
+	return tag.is_uuid() ? SesameClientCore::lock(tag.get_type(), tag.get_uuid()) : SesameClientCore::lock(tag.get_text());
+}
+
+/**
+ * @brief Click with a text tag
+ * @details The text is passed as a C string and the core truncates it again (see Tag).
+ * @return false if `tag` is a UUID tag (not supported by click)
+ */
+bool
+SesameClient::click(const Tag& tag) {
+	if (!tag.is_valid() || tag.is_uuid()) {
+		return false;
+	}
+	return tag.get_text_size() ? SesameClientCore::click(tag.get_text()) : SesameClientCore::click();
 }
 
 }  // namespace libsesame3bt
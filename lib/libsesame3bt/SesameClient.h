@@ -2,7 +2,22 @@
 
 #include <NimBLEDevice.h>
 #include <libsesame3bt/ClientCore.h>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include "Executor.h"
+#include "RetryPolicy.h"
+#include "SessionStats.h"
+#include "Transport.h"
+
+#ifndef LIBSESAME3BT_CMD_QUEUE_SIZE
+#define LIBSESAME3BT_CMD_QUEUE_SIZE 4
+#endif
 
 namespace libsesame3bt {
 
@@ -10,7 +25,7 @@ namespace libsesame3bt {
  * @brief Sesame client
  *
  */
-class SesameClient : private core::SesameClientCore, private NimBLEClientCallbacks, private core::SesameBLEBackend {
+class SesameClient : private core::SesameClientCore, private Transport::Handler, private core::SesameBLEBackend {
  public:
 	enum class state_t { idle, connected, authenticating, active, connecting, connect_failed };
 	static constexpr size_t MAX_CMD_TAG_SIZE = Sesame::MAX_HISTORY_TAG_SIZE;
@@ -24,6 +39,182 @@ class SesameClient : private core::SesameClientCore, private NimBLEClientCallbac
 	using state_callback_t = std::function<void(SesameClient& client, state_t state)>;
 	using history_callback_t = std::function<void(SesameClient& client, const History& history)>;
 	using registered_devices_callback_t = std::function<void(SesameClient& client, const std::vector<RegisteredDevice> devices)>;
+	static constexpr size_t CMD_QUEUE_SIZE = LIBSESAME3BT_CMD_QUEUE_SIZE;
+
+	/**
+	 * @brief Receiver of client events
+	 * @details Alternative to the four std::function callbacks: one object is called directly. Called from the BLE host
+	 * task (on_state also from the caller of connect() / disconnect()).
+	 */
+	class Listener {
+	 public:
+		virtual ~Listener() = default;
+		virtual void on_state(SesameClient& /* client */, state_t /* state */) {}
+		virtual void on_status(SesameClient& /* client */, Status /* status */) {}
+		virtual void on_history(SesameClient& /* client */, const History& /* history */) {}
+		virtual void on_registered_devices(SesameClient& /* client */, const std::vector<RegisteredDevice>& /* devices */) {}
+	};
+
+	/**
+	 * @brief History tag validated and encoded once
+	 * @details Text is truncated to MAX_CMD_TAG_SIZE on UTF-8 boundary, UUID is stored in wire byte order. One tag may be
+	 * used by any number of commands and clients.
+	 * Only UUID tags are sent as encoded here. libsesame3bt-core takes text tags as C strings, so a text tag is
+	 * measured and truncated again by the core on every lock(), unlock() and click(); a Tag saves that work only for
+	 * Command, which copies the truncated text once.
+	 */
+	class Tag {
+	 public:
+		Tag() = default;
+		static Tag text(const char* tag);
+		static Tag uuid(history_tag_type_t type, const NimBLEUUID& uuid);
+		/** false if made from an invalid UUID */
+		bool is_valid() const { return valid; }
+		bool is_uuid() const { return type != history_tag_type_t::none; }
+		history_tag_type_t get_type() const { return type; }
+		/** text tag (empty for UUID tag) */
+		const char* get_text() const { return text_tag; }
+		size_t get_text_size() const { return text_len; }
+		const std::array<std::byte, HISTORY_TAG_UUID_SIZE>& get_uuid() const { return uuid_tag; }
+
+	 private:
+		history_tag_type_t type = history_tag_type_t::none;
+		bool valid = true;
+		uint8_t text_len = 0;
+		char text_tag[MAX_CMD_TAG_SIZE + 1]{};
+		std::array<std::byte, HISTORY_TAG_UUID_SIZE> uuid_tag{};
+	};
+
+	/**
+	 * @brief Command accepted by enqueue()
+	 */
+	struct Command {
+		enum class type_t : uint8_t { lock, unlock, click, request_status, request_history };
+		type_t type;
+		/** tag type of UUID tag, `none` to use text tag */
+		history_tag_type_t tag_type = history_tag_type_t::none;
+		std::array<std::byte, HISTORY_TAG_UUID_SIZE> tag_uuid{};
+		bool has_tag = false;
+		char tag[MAX_CMD_TAG_SIZE + 1]{};
+		/** script number of click, -1 for default */
+		int16_t script = -1;
+		/** false if the factory function got an invalid argument, enqueue() rejects it */
+		bool valid = true;
+
+		static Command lock(const char* tag) { return with_tag(type_t::lock, tag); }
+		static Command unlock(const char* tag) { return with_tag(type_t::unlock, tag); }
+		static Command lock(history_tag_type_t type, const NimBLEUUID& uuid) { return with_uuid(type_t::lock, type, uuid); }
+		static Command unlock(history_tag_type_t type, const NimBLEUUID& uuid) { return with_uuid(type_t::unlock, type, uuid); }
+		static Command lock(const Tag& tag) { return with_tag(type_t::lock, tag); }
+		static Command unlock(const Tag& tag) { return with_tag(type_t::unlock, tag); }
+		static Command click(const char* tag = nullptr) { return with_tag(type_t::click, tag); }
+		static Command click(const Tag& tag) { return with_tag(type_t::click, tag); }
+		static Command click(uint8_t script) {
+			Command cmd{type_t::click};
+			cmd.script = script;
+			return cmd;
+		}
+		static Command request_status() { return {type_t::request_status}; }
+		static Command request_history() { return {type_t::request_history}; }
+
+	 private:
+		static Command with_tag(type_t type, const char* tag);
+		static Command with_uuid(type_t type, history_tag_type_t tag_type, const NimBLEUUID& uuid);
+		static Command with_tag(type_t type, const Tag& tag);
+	};
+	enum class command_result_t : uint8_t {
+		/** written to the device */
+		sent,
+		/** failed to write */
+		failed,
+		/** not sent within the command timeout */
+		expired,
+		/** removed by clear_queue() */
+		cancelled,
+	};
+	using command_callback_t = std::function<void(SesameClient& client, command_result_t result)>;
+	enum class operation_result_t : uint8_t {
+		/** command sent and the device responded (status or history) */
+		success,
+		/** command sent but no response before the deadline */
+		unconfirmed,
+		connect_failed,
+		auth_failed,
+		send_failed,
+		/** deadline expired before the command was sent */
+		timeout,
+	};
+	/**
+	 * @brief Result of operate_async()
+	 * @details Stage times are in milliseconds, 0 for stages not reached or skipped (already connected).
+	 */
+	struct OperationReport {
+		operation_result_t result;
+		uint32_t connect_ms;
+		uint32_t authenticate_ms;
+		uint32_t send_ms;
+		uint32_t confirm_ms;
+		uint32_t total_ms;
+	};
+	using operation_callback_t = std::function<void(SesameClient& client, const OperationReport& report)>;
+	using ConnectionParams = libsesame3bt::ConnectionParams;
+
+	/**
+	 * @brief Condition of status notifications delivered to the status callback / listener
+	 * @details A notification is delivered when a field in `fields` differs from the last delivered status. Position and
+	 * voltage count as changed only when they move more than the hysteresis, and such changes are delivered at most once
+	 * per `min_interval_ms`: the last status suppressed by the interval is delivered by loop() when the interval has
+	 * passed. The first status of each session is always delivered.
+	 */
+	struct StatusFilter {
+		enum field_t : uint16_t {
+			IN_LOCK = 1,
+			IN_UNLOCK = 2,
+			CRITICAL = 4,
+			CLUTCH_FAILED = 8,
+			BATTERY_CRITICAL = 16,
+			STOPPED = 32,
+			MOTOR_STATUS = 64,
+			TARGET = 128,
+			POSITION = 256,
+			VOLTAGE = 512,
+			ALL = 1023,
+		};
+		/** bitwise OR of field_t */
+		uint16_t fields = ALL;
+		/** voltage change ignored (V) */
+		float voltage_hysteresis = 0.0f;
+		/** position change ignored */
+		uint16_t position_hysteresis = 0;
+		/** minimum interval of deliveries caused by position or voltage change (ms) */
+		uint32_t min_interval_ms = 0;
+
+		/**
+		 * @brief Check whether `status` differs meaningfully from `last`
+		 * @param last last delivered status
+		 * @param status new status
+		 * @param elapsed_ms time since `last` was delivered
+		 * @tparam S Status compatible type
+		 */
+		template <typename S>
+		bool is_changed(const S& last, const S& status, uint32_t elapsed_ms) const {
+			auto differs = [this](field_t field, bool changed) { return (fields & field) && changed; };
+			if (differs(IN_LOCK, status.in_lock() != last.in_lock()) || differs(IN_UNLOCK, status.in_unlock() != last.in_unlock()) ||
+			    differs(CRITICAL, status.is_critical() != last.is_critical()) ||
+			    differs(CLUTCH_FAILED, status.is_clutch_failed() != last.is_clutch_failed()) ||
+			    differs(BATTERY_CRITICAL, status.battery_critical() != last.battery_critical()) ||
+			    differs(STOPPED, status.stopped() != last.stopped()) ||
+			    differs(MOTOR_STATUS, status.motor_status() != last.motor_status()) ||
+			    differs(TARGET, status.target() != last.target())) {
+				return true;
+			}
+			if (elapsed_ms < min_interval_ms) {
+				return false;
+			}
+			return differs(POSITION, std::abs(status.position() - last.position()) > position_hysteresis) ||
+			       differs(VOLTAGE, std::fabs(status.voltage() - last.voltage()) > voltage_hysteresis);
+		}
+	};
 
 	SesameClient();
 	SesameClient(const SesameClient&) = delete;
@@ -35,11 +226,61 @@ class SesameClient : private core::SesameClientCore, private NimBLEClientCallbac
 	bool connect_async();
 	bool start_authenticate();
 	virtual void disconnect() override;
-	void set_connect_timeout(uint32_t timeout) { connect_timeout = timeout; }
-	void set_status_callback(status_callback_t callback) { status_callback = callback; }
-	void set_state_callback(state_callback_t callback) { state_callback = callback; }
-	void set_history_callback(history_callback_t callback) { history_callback = callback; }
-	void set_registered_devices_callback(registered_devices_callback_t callback) { registered_devices_callback = callback; }
+	void set_connect_timeout(uint32_t timeout) { ble.set_connect_timeout(timeout); }
+	/** Retry failed connections of connect() and connect_async() (asynchronous retries are started by loop()) */
+	void set_retry_policy(const RetryPolicy& policy) { retry_policy = policy; }
+	const RetryPolicy& get_retry_policy() const { return retry_policy; }
+	/** Failed connection attempts by reason */
+	const FailureCounter& get_connect_failures() const { return connect_failures; }
+	void clear_connect_failures() { connect_failures.clear(); }
+	bool set_connection_params(const ConnectionParams& params);
+	const std::optional<ConnectionParams>& get_connection_params() const { return ble.get_connection_params(); }
+	void set_mtu_exchange(bool enable, uint16_t data_len = 251);
+	/** ATT MTU of the current session, 0 if not connected */
+	uint16_t get_mtu() const { return transport->get_mtu(); }
+	bool set_transport(Transport* transport);
+	Transport& get_transport() const { return *transport; }
+	/** Fragments of messages received from the device */
+	const FragmentCounter& get_rx_fragments() const { return rx_fragments; }
+	/** Fragments of messages written to the device */
+	const FragmentCounter& get_tx_fragments() const { return tx_fragments; }
+	void clear_fragment_counters() {
+		rx_fragments.clear();
+		tx_fragments.clear();
+	}
+	void set_attribute_cache(bool enable);
+	/** Deliver only status notifications with meaningful changes (see StatusFilter) */
+	void set_status_filter(const StatusFilter& filter) {
+		std::lock_guard lock{status_mutex};
+		status_filter = filter;
+	}
+	/** Deliver all status notifications (default) */
+	void clear_status_filter() {
+		std::lock_guard lock{status_mutex};
+		status_filter.reset();
+		pending_status.reset();
+	}
+	/** Number of status notifications not delivered by the status filter */
+	uint32_t get_suppressed_status_count() const { return suppressed_statuses; }
+	void reset_suppressed_status_count() { suppressed_statuses = 0; }
+	void set_status_callback(status_callback_t callback);
+	void set_state_callback(state_callback_t callback);
+	void set_history_callback(history_callback_t callback);
+	void set_registered_devices_callback(registered_devices_callback_t callback);
+	/**
+	 * @brief Receive events by `listener` instead of callbacks
+	 * @details set_*_callback() switches back to the callbacks.
+	 * @param listener must outlive the client, nullptr to stop
+	 */
+	void set_listener(Listener* listener) { this->listener = listener; }
+	/** Listener receiving events, an internal one when callbacks are used (to chain a listener to it) */
+	Listener* get_listener() const { return listener; }
+	/**
+	 * @brief Deliver listener / callback events through `executor` instead of calling them on the BLE host task
+	 * @details Events are delivered in order. The client must outlive the events queued to the executor.
+	 * @param executor executor (may be shared by clients and scanner), nullptr to call directly
+	 */
+	void set_executor(Executor* executor) { this->executor = executor; }
 	// warning: oveloading core method
 	state_t get_state() const { return state; }
 	/**
@@ -47,9 +288,24 @@ class SesameClient : private core::SesameClientCore, private NimBLEClientCallbac
 	 * @details This function may return nullptr when get_state() is `idle`, please check before use.
 	 * @return NimBLEClient*
 	 */
-	NimBLEClient* get_ble_client() const { return blec; }
+	NimBLEClient* get_ble_client() const { return ble.get_client(); }
+	bool enqueue(const Command& cmd, command_callback_t callback = nullptr);
+	size_t get_queued_count() const;
+	void clear_queue();
+	/** Queued commands not sent within this period are discarded (ms) */
+	void set_command_timeout(uint32_t timeout) { command_timeout = timeout; }
+	/** Phase times of the current (or last) session */
+	const SessionTiming& get_session_timing() const { return timing; }
+	/** Record phase latencies of every session to `stats` (nullptr to stop), may be shared by clients */
+	void set_session_stats(SessionStats* stats) { session_stats = stats; }
+	bool operate_async(const Command& cmd, operation_callback_t callback, uint32_t timeout = 15'000);
+	bool is_operating() const { return op_stage != op_stage_t::none; }
+	void loop();
 	bool unlock(history_tag_type_t type, const NimBLEUUID& uuid);
 	bool lock(history_tag_type_t type, const NimBLEUUID& uuid);
+	bool unlock(const Tag& tag);
+	bool lock(const Tag& tag);
+	bool click(const Tag& tag);
 
 	static NimBLEAddress uuid_to_ble_address(const NimBLEUUID& uuid);
 
@@ -66,23 +322,99 @@ class SesameClient : private core::SesameClientCore, private NimBLEClientCallbac
 
  private:
 	NimBLEAddress address;
-	NimBLEClient* blec = nullptr;
-	NimBLERemoteCharacteristic* tx = nullptr;
-	NimBLERemoteCharacteristic* rx = nullptr;
-	status_callback_t status_callback{};
-	state_callback_t state_callback{};
-	history_callback_t history_callback{};
-	registered_devices_callback_t registered_devices_callback{};
-	state_t state = state_t::idle;
-	uint32_t connect_timeout = 30'000;
-	bool is_async_connect;
+	NimBLETransport ble;
+	/** `ble` or the transport given to set_transport() */
+	Transport* transport = &ble;
+	class CallbackListener;
+	Listener* listener = nullptr;
+	Executor* executor = nullptr;
+	/** holds callbacks set by set_*_callback(), allocated on first use */
+	std::unique_ptr<CallbackListener> callbacks;
+	/** written by the BLE host task, polled with get_state() by other tasks */
+	std::atomic<state_t> state{state_t::idle};
+	RetryPolicy retry_policy{};
+	FailureCounter connect_failures;
+	uint8_t connect_attempts = 0;
+	uint32_t connect_started_at = 0;
+	uint32_t connect_retry_at = 0;
+	/** asynchronous retry waits for connect_retry_at, started by loop() */
+	std::atomic<bool> connect_retry_pending{false};
+	FragmentCounter rx_fragments;
+	FragmentCounter tx_fragments;
+	/** guards the status filter state, held while delivering a status (recursive: callbacks may change the filter) */
+	std::recursive_mutex status_mutex;
+	std::optional<StatusFilter> status_filter;
+	/** last status delivered in this session */
+	std::optional<Status> delivered_status;
+	uint32_t delivered_status_at = 0;
+	/** last status suppressed by the filter, delivered by loop() after min_interval_ms */
+	std::optional<Status> pending_status;
+	std::atomic<bool> status_pending{false};
+	std::atomic<uint32_t> suppressed_statuses{0};
+
+	struct QueuedCommand {
+		Command cmd;
+		command_callback_t callback;
+		uint32_t queued_at;
+	};
+	mutable std::mutex cmd_mutex;
+	std::array<QueuedCommand, CMD_QUEUE_SIZE> cmd_queue{};
+	size_t cmd_head = 0;
+	size_t cmd_count = 0;
+	bool cmd_flushing = false;
+	uint32_t command_timeout = 30'000;
+
+	SessionTiming timing{};
+	bool timing_recorded = true;
+	SessionStats* session_stats = nullptr;
+
+	enum class op_stage_t : uint8_t { none, connecting, authenticating, sending, confirming };
+	enum op_event_t : uint8_t {
+		OP_CONNECTED = 1,
+		OP_CONNECT_FAILED = 2,
+		OP_ACTIVE = 4,
+		OP_IDLE = 8,
+		OP_SENT = 16,
+		OP_SEND_FAILED = 32,
+		OP_CONFIRMED = 64,
+	};
+	std::atomic<op_stage_t> op_stage{op_stage_t::none};
+	std::atomic<uint8_t> op_events{0};
+	Command op_command{};
+	bool op_owns_connection = false;
+	operation_callback_t op_callback{};
+	uint32_t op_started_at = 0;
+	uint32_t op_timeout = 0;
+	uint32_t op_connected_at = 0;
+	uint32_t op_active_at = 0;
+	uint32_t op_sent_at = 0;
+	uint32_t op_confirmed_at = 0;
+	uint32_t op_lost_at = 0;
 
 	void core_state_callback(core::SesameClientCore& core, core::state_t state);
 	void set_state(state_t state);
+	void filter_status(const Status& status);
+	void flush_status();
+	CallbackListener& use_callbacks();
+	template <typename... Args>
+	void emit(void (Listener::*event)(SesameClient&, Args...), const std::decay_t<Args>&... args);
+	void timing_start();
+	void timing_mark(uint32_t& phase_us);
+	void timing_record();
+	void op_mark(op_event_t event, uint32_t& at);
+	void op_send();
+	void op_finish(operation_result_t result);
+	void flush_commands();
+	bool send_command(const Command& cmd);
+	size_t take_expired(std::array<QueuedCommand, CMD_QUEUE_SIZE>& out, uint32_t now);
 
-	virtual void onDisconnect(NimBLEClient* pClient, int reason) override;
-	virtual void onConnect(NimBLEClient* pClient) override;
-	virtual void onConnectFail(NimBLEClient* pClient, int reason) override;
+	virtual void on_transport_connected() override;
+	virtual void on_transport_connect_failed(int reason) override;
+	bool schedule_connect_retry(int reason);
+	void retry_connect();
+	virtual void on_transport_disconnected(int reason) override;
+	virtual void on_transport_received(uint8_t* data, size_t size) override;
+	virtual void on_transport_discovered() override;
 	virtual bool write_to_tx(const uint8_t* data, size_t size) override;
 };
 
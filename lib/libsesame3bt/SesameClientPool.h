@@ -0,0 +1,292 @@
+#pragma once
+#include <Sesame.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "ConnectScheduler.h"
+#include "SesameClient.h"
+#include "clock.h"
+
+namespace libsesame3bt {
+
+/**
+ * @brief Connection slot manager for more devices than BLE connections
+ * @details The pool owns any number of devices but keeps at most `max_connections` of them connected. Operations
+ * submitted for a device run as soon as its session is active. Devices without session wait until a connection slot is
+ * free; when all slots are used, the least recently used session without pending operations is disconnected.
+ * Sessions are opened through a ConnectScheduler, which starts connections one at a time (NimBLE rejects a second
+ * connection attempt while one is in progress) and authenticates established connections.
+ * Do not enable the attribute cache of clients (SesameClient::set_attribute_cache()) when there are more devices than
+ * connections, kept NimBLE clients use up the connections.
+ * All functions must be called from the same task. loop() polls get_state() of the clients, so their state callback
+ * and Listener stay free for the application. loop() also calls loop() of every client, the application does not
+ * need to.
+ * @tparam Client SesameClient compatible class (begin(), set_keys(), connect_async(), start_authenticate(),
+ * disconnect(), get_state(), loop())
+ */
+template <typename Client = SesameClient>
+class SesameClientPool {
+ public:
+	using state_t = typename Client::state_t;
+	/** Operation executed with active client, return false on failure */
+	using operation_t = std::function<bool(Client& client)>;
+	/** Called when the operation is done (true) or failed (false, including connection failure) */
+	using completion_t = std::function<void(int device, bool success)>;
+#ifdef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+	static constexpr size_t DEFAULT_MAX_CONNECTIONS = CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+#else
+	static constexpr size_t DEFAULT_MAX_CONNECTIONS = 3;
+#endif
+	static constexpr size_t MAX_PENDING = 8;
+
+	struct Metrics {
+		uint32_t submitted;
+		uint32_t completed;
+		uint32_t failed;
+		uint32_t rejected;
+		uint32_t connects;
+		uint32_t connect_failures;
+		uint32_t evictions;
+		/** sum / maximum of time from submit() to execution or failure (ms) */
+		uint64_t total_wait_ms;
+		uint32_t max_wait_ms;
+		/** time of the first submit() (sysclock::now_ms()) */
+		uint32_t started_at;
+
+		uint32_t mean_wait_ms() const { return completed + failed ? total_wait_ms / (completed + failed) : 0; }
+		/** completed operations per minute since the first submit() */
+		float throughput(uint32_t now_ms) const {
+			uint32_t elapsed = now_ms - started_at;
+			return elapsed ? completed * 60'000.0f / elapsed : 0.0f;
+		}
+	};
+
+	explicit SesameClientPool(size_t max_connections = DEFAULT_MAX_CONNECTIONS) : max_connections(max_connections) {}
+	SesameClientPool(const SesameClientPool&) = delete;
+	SesameClientPool& operator=(const SesameClientPool&) = delete;
+
+	/**
+	 * @brief Register a device
+	 * @return device number (0, 1, ...), -1 on error
+	 */
+	int add(const NimBLEAddress& address, Sesame::model_t model, const char* pk_str, const char* secret_str) {
+		auto dev = std::make_unique<Device>();
+		if (!dev->client.begin(address, model) || !dev->client.set_keys(pk_str, secret_str)) {
+			return -1;
+		}
+		devices.push_back(std::move(dev));
+		return static_cast<int>(devices.size() - 1);
+	}
+
+	/**
+	 * @brief Queue an operation
+	 * @param device device number returned by add()
+	 * @param op operation, called from loop() with active client
+	 * @param done completion callback, called from loop()
+	 * @return false if device number is invalid or too many operations are queued for the device
+	 */
+	bool submit(int device, operation_t op, completion_t done = nullptr) {
+		if (device < 0 || static_cast<size_t>(device) >= devices.size() || !op) {
+			return false;
+		}
+		auto& dev = *devices[device];
+		auto now = sysclock::now_ms();
+		if (metrics.submitted == 0) {
+			metrics.started_at = now;
+		}
+		if (dev.pending.size() >= MAX_PENDING) {
+			metrics.rejected++;
+			return false;
+		}
+		dev.pending.push_back({std::move(op), std::move(done), now});
+		metrics.submitted++;
+		return true;
+	}
+
+	/**
+	 * @brief Drive connections and operations, call periodically
+	 */
+	void loop() {
+		auto now = sysclock::now_ms();
+		for (auto& dev : devices) {
+			// clients being opened are run by the scheduler
+			if (dev->phase != phase_t::opening) {
+				dev->client.loop();
+			}
+			if (dev->phase == phase_t::active && dev->client.get_state() != state_t::active) {
+				close(*dev);
+			}
+		}
+		admit(now);
+		scheduler.loop();
+		for (size_t i = 0; i < devices.size(); i++) {
+			auto& dev = *devices[i];
+			if (dev.phase == phase_t::active) {
+				run_pending(static_cast<int>(i), dev, now);
+				if (idle_timeout_ms && dev.pending.empty() && now - dev.last_used > idle_timeout_ms) {
+					close(dev);
+				}
+			}
+		}
+	}
+
+	Client* get_client(int device) {
+		return device >= 0 && static_cast<size_t>(device) < devices.size() ? &devices[device]->client : nullptr;
+	}
+	size_t size() const { return devices.size(); }
+	size_t get_connection_count() const {
+		return std::count_if(devices.cbegin(), devices.cend(), [](const auto& d) { return d->phase != phase_t::closed; });
+	}
+	size_t get_pending_count() const {
+		size_t n = 0;
+		for (const auto& d : devices) {
+			n += d->pending.size();
+		}
+		return n;
+	}
+	const Metrics& get_metrics() const { return metrics; }
+	void reset_metrics() { metrics = {}; }
+	/** Time limit of connection and authentication (ms) */
+	void set_session_timeout(uint32_t timeout_ms) { scheduler.set_session_timeout(timeout_ms); }
+	/** Disconnect sessions without operation for this period even if the slot is not needed (ms, 0: never) */
+	void set_idle_timeout(uint32_t timeout_ms) { idle_timeout_ms = timeout_ms; }
+	/** Fail queued operations after this number of consecutive connection failures */
+	void set_max_attempts(uint8_t attempts) { max_attempts = std::max<uint8_t>(attempts, 1); }
+	/** Wait before connecting again after a connection failure (ms) */
+	void set_retry_delay(uint32_t delay_ms) { retry_delay_ms = delay_ms; }
+
+ private:
+	using report_t = typename ConnectScheduler<Client>::Report;
+	using result_t = typename ConnectScheduler<Client>::result_t;
+	/** opening: requested to the scheduler */
+	enum class phase_t : uint8_t { closed, opening, active };
+	struct Request {
+		operation_t op;
+		completion_t done;
+		uint32_t submitted_at;
+	};
+	struct Device {
+		Client client;
+		std::deque<Request> pending;
+		phase_t phase = phase_t::closed;
+		uint32_t last_used = 0;
+		uint32_t retry_at = 0;
+		uint8_t attempts = 0;
+	};
+
+	std::vector<std::unique_ptr<Device>> devices;
+	size_t max_connections;
+	// declared after `devices`, destroyed before the clients it refers to
+	ConnectScheduler<Client> scheduler;
+	uint32_t idle_timeout_ms = 0;
+	uint32_t retry_delay_ms = 1'000;
+	uint8_t max_attempts = 3;
+	Metrics metrics{};
+
+	void on_opened(int id, const report_t& report) {
+		auto& dev = *devices[id];
+		auto now = sysclock::now_ms();
+		if (report.result != result_t::active) {
+			fail_session(id, dev, now);
+			return;
+		}
+		dev.phase = phase_t::active;
+		dev.attempts = 0;
+		dev.last_used = now;
+	}
+
+	void run_pending(int id, Device& dev, uint32_t now) {
+		while (!dev.pending.empty() && dev.phase == phase_t::active) {
+			auto req = std::move(dev.pending.front());
+			dev.pending.pop_front();
+			record_wait(now - req.submitted_at);
+			bool ok = req.op(dev.client);
+			ok ? metrics.completed++ : metrics.failed++;
+			dev.last_used = now;
+			if (req.done) {
+				req.done(id, ok);
+			}
+		}
+	}
+
+	void admit(uint32_t now) {
+		while (true) {
+			// device waiting longest
+			Device* next = nullptr;
+			int next_id = -1;
+			for (size_t i = 0; i < devices.size(); i++) {
+				auto& d = *devices[i];
+				if (d.phase != phase_t::closed || d.pending.empty() || static_cast<int32_t>(now - d.retry_at) < 0) {
+					continue;
+				}
+				if (!next || static_cast<int32_t>(d.pending.front().submitted_at - next->pending.front().submitted_at) < 0) {
+					next = &d;
+					next_id = static_cast<int>(i);
+				}
+			}
+			if (!next) {
+				return;
+			}
+			if (get_connection_count() >= max_connections && !evict()) {
+				return;
+			}
+			if (!scheduler.request(next->client, [this, next_id](Client&, const report_t& report) { on_opened(next_id, report); })) {
+				fail_session(next_id, *next, now);
+				continue;
+			}
+			next->phase = phase_t::opening;
+			metrics.connects++;
+		}
+	}
+
+	/** Disconnect least recently used active session without pending operation */
+	bool evict() {
+		Device* lru = nullptr;
+		for (auto& d : devices) {
+			if (d->phase == phase_t::active && d->pending.empty() &&
+			    (!lru || static_cast<int32_t>(d->last_used - lru->last_used) < 0)) {
+				lru = d.get();
+			}
+		}
+		if (!lru) {
+			return false;
+		}
+		metrics.evictions++;
+		close(*lru);
+		return true;
+	}
+
+	void fail_session(int id, Device& dev, uint32_t now) {
+		metrics.connect_failures++;
+		close(dev);
+		dev.retry_at = now + retry_delay_ms;
+		if (++dev.attempts < max_attempts) {
+			return;
+		}
+		dev.attempts = 0;
+		auto failed = std::move(dev.pending);
+		dev.pending.clear();
+		for (auto& req : failed) {
+			record_wait(now - req.submitted_at);
+			metrics.failed++;
+			if (req.done) {
+				req.done(id, false);
+			}
+		}
+	}
+
+	void close(Device& dev) {
+		dev.phase = phase_t::closed;
+		dev.client.disconnect();
+	}
+
+	void record_wait(uint32_t wait_ms) {
+		metrics.total_wait_ms += wait_ms;
+		metrics.max_wait_ms = std::max(metrics.max_wait_ms, wait_ms);
+	}
+};
+
+}  // namespace libsesame3bt
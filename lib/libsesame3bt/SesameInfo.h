@@ -2,35 +2,55 @@
 #include <NimBLEDevice.h>
 #include <Sesame.h>
 #include <cstddef>
-#include <string>
+#include <cstring>
+#include <type_traits>
 
 namespace libsesame3bt {
 
+/**
+ * @brief Scanned SESAME device
+ * @details Fixed size value type, safe to copy and keep after the scan (no reference to scan results).
+ */
 class SesameInfo {
-	friend class SesameScanner;
-
  public:
-	SesameInfo() = delete;
-	const NimBLEAddress address;
-	const Sesame::model_t model;
 	union flags_t {
 		struct {
 			bool registered : 1;
 			bool unused : 7;
 		};
 		std::byte v;
+		flags_t() : v{} {}
 		flags_t(std::byte _v) : v(_v) {}
-	} const flags;
-	const NimBLEUUID uuid;
-	const NimBLEAdvertisedDevice& advertised_device;
+	};
+
+	/** BLE address value (NimBLE byte order) */
+	uint8_t ble_address[6]{};
+	uint8_t ble_address_type{};
+	Sesame::model_t model{Sesame::model_t::unknown};
+	flags_t flags{};
+	/** RSSI of the advertisement (dBm) */
+	int8_t rssi{};
+	/** SESAME UUID (big endian) */
+	uint8_t uuid_bin[16]{};
+	/** Reception time of the advertisement (sysclock::now_ms()) */
+	uint32_t timestamp{};
 
- private:
+	SesameInfo() = default;
 	SesameInfo(const NimBLEAddress& _address,
 	           Sesame::model_t _model,
 	           std::byte flags_byte,
-	           const NimBLEUUID& _uuid,
-	           const NimBLEAdvertisedDevice& _adv)
-	    : address(_address), model(_model), flags(flags_byte), uuid(_uuid), advertised_device(_adv) {}
+	           const uint8_t (&_uuid)[16],
+	           int8_t _rssi,
+	           uint32_t _timestamp)
+	    : ble_address_type(_address.getType()), model(_model), flags(flags_byte), rssi(_rssi), timestamp(_timestamp) {
+		std::memcpy(ble_address, _address.getVal(), sizeof(ble_address));
+		std::memcpy(uuid_bin, _uuid, sizeof(uuid_bin));
+	}
+
+	NimBLEAddress address() const { return NimBLEAddress{ble_address, ble_address_type}; }
+	NimBLEUUID uuid() const { return NimBLEUUID{uuid_bin, sizeof(uuid_bin)}.reverseByteOrder(); }
 };
 
+static_assert(std::is_trivially_copyable_v<SesameInfo>);
+
 }  // namespace libsesame3bt
@@ -2,6 +2,11 @@
 #include <NimBLEDevice.h>
 #include <Sesame.h>
 #include <libsesame3bt/ScannerCore.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include "clock.h"
 
 #ifndef LIBSESAME3BT_DEBUG
 #define LIBSESAME3BT_DEBUG 0
@@ -10,47 +15,173 @@
 
 namespace libsesame3bt {
 
+namespace {
+
+constexpr uint16_t CANDY_HOUSE_COMPANY_ID = 0x055a;
+constexpr uint8_t AD_TYPE_UUID16_INCOMPLETE = 0x02;
+constexpr uint8_t AD_TYPE_UUID16_COMPLETE = 0x03;
+constexpr uint8_t AD_TYPE_MANUFACTURER_DATA = 0xff;
+
+}  // namespace
+
+/**
+ * @brief Test raw advertising payload for SESAME service UUID and CANDY HOUSE manufacturer data
+ * @details Walks AD structures in place, nothing is allocated.
+ * @param payload advertising data (and scan response data)
+ * @param size size of payload
+ * @return true if the payload may be a SESAME advertisement
+ */
 bool
-SesameScanner::scan_async(uint32_t scan_duration, scan_handler_t handler) {
-	this->handler = handler;
+SesameScanner::is_sesame_payload(const uint8_t* payload, size_t size) {
+	constexpr uint8_t srv_lo = Sesame::SESAME3_SRV_UUID & 0xff;
+	constexpr uint8_t srv_hi = Sesame::SESAME3_SRV_UUID >> 8;
+	bool has_service = false;
+	bool has_manufacturer = false;
+	for (size_t pos = 0; pos + 1 < size;) {
+		size_t ad_len = payload[pos];
+		if (ad_len == 0 || pos + 1 + ad_len > size) {
+			break;
+		}
+		const uint8_t* data = &payload[pos + 2];
+		size_t data_len = ad_len - 1;
+		switch (payload[pos + 1]) {
+			case AD_TYPE_UUID16_INCOMPLETE:
+			case AD_TYPE_UUID16_COMPLETE:
+				for (size_t i = 0; i + 1 < data_len; i += 2) {
+					if (data[i] == srv_lo && data[i + 1] == srv_hi) {
+						has_service = true;
+						break;
+					}
+				}
+				break;
+			case AD_TYPE_MANUFACTURER_DATA:
+				has_manufacturer = data_len >= 2 && data[0] == (CANDY_HOUSE_COMPANY_ID & 0xff) && data[1] == (CANDY_HOUSE_COMPANY_ID >> 8);
+				break;
+			default:
+				break;
+		}
+		if (has_service && has_manufacturer) {
+			return true;
+		}
+		pos += 1 + ad_len;
+	}
+	return false;
+}
+
+void
+SesameScanner::prepare(scan_handler_t handler, const ScanProfile& profile) {
+	this->handler = handler ? std::make_shared<scan_handler_t>(std::move(handler)) : nullptr;
+	buffered = false;
 	scanner = NimBLEDevice::getScan();
 	scanner->clearResults();
 	scanner->setScanCallbacks(this);
-	scanner->setInterval(1349);
-	scanner->setWindow(449);
-	scanner->setActiveScan(true);
+	scanner->setInterval(profile.interval);
+	scanner->setWindow(std::min(profile.window, profile.interval));
+	scanner->setActiveScan(profile.active);
 	scanner->setMaxResults(0);
-	return scanner->start(scan_duration, false);
+}
+
+bool
+SesameScanner::scan_async_start(uint32_t scan_duration) {
+	scanning = true;
+	if (!scanner->start(scan_duration, false)) {
+		scanning = false;
+		return false;
+	}
+	return true;
+}
+
+bool
+SesameScanner::scan_async(uint32_t scan_duration, scan_handler_t handler, const ScanProfile& profile) {
+	prepare(handler, profile);
+	return scan_async_start(scan_duration);
+}
+
+/**
+ * @brief Start scan without handler, results are buffered
+ * @details Results are pushed to a bounded queue on the BLE host task and taken with poll() / pop() from application
+ * task. When the queue is full, results are dropped (see get_dropped_count()).
+ * @param scan_duration scan duration in milliseconds (0: scan until stop())
+ * @param profile scan parameters
+ * @return true if scan started
+ */
+bool
+SesameScanner::scan_buffered(uint32_t scan_duration, const ScanProfile& profile) {
+	prepare(nullptr, profile);
+	queue.clear();
+	queue.reset_dropped();
+	buffered = true;
+	return scan_async_start(scan_duration);
+}
+
+/**
+ * @brief Take a buffered scan result without waiting
+ * @return false if no result is buffered
+ */
+bool
+SesameScanner::poll(SesameInfo& info) {
+	return queue.pop(info);
+}
+
+/**
+ * @brief Take a buffered scan result, wait for it if needed
+ * @param info result
+ * @param timeout_ms maximum wait time in milliseconds
+ * @return false on timeout or if scan is finished and no result is left
+ */
+bool
+SesameScanner::pop(SesameInfo& info, uint32_t timeout_ms) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	std::unique_lock lock{wait_mutex};
+	while (!queue.pop(info)) {
+		if (!scanning) {
+			return queue.pop(info);
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (now >= deadline) {
+			return false;
+		}
+		// producer does not take the mutex, wake up periodically not to miss a notification
+		wait_cv.wait_for(lock, std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(10)));
+	}
+	return true;
 }
 
 void
 SesameScanner::onScanEnd(const NimBLEScanResults& results, int reason) {
-	if (handler) {
-		handler(*this, nullptr);
-		handler = nullptr;
+	scanning = false;
+	wait_cv.notify_all();
+	finish_handler();
+}
+
+/** Tell the end of scan to the handler and release it */
+void
+SesameScanner::finish_handler() {
+	auto h = std::move(handler);
+	handler = nullptr;
+	if (!h) {
+		return;
+	}
+	if (!executor) {
+		(*h)(*this, nullptr);
+	} else if (!executor->post([this, h]() { (*h)(*this, nullptr); })) {
+		DEBUG_PRINTLN("Executor queue full, end of scan dropped");
 	}
 }
 
 void
-SesameScanner::scan(uint32_t scan_duration, scan_handler_t handler) {
-	this->handler = handler;
-	scanner = NimBLEDevice::getScan();
-	scanner->clearResults();
-	scanner->setScanCallbacks(this);
-	scanner->setInterval(1349);
-	scanner->setWindow(449);
-	scanner->setActiveScan(true);
-	scanner->setMaxResults(0);
+SesameScanner::scan(uint32_t scan_duration, scan_handler_t handler, const ScanProfile& profile) {
+	prepare(handler, profile);
+	scanning = true;
 	scanner->getResults(scan_duration, false);
-	if (this->handler) {
-		this->handler(*this, nullptr);
-		this->handler = nullptr;
-	}
+	scanning = false;
+	finish_handler();
 }
 
 void
 SesameScanner::onResult(const NimBLEAdvertisedDevice* adv) {
-	if (!adv->isAdvertisingService(NimBLEUUID(Sesame::SESAME3_SRV_UUID))) {
+	const auto& payload = adv->getPayload();
+	if (!is_sesame_payload(payload.data(), payload.size())) {
 		return;
 	}
 	auto addr = adv->getAddress();
@@ -60,10 +191,206 @@ SesameScanner::onResult(const NimBLEAdvertisedDevice* adv) {
 		DEBUG_PRINTF("%s: Unexpected advertisement/name data, ignored\n", addr.toString().c_str());
 		return;
 	}
-	auto info = SesameInfo(addr, model, flag_byte, NimBLEUUID{uuid_bin, std::size(uuid_bin)}.reverseByteOrder(), *adv);
+	SesameInfo info{addr, model, flag_byte, uuid_bin, adv->getRSSI(), sysclock::now_ms()};
+	signals.update(info);
+	if (buffered) {
+		if (queue.push(info)) {
+			wait_cv.notify_one();
+		}
+	}
+	if (!executor) {
+		deliver(info, handler);
+	} else if ((subscriber_count || handler) && !executor->post([this, info, h = handler]() { deliver(info, h); })) {
+		DEBUG_PRINTLN("Executor queue full, scan result dropped");
+	}
+}
+
+void
+SesameScanner::deliver(const SesameInfo& info, const std::shared_ptr<scan_handler_t>& handler) {
+	dispatch(info);
 	if (handler) {
-		handler(*this, &info);
+		(*handler)(*this, &info);
+	}
+}
+
+/**
+ * @brief Receive scan results matching a filter
+ * @details Subscribers share the radio scan started by scan() / scan_async() / scan_buffered() and keep receiving
+ * results across scans until unsubscribe(). Subscribers are called on the BLE host task (or by the executor, see
+ * set_executor()).
+ * @param filter condition of delivered results
+ * @param subscriber receiver of results
+ * @return subscription id (0 if no subscriber slot or UUID slot is available)
+ */
+uint32_t
+SesameScanner::subscribe(const ScanFilter& filter, subscriber_t subscriber) {
+	if (!subscriber) {
+		return 0;
+	}
+	std::lock_guard lock{subscribers_mutex};
+	// do not overwrite the handler running now (subscribe from subscriber)
+	auto slot = std::find_if(subscribers.begin(), subscribers.end(), [this](const auto& sub) { return sub.id == 0 && &sub != running; });
+	if (slot == subscribers.end()) {
+		DEBUG_PRINTLN("No subscriber slot available");
+		return 0;
+	}
+	uint16_t uuids = 0;
+	for (const auto& uuid : filter.uuids) {
+		if (uuid.bitSize() != 128) {
+			DEBUG_PRINTLN("Invalid UUID size, must be 128 bits");
+			release_uuids(uuids);
+			return 0;
+		}
+		uint8_t uuid_bin[16];
+		std::reverse_copy(uuid.getValue(), uuid.getValue() + 16, uuid_bin);
+		auto found = std::find_if(filter_uuids.begin(), filter_uuids.end(),
+		                          [&uuid_bin](const auto& e) { return e.refs > 0 && std::memcmp(e.uuid_bin, uuid_bin, 16) == 0; });
+		if (found == filter_uuids.end()) {
+			found = std::find_if(filter_uuids.begin(), filter_uuids.end(), [](const auto& e) { return e.refs == 0; });
+			if (found == filter_uuids.end()) {
+				DEBUG_PRINTLN("No UUID slot available");
+				release_uuids(uuids);
+				return 0;
+			}
+			std::memcpy(found->uuid_bin, uuid_bin, 16);
+		}
+		uint16_t bit = 1u << std::distance(filter_uuids.begin(), found);
+		if (!(uuids & bit)) {
+			found->refs++;
+			uuids |= bit;
+		}
+	}
+	if (++last_subscription_id == 0) {
+		++last_subscription_id;
+	}
+	*slot = {last_subscription_id, filter.models, uuids, filter.registration, filter.min_rssi, subscriber};
+	subscriber_count++;
+	update_union_filter();
+	return slot->id;
+}
+
+/**
+ * @brief Stop delivering results to a subscriber
+ * @param id subscription id returned by subscribe()
+ * @return false if no such subscription
+ */
+bool
+SesameScanner::unsubscribe(uint32_t id) {
+	if (id == 0) {
+		return false;
+	}
+	std::lock_guard lock{subscribers_mutex};
+	auto slot = std::find_if(subscribers.begin(), subscribers.end(), [id](const auto& sub) { return sub.id == id; });
+	if (slot == subscribers.end()) {
+		return false;
+	}
+	release_uuids(slot->uuids);
+	// handler may be running now (unsubscribe from subscriber), keep it until the slot is reused
+	slot->id = 0;
+	subscriber_count--;
+	update_union_filter();
+	return true;
+}
+
+void
+SesameScanner::release_uuids(uint16_t uuids) {
+	for (size_t i = 0; i < filter_uuids.size(); i++) {
+		if (uuids & (1u << i)) {
+			filter_uuids[i].refs--;
+		}
+	}
+}
+
+void
+SesameScanner::update_union_filter() {
+	any_model = false;
+	union_models = 0;
+	union_min_rssi = INT8_MAX;
+	for (const auto& sub : subscribers) {
+		if (sub.id == 0) {
+			continue;
+		}
+		any_model |= sub.models == 0;
+		union_models |= sub.models;
+		union_min_rssi = std::min(union_min_rssi, sub.min_rssi);
+	}
+}
+
+/**
+ * Conditions common to all subscribers are tested first, then the UUID is looked up once and each subscriber only
+ * tests bit masks.
+ */
+void
+SesameScanner::dispatch(const SesameInfo& info) {
+	if (subscriber_count == 0) {
+		return;
+	}
+	std::lock_guard lock{subscribers_mutex};
+	auto model_bit = ScanFilter::model_bit(info.model);
+	if ((!any_model && !(union_models & model_bit)) || info.rssi < union_min_rssi) {
+		return;
+	}
+	uint16_t uuid_bit = 0;
+	for (size_t i = 0; i < filter_uuids.size(); i++) {
+		if (filter_uuids[i].refs > 0 && std::memcmp(filter_uuids[i].uuid_bin, info.uuid_bin, 16) == 0) {
+			uuid_bit = 1u << i;
+			break;
+		}
+	}
+	auto registration = info.flags.registered ? ScanFilter::registration_t::registered : ScanFilter::registration_t::unregistered;
+	for (auto& sub : subscribers) {
+		if (sub.id == 0 || (sub.models && !(sub.models & model_bit)) || (sub.uuids && !(sub.uuids & uuid_bit)) ||
+		    (sub.registration != ScanFilter::registration_t::any && sub.registration != registration) || info.rssi < sub.min_rssi) {
+			continue;
+		}
+		running = &sub;
+		sub.handler(*this, info);
+		running = nullptr;
+	}
+}
+
+/**
+ * @brief Test a scan result against the filter
+ * @return true if all conditions are satisfied
+ */
+bool
+ScanFilter::matches(const SesameInfo& info) const {
+	if ((models && !(models & model_bit(info.model))) || info.rssi < min_rssi) {
+		return false;
+	}
+	if (registration != registration_t::any && (registration == registration_t::registered) != info.flags.registered) {
+		return false;
+	}
+	if (uuids.empty()) {
+		return true;
+	}
+	return std::any_of(uuids.cbegin(), uuids.cend(), [&info](const auto& uuid) {
+		return uuid.bitSize() == 128 && std::equal(info.uuid_bin, info.uuid_bin + 16, std::make_reverse_iterator(uuid.getValue() + 16));
+	});
+}
+
+/**
+ * @brief Get devices found by scans, ranked by signal
+ * @details Devices with strong and steady signal come first, connecting to them is less likely to time out. RSSI and
+ * advertising interval are averaged over all scans since clear_signals(). The RSSI condition of the filter is tested
+ * against the latest advertisement.
+ * @param out array receiving candidates
+ * @param max_count size of out
+ * @param filter condition of candidates
+ * @param max_age_ms devices not seen within this period are excluded
+ * @return number of candidates stored to out
+ */
+size_t
+SesameScanner::get_candidates(Candidate* out, size_t max_count, const ScanFilter& filter, uint32_t max_age_ms) const {
+	std::array<Candidate, SignalTracker::TABLE_SIZE> ranked;
+	auto count = signals.rank(ranked.data(), ranked.size(), sysclock::now_ms(), max_age_ms);
+	size_t n = 0;
+	for (size_t i = 0; i < count && n < max_count; i++) {
+		if (filter.matches(ranked[i].info)) {
+			out[n++] = ranked[i];
+		}
 	}
+	return n;
 }
 
 void
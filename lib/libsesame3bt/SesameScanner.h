@@ -1,19 +1,113 @@
 #pragma once
 #include <NimBLEDevice.h>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Executor.h"
 #include "SesameInfo.h"
+#include "SignalTracker.h"
+#include "SpscRing.h"
+
+#ifndef LIBSESAME3BT_SCAN_QUEUE_SIZE
+#define LIBSESAME3BT_SCAN_QUEUE_SIZE 32
+#endif
 
 namespace libsesame3bt {
 
+/**
+ * @brief BLE scan parameters
+ * @details `interval` and `window` are in milliseconds, radio listens `window` ms in every `interval` ms.
+ * Passive scan does not receive scan responses, SESAME 3 / SESAME 4 / SESAME bot / SESAME Cycle (OS2 devices) are not
+ * recognized without them.
+ */
+struct ScanProfile {
+	uint16_t interval;
+	uint16_t window;
+	bool active;
+
+	/** ~33% duty active scan (library default) */
+	static constexpr ScanProfile standard() { return {1349, 449, true}; }
+	/** ~5% duty active scan for long running background scan sharing the radio with Wi-Fi */
+	static constexpr ScanProfile low_duty() { return {1280, 64, true}; }
+	/** ~75% duty active scan to find devices quickly */
+	static constexpr ScanProfile fast_discovery() { return {40, 30, true}; }
+	/** ~33% duty passive scan, no scan request is transmitted (OS3 devices only) */
+	static constexpr ScanProfile passive() { return {1349, 449, false}; }
+};
+
+/**
+ * @brief Condition of scan results delivered to a subscriber (SesameScanner::subscribe())
+ * @details Each condition is ANDed, unset condition matches everything.
+ */
+struct ScanFilter {
+	enum class registration_t : uint8_t { any, registered, unregistered };
+
+	/** bit mask of accepted models (model_bit()), 0 to accept any model */
+	uint64_t models = 0;
+	/** accepted SESAME UUIDs, empty to accept any device */
+	std::vector<NimBLEUUID> uuids{};
+	registration_t registration = registration_t::any;
+	int8_t min_rssi = INT8_MIN;
+
+	ScanFilter& model(Sesame::model_t model) {
+		models |= model_bit(model);
+		return *this;
+	}
+	ScanFilter& uuid(const NimBLEUUID& uuid) {
+		uuids.push_back(uuid);
+		return *this;
+	}
+	ScanFilter& registered(bool registered = true) {
+		registration = registered ? registration_t::registered : registration_t::unregistered;
+		return *this;
+	}
+	ScanFilter& rssi_floor(int8_t rssi) {
+		min_rssi = rssi;
+		return *this;
+	}
+	bool matches(const SesameInfo& info) const;
+	static constexpr uint64_t model_bit(Sesame::model_t model) {
+		auto v = static_cast<int>(model);
+		return v >= 0 && v < 64 ? uint64_t{1} << v : 0;
+	}
+};
+
 class SesameScanner : private NimBLEScanCallbacks {
  public:
 	using scan_handler_t = std::function<void(SesameScanner&, const SesameInfo*)>;
+	using subscriber_t = std::function<void(SesameScanner&, const SesameInfo&)>;
+	using Candidate = SignalTracker::Candidate;
+	static constexpr size_t MAX_SUBSCRIBERS = 8;
+	static constexpr size_t MAX_FILTER_UUIDS = 16;
 	static SesameScanner& get() {
 		static SesameScanner instance;
 		return instance;
 	}
-	void scan(uint32_t scan_duration, scan_handler_t handler);
-	bool scan_async(uint32_t scan_duration, scan_handler_t handler);
+	void scan(uint32_t scan_duration, scan_handler_t handler, const ScanProfile& profile = ScanProfile::standard());
+	bool scan_async(uint32_t scan_duration, scan_handler_t handler, const ScanProfile& profile = ScanProfile::standard());
+	bool scan_buffered(uint32_t scan_duration, const ScanProfile& profile = ScanProfile::standard());
+	bool poll(SesameInfo& info);
+	bool pop(SesameInfo& info, uint32_t timeout_ms);
 	void stop();
+	bool is_scanning() const { return scanning; }
+	/** Number of results discarded because the buffer of scan_buffered() was full */
+	uint32_t get_dropped_count() const { return queue.dropped(); }
+	static bool is_sesame_payload(const uint8_t* payload, size_t size);
+	uint32_t subscribe(const ScanFilter& filter, subscriber_t subscriber);
+	bool unsubscribe(uint32_t id);
+	size_t get_candidates(Candidate* out, size_t max_count, const ScanFilter& filter = {}, uint32_t max_age_ms = 10'000) const;
+	/** Forget RSSI / advertising interval statistics collected by previous scans */
+	void clear_signals() { signals.clear(); }
+	/**
+	 * @brief Call scan handlers and subscribers from `executor` instead of the BLE host task
+	 * @details Change only while not scanning. Buffered results (scan_buffered()) are not affected.
+	 * @param executor executor, nullptr to call on the BLE host task
+	 */
+	void set_executor(Executor* executor) { this->executor = executor; }
 	SesameScanner(const SesameScanner&) = delete;
 	SesameScanner& operator=(const SesameScanner&) = delete;
 	SesameScanner(SesameScanner&&) = delete;
@@ -22,9 +116,47 @@ class SesameScanner : private NimBLEScanCallbacks {
  private:
 	friend void scan_completed_handler(NimBLEScanResults);
 	NimBLEScan* scanner{};
-	scan_handler_t handler{};
+	/** shared with the events queued to the executor */
+	std::shared_ptr<scan_handler_t> handler{};
+	Executor* executor = nullptr;
+	std::atomic<bool> scanning{false};
+	bool buffered = false;
+	SpscRing<SesameInfo, LIBSESAME3BT_SCAN_QUEUE_SIZE> queue;
+	std::mutex wait_mutex;
+	std::condition_variable wait_cv;
+	SignalTracker signals;
+
+	struct Subscriber {
+		uint32_t id = 0;
+		uint64_t models;
+		uint16_t uuids;
+		ScanFilter::registration_t registration;
+		int8_t min_rssi;
+		subscriber_t handler;
+	};
+	struct FilterUuid {
+		uint8_t uuid_bin[16];
+		uint8_t refs;
+	};
+	std::recursive_mutex subscribers_mutex;
+	std::atomic<size_t> subscriber_count{0};
+	uint32_t last_subscription_id = 0;
+	std::array<Subscriber, MAX_SUBSCRIBERS> subscribers{};
+	std::array<FilterUuid, MAX_FILTER_UUIDS> filter_uuids{};
+	const Subscriber* running = nullptr;
+	bool any_model = false;
+	uint64_t union_models = 0;
+	int8_t union_min_rssi = INT8_MIN;
+
+	void dispatch(const SesameInfo& info);
+	void deliver(const SesameInfo& info, const std::shared_ptr<scan_handler_t>& handler);
+	void finish_handler();
+	void update_union_filter();
+	void release_uuids(uint16_t uuids);
 
 	void scan_completed(NimBLEScanResults results);
+	void prepare(scan_handler_t handler, const ScanProfile& profile);
+	bool scan_async_start(uint32_t scan_duration);
 	virtual void onResult(const NimBLEAdvertisedDevice* advertisedDevice) override;
 	virtual void onScanEnd(const NimBLEScanResults& results, int reason) override;
 
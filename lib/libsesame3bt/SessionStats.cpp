@@ -0,0 +1,40 @@
+#include "SessionStats.h"
+
+namespace libsesame3bt {
+
+namespace {
+
+void
+add_interval(LatencyHistogram& hist, uint32_t from_us, uint32_t to_us, bool from_reached = true) {
+	if (from_reached && to_us && to_us >= from_us) {
+		hist.add(to_us - from_us);
+	}
+}
+
+}  // namespace
+
+/**
+ * @brief Add the phases reached in a session
+ */
+void
+SessionStats::record(const SessionTiming& timing) {
+	std::lock_guard lock{mutex};
+	sessions++;
+	add_interval(connect, 0, timing.connected_us);
+	add_interval(discovery, timing.connected_us, timing.discovered_us, timing.connected_us);
+	add_interval(subscribe, timing.discovered_us, timing.subscribed_us, timing.discovered_us);
+	add_interval(authenticate, timing.subscribed_us, timing.active_us, timing.subscribed_us);
+	add_interval(first_status, timing.active_us, timing.first_status_us, timing.active_us);
+	add_interval(setup, 0, timing.active_us);
+}
+
+void
+SessionStats::clear() {
+	std::lock_guard lock{mutex};
+	sessions = 0;
+	for (auto* hist : {&connect, &discovery, &subscribe, &authenticate, &first_status, &setup}) {
+		hist->clear();
+	}
+}
+
+}  // namespace libsesame3bt
@@ -0,0 +1,190 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Log-linear histogram of latencies in fixed memory
+ * @details Each power of two range is split into 8 buckets, reported values are within 12.5% of the recorded ones.
+ * When 1024 samples are accumulated all counts are halved, so old samples fade out (rolling window).
+ */
+class LatencyHistogram {
+ public:
+	static constexpr size_t BUCKETS = 8 + 29 * 8;
+	static constexpr uint32_t DECAY_AT = 1024;
+
+	void add(uint32_t value) {
+		if (total >= DECAY_AT) {
+			decay();
+		}
+		counts[bucket_of(value)]++;
+		total++;
+	}
+	/** Number of samples (after decay) */
+	uint32_t count() const { return total; }
+	/** Lower bound of the smallest sample, 0 if empty */
+	uint32_t min() const {
+		for (size_t i = 0; i < BUCKETS; i++) {
+			if (counts[i]) {
+				return lower_bound(i);
+			}
+		}
+		return 0;
+	}
+	/** Upper bound of the largest sample, 0 if empty */
+	uint32_t max() const {
+		for (size_t i = BUCKETS; i > 0; i--) {
+			if (counts[i - 1]) {
+				return lower_bound(i - 1) + width(i - 1) - 1;
+			}
+		}
+		return 0;
+	}
+	/**
+	 * @brief Value below which `pct` percent of samples fall
+	 * @param pct percentile (0-100)
+	 * @return middle of the bucket, 0 if empty
+	 */
+	uint32_t percentile(float pct) const {
+		if (total == 0) {
+			return 0;
+		}
+		uint32_t rank = static_cast<uint32_t>(pct / 100.0f * (total - 1) + 0.5f);
+		uint32_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; i++) {
+			seen += counts[i];
+			if (seen > rank) {
+				return lower_bound(i) + width(i) / 2;
+			}
+		}
+		return max();
+	}
+	void clear() {
+		counts.fill(0);
+		total = 0;
+	}
+
+	static constexpr size_t bucket_of(uint32_t value) {
+		if (value < 8) {
+			return value;
+		}
+		int msb = 31 - __builtin_clz(value);
+		return 8 + (msb - 3) * 8 + ((value >> (msb - 3)) & 7);
+	}
+	static constexpr uint32_t lower_bound(size_t bucket) {
+		if (bucket < 8) {
+			return static_cast<uint32_t>(bucket);
+		}
+		auto shift = (bucket - 8) / 8;
+		return static_cast<uint32_t>((8 + (bucket - 8) % 8) << shift);
+	}
+	static constexpr uint32_t width(size_t bucket) { return bucket < 8 ? 1 : uint32_t{1} << ((bucket - 8) / 8); }
+
+ private:
+	std::array<uint16_t, BUCKETS> counts{};
+	uint32_t total = 0;
+
+	void decay() {
+		total = 0;
+		for (auto& c : counts) {
+			c /= 2;
+			total += c;
+		}
+	}
+};
+
+/**
+ * @brief Fragment counts of SESAME messages on one direction of the link
+ * @details The first byte of each BLE write / notification tells whether it starts and whether it ends a message.
+ */
+class FragmentCounter {
+ public:
+	void add(const uint8_t* data, size_t size) {
+		if (size == 0) {
+			return;
+		}
+		if (data[0] & 1) {
+			current = 0;
+		}
+		current++;
+		total++;
+		largest = std::max<uint16_t>(largest, size);
+		if (data[0] >> 1) {
+			completed++;
+			most = std::max(most, current);
+			current = 0;
+		}
+	}
+	/** Number of complete messages */
+	uint32_t messages() const { return completed; }
+	/** Number of fragments, including those of incomplete messages */
+	uint32_t fragments() const { return total; }
+	/** Most fragments in one message */
+	uint16_t max_fragments() const { return most; }
+	/** Largest fragment (bytes, including header) */
+	uint16_t max_size() const { return largest; }
+	float per_message() const { return completed ? static_cast<float>(total - current) / completed : 0.0f; }
+	void clear() { *this = {}; }
+
+ private:
+	uint32_t completed = 0;
+	uint32_t total = 0;
+	uint16_t current = 0;
+	uint16_t most = 0;
+	uint16_t largest = 0;
+};
+
+/**
+ * @brief Time of each phase of a SesameClient session
+ * @details Offsets are microseconds from `started_at` (sysclock::now_us() at connect), 0 if the phase was not reached.
+ */
+struct SessionTiming {
+	uint64_t started_at;
+	uint32_t connected_us;
+	/** SESAME service and characteristics found */
+	uint32_t discovered_us;
+	/** notification of RX characteristic enabled */
+	uint32_t subscribed_us;
+	uint32_t authenticating_us;
+	uint32_t active_us;
+	/** first status notification in the session */
+	uint32_t first_status_us;
+	uint32_t disconnected_us;
+};
+
+/**
+ * @brief Latency statistics of SesameClient sessions
+ * @details Attach to one or more clients with SesameClient::set_session_stats(). All histograms are in microseconds.
+ */
+class SessionStats {
+ public:
+	/** start to connected */
+	LatencyHistogram connect;
+	/** connected to service discovered */
+	LatencyHistogram discovery;
+	/** discovered to notification enabled */
+	LatencyHistogram subscribe;
+	/** notification enabled to active */
+	LatencyHistogram authenticate;
+	/** active to first status */
+	LatencyHistogram first_status;
+	/** start to active */
+	LatencyHistogram setup;
+
+	void record(const SessionTiming& timing);
+	/** Number of recorded sessions (not decayed) */
+	uint32_t get_session_count() const { return sessions; }
+	void clear();
+	/** Lock while reading histograms updated by other tasks */
+	std::mutex& get_mutex() { return mutex; }
+
+ private:
+	std::mutex mutex;
+	uint32_t sessions = 0;
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,105 @@
+#include "SignalTracker.h"
+#include <algorithm>
+#include <cstring>
+
+namespace libsesame3bt {
+
+namespace {
+
+// RSSI average follows 1/4 of the difference, interval average 1/8
+constexpr int RSSI_SHIFT = 2;
+constexpr int INTERVAL_SHIFT = 3;
+// A device missing its expected advertisements is probably moving away or shadowed
+constexpr int32_t MISSED_PENALTY_Q4 = 3 * 16;
+constexpr uint32_t MAX_MISSED = 10;
+// Interval (reliability) is unknown until the second advertisement
+constexpr int32_t SINGLE_SAMPLE_PENALTY_Q4 = 6 * 16;
+
+bool
+same_device(const SesameInfo& a, const SesameInfo& b) {
+	return a.ble_address_type == b.ble_address_type && std::memcmp(a.ble_address, b.ble_address, sizeof(a.ble_address)) == 0;
+}
+
+}  // namespace
+
+/**
+ * @brief Record an advertisement
+ * @param info scan result (timestamp must be set)
+ */
+void
+SignalTracker::update(const SesameInfo& info) {
+	std::lock_guard lock{mutex};
+	auto end = entries.begin() + used;
+	auto entry = std::find_if(entries.begin(), end, [&info](const auto& e) { return same_device(e.info, info); });
+	if (entry == end) {
+		if (used < entries.size()) {
+			entry = end;
+			used++;
+		} else {
+			entry = std::max_element(entries.begin(), entries.end(), [&info](const auto& a, const auto& b) {
+				return info.timestamp - a.info.timestamp < info.timestamp - b.info.timestamp;
+			});
+		}
+		*entry = {info, int32_t{info.rssi} * 16, 0, 1};
+		return;
+	}
+	uint32_t interval = info.timestamp - entry->info.timestamp;
+	entry->rssi_q4 += (int32_t{info.rssi} * 16 - entry->rssi_q4) / (1 << RSSI_SHIFT);
+	if (entry->samples == 1) {
+		entry->interval_ms = interval;
+	} else {
+		entry->interval_ms = static_cast<uint32_t>(entry->interval_ms + ((int64_t{interval} - entry->interval_ms) >> INTERVAL_SHIFT));
+	}
+	entry->samples++;
+	entry->info = info;
+}
+
+/**
+ * @brief List recently seen devices, best first
+ * @details Score is smoothed RSSI, lowered by 3 dB for each advertisement expected but not received since the last one
+ * (up to 10) and by 6 dB if only one advertisement was received.
+ * @param out array receiving candidates
+ * @param max_count size of out
+ * @param now_ms current time (sysclock::now_ms())
+ * @param max_age_ms devices not seen within this period are excluded
+ * @return number of candidates stored to out
+ */
+size_t
+SignalTracker::rank(Candidate* out, size_t max_count, uint32_t now_ms, uint32_t max_age_ms) const {
+	std::array<Candidate, TABLE_SIZE> all;
+	size_t count = 0;
+	{
+		std::lock_guard lock{mutex};
+		for (size_t i = 0; i < used; i++) {
+			const auto& e = entries[i];
+			uint32_t age = now_ms - e.info.timestamp;
+			if (age > max_age_ms) {
+				continue;
+			}
+			int32_t score_q4 = e.rssi_q4;
+			if (e.samples < 2) {
+				score_q4 -= SINGLE_SAMPLE_PENALTY_Q4;
+			} else if (e.interval_ms > 0) {
+				score_q4 -= static_cast<int32_t>(std::min(age / e.interval_ms, MAX_MISSED)) * MISSED_PENALTY_Q4;
+			}
+			all[count++] = {e.info, e.rssi_q4 / 16.0f, e.interval_ms, e.samples, score_q4 / 16.0f};
+		}
+	}
+	auto n = std::min(count, max_count);
+	std::partial_sort(all.begin(), all.begin() + n, all.begin() + count, [](const auto& a, const auto& b) {
+		return a.score != b.score ? a.score > b.score : a.samples > b.samples;
+	});
+	std::copy_n(all.begin(), n, out);
+	return n;
+}
+
+/**
+ * @brief Forget all devices
+ */
+void
+SignalTracker::clear() {
+	std::lock_guard lock{mutex};
+	used = 0;
+}
+
+}  // namespace libsesame3bt
@@ -0,0 +1,53 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "SesameInfo.h"
+
+#ifndef LIBSESAME3BT_SIGNAL_TABLE_SIZE
+#define LIBSESAME3BT_SIGNAL_TABLE_SIZE 16
+#endif
+
+namespace libsesame3bt {
+
+/**
+ * @brief Per-device signal statistics of scanned SESAMEs
+ * @details Keeps exponentially weighted moving averages of RSSI and advertising interval in a fixed size table. When
+ * the table is full, the device not seen for the longest time is replaced.
+ */
+class SignalTracker {
+ public:
+	static constexpr size_t TABLE_SIZE = LIBSESAME3BT_SIGNAL_TABLE_SIZE;
+
+	struct Candidate {
+		/** latest advertisement */
+		SesameInfo info;
+		/** smoothed RSSI (dBm) */
+		float rssi;
+		/** smoothed advertising interval (ms), 0 if only one advertisement was received */
+		uint32_t interval_ms;
+		/** number of received advertisements */
+		uint32_t samples;
+		/** ranking score (dBm, smoothed RSSI minus penalties) */
+		float score;
+	};
+
+	void update(const SesameInfo& info);
+	size_t rank(Candidate* out, size_t max_count, uint32_t now_ms, uint32_t max_age_ms) const;
+	void clear();
+
+ private:
+	struct Entry {
+		SesameInfo info;
+		/** RSSI average in 1/16 dBm */
+		int32_t rssi_q4;
+		uint32_t interval_ms;
+		uint32_t samples;
+	};
+	mutable std::mutex mutex;
+	std::array<Entry, TABLE_SIZE> entries{};
+	size_t used = 0;
+};
+
+}  // namespace libsesame3bt
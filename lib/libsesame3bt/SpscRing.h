@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Bounded lock-free single producer / single consumer queue
+ * @details push() must be called from one task (producer) and pop() from one other task (consumer). When the queue is
+ * full, push() fails and the element is counted as dropped.
+ * @tparam T element type (trivially copyable)
+ * @tparam N capacity (power of 2)
+ */
+template <typename T, size_t N>
+class SpscRing {
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+	static_assert(std::is_trivially_copyable_v<T>, "element must be trivially copyable");
+
+ public:
+	/**
+	 * @brief Append an element (producer side)
+	 * @return false if the queue is full (element is dropped)
+	 */
+	bool push(const T& value) {
+		auto head = write_pos.load(std::memory_order_relaxed);
+		if (head - read_pos.load(std::memory_order_acquire) >= N) {
+			dropped_count.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		buffer[head & (N - 1)] = value;
+		write_pos.store(head + 1, std::memory_order_release);
+		return true;
+	}
+	/**
+	 * @brief Take the oldest element (consumer side)
+	 * @return false if the queue is empty
+	 */
+	bool pop(T& value) {
+		auto tail = read_pos.load(std::memory_order_relaxed);
+		if (tail == write_pos.load(std::memory_order_acquire)) {
+			return false;
+		}
+		value = buffer[tail & (N - 1)];
+		read_pos.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	bool empty() const { return write_pos.load(std::memory_order_acquire) == read_pos.load(std::memory_order_acquire); }
+	size_t size() const { return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire); }
+	static constexpr size_t capacity() { return N; }
+	/** Number of elements rejected by push() since construction or reset_dropped() */
+	uint32_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+	uint32_t reset_dropped() { return dropped_count.exchange(0, std::memory_order_relaxed); }
+	/** Discard all elements (consumer side) */
+	void clear() { read_pos.store(write_pos.load(std::memory_order_acquire), std::memory_order_release); }
+
+ private:
+	alignas(64) std::atomic<uint32_t> write_pos{0};
+	alignas(64) std::atomic<uint32_t> read_pos{0};
+	std::atomic<uint32_t> dropped_count{0};
+	T buffer[N]{};
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,393 @@
+#include "Transport.h"
+#include <Sesame.h>
+
+#ifndef LIBSESAME3BT_DEBUG
+#define LIBSESAME3BT_DEBUG 0
+#endif
+#include "debug.h"
+
+namespace libsesame3bt {
+
+/**
+ * @brief Check the ranges of the Bluetooth Core Specification
+ * @details Supervision timeout must be longer than two effective intervals, (1 + latency) * max_interval.
+ */
+bool
+ConnectionParams::is_valid() const {
+	return min_interval >= 6 && min_interval <= max_interval && max_interval <= 3200 && latency <= 499 &&
+	       supervision_timeout >= 10 && supervision_timeout <= 3200 &&
+	       uint32_t{supervision_timeout} * 4 > (uint32_t{latency} + 1) * max_interval;
+}
+
+NimBLETransport::~NimBLETransport() {
+	if (blec) {
+		blec->setClientCallbacks(nullptr, false);
+		NimBLEDevice::deleteClient(blec);
+	}
+}
+
+bool
+NimBLETransport::prepare_ble_client() {
+	if (!blec) {
+		blec = NimBLEDevice::createClient();
+		if (!blec) {
+			DEBUG_PRINTLN("Failed to create BLE client");
+			return false;
+		}
+	}
+	blec->setClientCallbacks(this, false);
+	blec->setConnectTimeout(connect_timeout);
+	if (conn_params) {
+		blec->setConnectionParams(conn_params->min_interval, conn_params->max_interval, conn_params->latency,
+		                          conn_params->supervision_timeout);
+	}
+	if (cache_invalid) {
+		blec->deleteServices();
+		tx = rx = nullptr;
+		cache_invalid = false;
+	}
+	return true;
+}
+
+bool
+NimBLETransport::connect(const NimBLEAddress& address, bool async) {
+	if (!prepare_ble_client()) {
+		return false;
+	}
+	is_async_connect = async;
+	mtu_pending = false;
+	if (!blec->connect(address, !cache_attributes, async, false)) {
+		return false;
+	}
+	if (!async) {
+		request_phy();
+	}
+	return true;
+}
+
+/**
+ * @details With the attribute cache, services are discovered again if the cached ones do not work.
+ */
+bool
+NimBLETransport::open() {
+	if (!blec) {
+		DEBUG_PRINTLN("BLE client not initialized (already disconnected?)");
+		return false;
+	}
+	if (subscribe_rx()) {
+		return true;
+	}
+	if (cache_attributes && blec->isConnected()) {
+		// attribute table of the device may have changed
+		DEBUG_PRINTLN("Retrying with service discovery");
+		blec->deleteServices();
+		tx = rx = nullptr;
+		return subscribe_rx();
+	}
+	return false;
+}
+
+bool
+NimBLETransport::subscribe_rx() {
+	auto srv = blec->getService(Sesame::SESAME3_SRV_UUID);
+	if (srv && (tx = srv->getCharacteristic(Sesame::TxUUID)) && (rx = srv->getCharacteristic(Sesame::RxUUID))) {
+		if (handler) {
+			handler->on_transport_discovered();
+		}
+		if (rx->subscribe(
+		        true,
+		        [this](NimBLERemoteCharacteristic* ch, uint8_t* data, size_t size, bool isNotify) {
+			        if (!isNotify || size <= 1 || !handler)
+				        return;
+			        handler->on_transport_received(data, size);
+		        },
+		        true)) {
+			return true;
+		} else {
+			DEBUG_PRINTLN("Failed to subscribe RX char, rc=%d", blec->getLastError());
+		}
+	} else {
+		DEBUG_PRINTLN("The device does not have TX or RX chars, rc=%d", blec->getLastError());
+	}
+	return false;
+}
+
+bool
+NimBLETransport::write(const uint8_t* data, size_t size) {
+	if (!blec || !tx) {
+		DEBUG_PRINTLN("ble or tx not initialized");
+		return false;
+	}
+	return tx->writeValue(data, size, false);
+}
+
+bool
+NimBLETransport::disconnect() {
+	if (!blec) {
+		return false;
+	}
+	// prevent disconnect callback loop
+	blec->setClientCallbacks(nullptr, false);
+	if (cache_attributes) {
+		// keep the client and its attribute table for the next session
+		if (blec->isConnected() && !blec->disconnect()) {
+			DEBUG_PRINTLN("Failed to disconnect, rc=%d", blec->getLastError());
+		}
+	} else {
+		if (!NimBLEDevice::deleteClient(blec)) {
+			DEBUG_PRINTLN("Failed to delete NimBLE client");
+		}
+		blec = nullptr;
+	}
+	return true;
+}
+
+/**
+ * @brief Set connection parameters and preferred PHY
+ * @details Used for following connections, an update is requested if connected.
+ * @return false if `params` is invalid or the update request failed
+ */
+bool
+NimBLETransport::set_connection_params(const ConnectionParams& params) {
+	if (!params.is_valid()) {
+		DEBUG_PRINTLN("Invalid connection parameters");
+		return false;
+	}
+	conn_params = params;
+	if (!is_connected()) {
+		return true;
+	}
+	if (!blec->updateConnParams(params.min_interval, params.max_interval, params.latency, params.supervision_timeout)) {
+		DEBUG_PRINTLN("Failed to update connection parameters, rc=%d", blec->getLastError());
+		return false;
+	}
+	request_phy();
+	return true;
+}
+
+/** PHY change is optional (not all controllers support 2M or Coded), failure only logged */
+void
+NimBLETransport::request_phy() {
+	if (conn_params && conn_params->phy_mask && !blec->updatePhy(conn_params->phy_mask, conn_params->phy_mask, 0)) {
+		DEBUG_PRINTLN("Failed to request PHY update, rc=%d", blec->getLastError());
+	}
+}
+
+void
+NimBLETransport::set_mtu_exchange(bool enable, uint16_t data_len) {
+	mtu_exchange = enable;
+	mtu_data_len = data_len;
+	mtu_unsupported = false;
+}
+
+void
+NimBLETransport::on_authenticated() {
+	if (mtu_exchange && !mtu_unsupported) {
+		// exchangeMTU() waits for the response, negotiate in loop()
+		mtu_pending = true;
+	}
+}
+
+void
+NimBLETransport::loop() {
+	if (mtu_pending.exchange(false)) {
+		negotiate_mtu();
+	}
+}
+
+void
+NimBLETransport::negotiate_mtu() {
+	if (!is_connected()) {
+		return;
+	}
+	if (!blec->exchangeMTU()) {
+		DEBUG_PRINTLN("MTU exchange failed, rc=%d, using default MTU", blec->getLastError());
+		mtu_unsupported = true;
+		return;
+	}
+	DEBUG_PRINTLN("MTU=%u", blec->getMTU());
+	if (mtu_data_len && !blec->setDataLen(mtu_data_len)) {
+		DEBUG_PRINTLN("Failed to set data length");
+	}
+}
+
+void
+NimBLETransport::set_attribute_cache(bool enable) {
+	cache_attributes = enable;
+	if (!enable) {
+		cache_invalid = true;
+	}
+}
+
+void
+NimBLETransport::onDisconnect(NimBLEClient* pClient, int reason) {
+	DEBUG_PRINTLN("BT disconnected by peer, rc=%d", reason);
+	if (handler) {
+		handler->on_transport_disconnected(reason);
+	}
+}
+
+void
+NimBLETransport::onConnect(NimBLEClient* pClient) {
+	if (!is_async_connect) {
+		return;
+	}
+	DEBUG_PRINTLN("BT connected");
+	request_phy();
+	if (handler) {
+		handler->on_transport_connected();
+	}
+}
+
+void
+NimBLETransport::onConnectFail(NimBLEClient* pClient, int reason) {
+	if (!is_async_connect) {
+		return;
+	}
+	DEBUG_PRINTLN("BT connect failed, rc=%d", reason);
+	blec->setClientCallbacks(nullptr, false);
+	if (handler) {
+		handler->on_transport_connect_failed(reason);
+	}
+}
+
+bool
+LoopbackTransport::connect(const NimBLEAddress& /* address */, bool async) {
+	std::lock_guard lock{mutex};
+	if (connected || connecting) {
+		last_error = connected ? BLE_HS_EDONE : BLE_HS_EALREADY;
+		return false;
+	}
+	events.clear();
+	if (async) {
+		attached = connecting = true;
+		events.push_back(connect_error ? Event{event_t::connect_failed, connect_error, {}} : Event{event_t::connected, 0, {}});
+		return true;
+	}
+	if (connect_error) {
+		last_error = connect_error;
+		return false;
+	}
+	attached = connected = true;
+	opened = false;
+	last_error = 0;
+	return true;
+}
+
+bool
+LoopbackTransport::open() {
+	if (!connected) {
+		last_error = BLE_HS_ENOTCONN;
+		return false;
+	}
+	if (handler) {
+		handler->on_transport_discovered();
+	}
+	if (!opened) {
+		opened = true;
+		peer.on_open(*this);
+	}
+	return true;
+}
+
+bool
+LoopbackTransport::write(const uint8_t* data, size_t size) {
+	if (!opened) {
+		last_error = BLE_HS_ENOTCONN;
+		return false;
+	}
+	peer.on_write(*this, data, size);
+	return true;
+}
+
+bool
+LoopbackTransport::disconnect() {
+	{
+		std::lock_guard lock{mutex};
+		if (!attached) {
+			return false;
+		}
+		events.clear();
+		attached = connecting = false;
+	}
+	bool was_connected = connected;
+	connected = opened = false;
+	if (was_connected) {
+		peer.on_close(*this);
+	}
+	return true;
+}
+
+/**
+ * @brief Send a fragment to the client
+ * @return false if not connected
+ */
+bool
+LoopbackTransport::notify(const uint8_t* data, size_t size) {
+	return push({event_t::received, 0, {data, data + size}});
+}
+
+/** Close the link from the peer side */
+void
+LoopbackTransport::close(int reason) {
+	push({event_t::closed, reason, {}});
+}
+
+bool
+LoopbackTransport::push(Event&& event) {
+	std::lock_guard lock{mutex};
+	if (!attached) {
+		return false;
+	}
+	events.push_back(std::move(event));
+	return true;
+}
+
+/** Report queued events to the handler */
+void
+LoopbackTransport::loop() {
+	std::deque<Event> pending;
+	{
+		std::lock_guard lock{mutex};
+		pending.swap(events);
+	}
+	for (auto& ev : pending) {
+		switch (ev.type) {
+			case event_t::connected:
+				connecting = false;
+				connected = true;
+				opened = false;
+				last_error = 0;
+				if (handler) {
+					handler->on_transport_connected();
+				}
+				break;
+			case event_t::connect_failed:
+				connecting = false;
+				last_error = ev.reason;
+				if (handler) {
+					handler->on_transport_connect_failed(ev.reason);
+				}
+				return;
+			case event_t::received:
+				if (opened && ev.data.size() > 1 && handler) {
+					handler->on_transport_received(ev.data.data(), ev.data.size());
+				}
+				break;
+			case event_t::closed:
+				if (!connected) {
+					break;
+				}
+				connected = opened = false;
+				if (handler) {
+					handler->on_transport_disconnected(ev.reason);
+				}
+				return;
+		}
+		if (!attached) {
+			return;  // disconnect() from the handler
+		}
+	}
+}
+
+}  // namespace libsesame3bt
@@ -0,0 +1,208 @@
+#pragma once
+#include <NimBLEDevice.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Link between SesameClient and a device
+ * @details Connects, opens the message channel (TX write / RX notify), writes fragments and disconnects. Results of
+ * asynchronous operations and received fragments are reported to the Handler. SesameClient uses NimBLETransport unless
+ * another transport is set with SesameClient::set_transport().
+ */
+class Transport {
+ public:
+	/** Receiver of transport events (SesameClient) */
+	class Handler {
+	 public:
+		virtual ~Handler() = default;
+		/** asynchronous connect() completed */
+		virtual void on_transport_connected() = 0;
+		/** asynchronous connect() failed */
+		virtual void on_transport_connect_failed(int reason) = 0;
+		/** link closed by the device or lost (not called by disconnect()) */
+		virtual void on_transport_disconnected(int reason) = 0;
+		/** notification fragment from the device */
+		virtual void on_transport_received(uint8_t* data, size_t size) = 0;
+		/** services of the device are known, called by open() before subscribing */
+		virtual void on_transport_discovered() {}
+	};
+
+	virtual ~Transport() = default;
+	void set_handler(Handler* handler) { this->handler = handler; }
+	/**
+	 * @brief Connect to the device
+	 * @param async true to return immediately, the result is reported to the handler
+	 * @return false if failed (synchronous) or could not start (asynchronous), see get_last_error()
+	 */
+	virtual bool connect(const NimBLEAddress& address, bool async) = 0;
+	/** Open the message channel of a connected device (synchronous) */
+	virtual bool open() = 0;
+	/** Write a message fragment */
+	virtual bool write(const uint8_t* data, size_t size) = 0;
+	/**
+	 * @brief Close the link, the handler is not called
+	 * @return false if there was nothing to close
+	 */
+	virtual bool disconnect() = 0;
+	virtual bool is_connected() const = 0;
+	/** Error code of the last failed operation */
+	virtual int get_last_error() const = 0;
+	/** ATT MTU of the current link, 0 if not connected */
+	virtual uint16_t get_mtu() const = 0;
+	/** Called when the session is authenticated */
+	virtual void on_authenticated() {}
+	/** Called when the session ended during authentication */
+	virtual void on_authentication_failed() {}
+	/** Called from SesameClient::loop() */
+	virtual void loop() {}
+
+ protected:
+	Handler* handler = nullptr;
+};
+
+/**
+ * @brief BLE connection parameters
+ * @details Intervals are in units of 1.25ms, supervision timeout in units of 10ms.
+ */
+struct ConnectionParams {
+	uint16_t min_interval;
+	uint16_t max_interval;
+	/** number of connection events the device may skip */
+	uint16_t latency;
+	uint16_t supervision_timeout;
+	/** preferred PHYs (BLE_GAP_LE_PHY_1M_MASK, ..._2M_MASK, ..._CODED_MASK), 0 to leave PHY as is */
+	uint8_t phy_mask = 0;
+
+	bool is_valid() const;
+	/** 7.5-15ms, for authentication and commands */
+	static constexpr ConnectionParams fast() { return {6, 12, 0, 200}; }
+	/** 30-50ms, NimBLE default */
+	static constexpr ConnectionParams balanced() { return {24, 40, 0, 400}; }
+	/** 100-200ms with latency 4, for long-lived idle sessions */
+	static constexpr ConnectionParams relaxed() { return {80, 160, 4, 600}; }
+};
+
+/**
+ * @brief Transport over NimBLE GATT client (default of SesameClient)
+ * @details Owns the NimBLEClient. SesameClient calls write() of its own NimBLETransport directly (not virtually).
+ */
+class NimBLETransport final : public Transport, private NimBLEClientCallbacks {
+ public:
+	NimBLETransport() = default;
+	NimBLETransport(const NimBLETransport&) = delete;
+	NimBLETransport& operator=(const NimBLETransport&) = delete;
+	virtual ~NimBLETransport();
+	virtual bool connect(const NimBLEAddress& address, bool async) override;
+	virtual bool open() override;
+	virtual bool write(const uint8_t* data, size_t size) override;
+	virtual bool disconnect() override;
+	virtual bool is_connected() const override { return blec && blec->isConnected(); }
+	virtual int get_last_error() const override { return blec ? blec->getLastError() : 0; }
+	virtual uint16_t get_mtu() const override { return is_connected() ? blec->getMTU() : 0; }
+	virtual void on_authenticated() override;
+	virtual void on_authentication_failed() override { cache_invalid = true; }
+	virtual void loop() override;
+
+	/** may be nullptr before the first connect() or after disconnect() */
+	NimBLEClient* get_client() const { return blec; }
+	void set_connect_timeout(uint32_t timeout) { connect_timeout = timeout; }
+	bool set_connection_params(const ConnectionParams& params);
+	const std::optional<ConnectionParams>& get_connection_params() const { return conn_params; }
+	void set_mtu_exchange(bool enable, uint16_t data_len);
+	void set_attribute_cache(bool enable);
+
+ private:
+	NimBLEClient* blec = nullptr;
+	NimBLERemoteCharacteristic* tx = nullptr;
+	NimBLERemoteCharacteristic* rx = nullptr;
+	uint32_t connect_timeout = 30'000;
+	std::optional<ConnectionParams> conn_params;
+	bool is_async_connect = false;
+	bool cache_attributes = false;
+	bool cache_invalid = false;
+	bool mtu_exchange = false;
+	/** MTU exchange failed, skipped until set_mtu_exchange() is called again */
+	bool mtu_unsupported = false;
+	uint16_t mtu_data_len = 0;
+	std::atomic<bool> mtu_pending{false};
+
+	bool prepare_ble_client();
+	void request_phy();
+	void negotiate_mtu();
+	bool subscribe_rx();
+
+	virtual void onDisconnect(NimBLEClient* pClient, int reason) override;
+	virtual void onConnect(NimBLEClient* pClient) override;
+	virtual void onConnectFail(NimBLEClient* pClient, int reason) override;
+};
+
+/**
+ * @brief In-memory transport to a Peer object in the same process
+ * @details Writes are passed to the peer synchronously. Asynchronous connection results, fragments sent by the peer
+ * and closing by the peer are queued and reported from loop() (SesameClient::loop()), so the peer may call notify()
+ * from any thread and from its write handler. No radio and no NimBLE host are involved: the session logic of
+ * SesameClient can be run and profiled in isolation.
+ */
+class LoopbackTransport : public Transport {
+ public:
+	/** Device side of the link */
+	class Peer {
+	 public:
+		virtual ~Peer() = default;
+		/** the client opened the message channel */
+		virtual void on_open(LoopbackTransport& /* link */) {}
+		/** fragment written by the client */
+		virtual void on_write(LoopbackTransport& link, const uint8_t* data, size_t size) = 0;
+		/** the client disconnected */
+		virtual void on_close(LoopbackTransport& /* link */) {}
+	};
+
+	explicit LoopbackTransport(Peer& peer) : peer(peer) {}
+	LoopbackTransport(const LoopbackTransport&) = delete;
+	LoopbackTransport& operator=(const LoopbackTransport&) = delete;
+	virtual bool connect(const NimBLEAddress& address, bool async) override;
+	virtual bool open() override;
+	virtual bool write(const uint8_t* data, size_t size) override;
+	virtual bool disconnect() override;
+	virtual bool is_connected() const override { return connected; }
+	virtual int get_last_error() const override { return last_error; }
+	virtual uint16_t get_mtu() const override { return connected ? mtu : 0; }
+	virtual void loop() override;
+
+	// peer side
+	bool notify(const uint8_t* data, size_t size);
+	void close(int reason = BLE_ERR_REM_USER_CONN_TERM);
+	/** Fail following connect() calls with `reason`, 0 to accept */
+	void set_connect_error(int reason) { connect_error = reason; }
+	void set_mtu(uint16_t mtu) { this->mtu = mtu; }
+
+ private:
+	enum class event_t : uint8_t { connected, connect_failed, received, closed };
+	struct Event {
+		event_t type;
+		int reason;
+		std::vector<uint8_t> data;
+	};
+	Peer& peer;
+	std::mutex mutex;
+	std::deque<Event> events;
+	/** connect() called and not disconnected, events are accepted */
+	bool attached = false;
+	bool connecting = false;
+	bool connected = false;
+	bool opened = false;
+	int connect_error = 0;
+	int last_error = 0;
+	uint16_t mtu = 23;
+
+	bool push(Event&& event);
+};
+
+}  // namespace libsesame3bt
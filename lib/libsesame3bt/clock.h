@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#if defined(ESP_PLATFORM)
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+namespace libsesame3bt::sysclock {
+
+#if defined(ESP_PLATFORM)
+
+/** Monotonic time since boot in microseconds */
+inline uint64_t
+now_us() {
+	return static_cast<uint64_t>(esp_timer_get_time());
+}
+
+/** Block the calling task */
+inline void
+sleep_ms(uint32_t ms) {
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+#else
+
+using source_t = uint64_t (*)();
+
+inline source_t&
+source() {
+	static source_t src = nullptr;
+	return src;
+}
+
+/**
+ * @brief Replace the time source (host only)
+ * @param src Function returning monotonic microseconds, nullptr to use steady_clock
+ */
+inline void
+set_source(source_t src) {
+	source() = src;
+}
+
+/** Monotonic time in microseconds */
+inline uint64_t
+now_us() {
+	if (auto src = source()) {
+		return src();
+	}
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+using sleeper_t = void (*)(uint32_t ms);
+
+inline sleeper_t&
+sleeper() {
+	static sleeper_t fn = nullptr;
+	return fn;
+}
+
+/**
+ * @brief Replace sleep_ms() (host only), e.g. to advance a virtual clock
+ * @param fn Function blocking for `ms` milliseconds, nullptr to use std::this_thread::sleep_for
+ */
+inline void
+set_sleeper(sleeper_t fn) {
+	sleeper() = fn;
+}
+
+/** Block the calling thread */
+inline void
+sleep_ms(uint32_t ms) {
+	if (auto fn = sleeper()) {
+		fn(ms);
+		return;
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#endif
+
+/** Monotonic time in milliseconds (wraps around after 49 days) */
+inline uint32_t
+now_ms() {
+	return static_cast<uint32_t>(now_us() / 1000);
+}
+
+}  // namespace libsesame3bt::sysclock
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#define BLE_ADDR_PUBLIC (0x00)
+#define BLE_ADDR_RANDOM (0x01)
+
+/**
+ * @brief Host stand-in of NimBLEAddress
+ * @details Value is stored in NimBLE byte order (least significant byte first), string form is most significant byte first.
+ */
+class NimBLEAddress {
+ public:
+	NimBLEAddress() = default;
+	NimBLEAddress(const uint8_t address[6], uint8_t type) : type(type) { std::memcpy(val, address, sizeof(val)); }
+	NimBLEAddress(const std::string& str, uint8_t type) : type(type) {
+		unsigned int b[6];
+		if (std::sscanf(str.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x", &b[5], &b[4], &b[3], &b[2], &b[1], &b[0]) != 6) {
+			return;
+		}
+		for (size_t i = 0; i < 6; i++) {
+			val[i] = static_cast<uint8_t>(b[i]);
+		}
+	}
+	bool isNull() const { return *this == NimBLEAddress{}; }
+	uint8_t getType() const { return type; }
+	const uint8_t* getVal() const { return val; }
+	std::string toString() const {
+		char buf[18];
+		std::snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x", val[5], val[4], val[3], val[2], val[1], val[0]);
+		return buf;
+	}
+	bool operator==(const NimBLEAddress& other) const { return std::memcmp(val, other.val, sizeof(val)) == 0; }
+	bool operator!=(const NimBLEAddress& other) const { return !(*this == other); }
+
+ private:
+	uint8_t val[6]{};
+	uint8_t type = BLE_ADDR_PUBLIC;
+};
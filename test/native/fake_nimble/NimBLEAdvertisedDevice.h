@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "NimBLEAddress.h"
+#include "NimBLEUUID.h"
+
+/**
+ * @brief Host stand-in of NimBLEAdvertisedDevice
+ * @details Accessors decode the raw AD structures the same way NimBLE does, so the cost of each call is comparable.
+ */
+class NimBLEAdvertisedDevice {
+ public:
+	NimBLEAdvertisedDevice(const NimBLEAddress& address, int8_t rssi, std::vector<uint8_t> payload)
+	    : address(address), rssi(rssi), payload(std::move(payload)) {}
+
+	const NimBLEAddress& getAddress() const { return address; }
+	int8_t getRSSI() const { return rssi; }
+	const std::vector<uint8_t>& getPayload() const { return payload; }
+	uint8_t getAddressType() const { return address.getType(); }
+	std::string getName() const {
+		const uint8_t* data;
+		uint8_t len;
+		if (find(0x09, data, len) || find(0x08, data, len)) {
+			return {reinterpret_cast<const char*>(data), len};
+		}
+		return {};
+	}
+	std::string getManufacturerData() const {
+		const uint8_t* data;
+		uint8_t len;
+		if (find(0xff, data, len)) {
+			return {reinterpret_cast<const char*>(data), len};
+		}
+		return {};
+	}
+	bool haveName() const { return !getName().empty(); }
+	bool haveManufacturerData() const { return !getManufacturerData().empty(); }
+	bool isAdvertisingService(const NimBLEUUID& uuid) const {
+		for (size_t i = 0; i + 1 < payload.size();) {
+			uint8_t len = payload[i];
+			if (len == 0 || i + 1 + len > payload.size()) {
+				break;
+			}
+			uint8_t type = payload[i + 1];
+			size_t unit = (type == 0x02 || type == 0x03) ? 2 : (type == 0x04 || type == 0x05) ? 4 : (type == 0x06 || type == 0x07) ? 16 : 0;
+			for (size_t p = 0; unit && p + unit <= len - 1u; p += unit) {
+				if (NimBLEUUID{&payload[i + 2 + p], unit} == uuid) {
+					return true;
+				}
+			}
+			i += 1 + len;
+		}
+		return false;
+	}
+
+ private:
+	NimBLEAddress address;
+	int8_t rssi;
+	std::vector<uint8_t> payload;
+
+	bool find(uint8_t ad_type, const uint8_t*& data, uint8_t& len) const {
+		for (size_t i = 0; i + 1 < payload.size();) {
+			uint8_t l = payload[i];
+			if (l == 0 || i + 1 + l > payload.size()) {
+				break;
+			}
+			if (payload[i + 1] == ad_type) {
+				data = &payload[i + 2];
+				len = l - 1;
+				return true;
+			}
+			i += 1 + l;
+		}
+		return false;
+	}
+};
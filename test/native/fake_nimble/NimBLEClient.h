@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "NimBLEAddress.h"
+#include "NimBLERemoteCharacteristic.h"
+#include "NimBLEUUID.h"
+
+#define BLE_HS_EALREADY (2)
+#define BLE_HS_EINVAL (3)
+#define BLE_HS_ENOTCONN (7)
+#define BLE_HS_ENOTSUP (8)
+#define BLE_HS_ETIMEOUT (13)
+#define BLE_HS_EDONE (14)
+#define BLE_HS_EBUSY (15)
+#define BLE_HS_ENOMEM (6)
+#define BLE_HS_EAUTHEN (23)
+#define BLE_HS_EAUTHOR (24)
+#define BLE_HS_EENCRYPT (25)
+#define BLE_HS_EDISABLED (30)
+#define BLE_HS_ERR_ATT_BASE (0x100)
+#define BLE_HS_ERR_HCI_BASE (0x200)
+#define BLE_ATT_ERR_INVALID_HANDLE (0x01)
+#define BLE_ERR_AUTH_FAIL (0x05)
+#define BLE_ERR_CONN_SPVN_TMO (0x08)
+#define BLE_ERR_CONN_LIMIT (0x09)
+#define BLE_ERR_ACL_CONN_EXISTS (0x0b)
+#define BLE_ERR_UNSUPPORTED (0x11)
+#define BLE_ERR_INV_HCI_CMD_PARMS (0x12)
+#define BLE_ERR_REM_USER_CONN_TERM (0x13)
+#define BLE_ERR_CONN_TERM_LOCAL (0x16)
+#define BLE_ERR_CONN_PARMS (0x3b)
+#define BLE_ERR_CONN_ESTABLISHMENT (0x3e)
+#define BLE_GAP_LE_PHY_1M (1)
+#define BLE_GAP_LE_PHY_2M (2)
+#define BLE_GAP_LE_PHY_CODED (3)
+#define BLE_GAP_LE_PHY_1M_MASK (0x01)
+#define BLE_GAP_LE_PHY_2M_MASK (0x02)
+#define BLE_GAP_LE_PHY_CODED_MASK (0x04)
+
+namespace fake_nimble {
+class Peripheral;
+}
+
+class NimBLEClient;
+
+class NimBLEClientCallbacks {
+ public:
+	virtual ~NimBLEClientCallbacks() = default;
+	virtual void onConnect(NimBLEClient* /* pClient */) {}
+	virtual void onConnectFail(NimBLEClient* /* pClient */, int /* reason */) {}
+	virtual void onDisconnect(NimBLEClient* /* pClient */, int /* reason */) {}
+};
+
+/**
+ * @brief Host stand-in of NimBLEClient
+ * @details Connects to a fake_nimble::Peripheral registered with the same address. Asynchronous results are
+ * delivered from fake_nimble::run().
+ */
+class NimBLEClient {
+ public:
+	bool connect(const NimBLEAddress& address, bool deleteAttributes = true, bool asyncConnect = false, bool exchangeMTU = true);
+	bool disconnect(uint8_t reason = BLE_ERR_REM_USER_CONN_TERM);
+	bool isConnected() const { return connected; }
+	int getLastError() const { return last_error; }
+	void setClientCallbacks(NimBLEClientCallbacks* callbacks, bool /* deleteCallbacks */ = true) { this->callbacks = callbacks; }
+	void setConnectTimeout(uint32_t timeout) { connect_timeout = timeout; }
+	void setConnectionParams(uint16_t minInterval,
+	                         uint16_t maxInterval,
+	                         uint16_t latency,
+	                         uint16_t timeout,
+	                         uint16_t /* scanInterval */ = 16,
+	                         uint16_t /* scanWindow */ = 16) {
+		min_interval = minInterval;
+		max_interval = maxInterval;
+		this->latency = latency;
+		supervision_timeout = timeout;
+	}
+	bool updateConnParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+	bool updatePhy(uint8_t txPhysMask, uint8_t rxPhysMask, uint16_t phyOptions = 0);
+	bool getPhy(uint8_t* txPhy, uint8_t* rxPhy) {
+		if (!connected) {
+			return false;
+		}
+		*txPhy = *rxPhy = phy;
+		return true;
+	}
+	NimBLERemoteService* getService(const NimBLEUUID& uuid);
+	void deleteServices() { services.clear(); }
+	NimBLEAddress getPeerAddress() const { return peer_address; }
+	uint16_t getConnHandle() const { return connected ? conn_handle : 0xffff; }
+	uint16_t getMTU() const { return mtu; }
+	bool exchangeMTU();
+	bool setDataLen(uint16_t txOctets);
+
+	// fake controls
+	NimBLEClientCallbacks* get_callbacks() const { return callbacks; }
+	fake_nimble::Peripheral* get_peer() const { return peer; }
+	uint32_t get_connect_timeout() const { return connect_timeout; }
+	uint16_t get_max_interval() const { return max_interval; }
+	uint16_t get_min_interval() const { return min_interval; }
+	uint16_t get_latency() const { return latency; }
+	uint16_t get_supervision_timeout() const { return supervision_timeout; }
+	NimBLERemoteCharacteristic* find_characteristic(const NimBLEUUID& uuid) const {
+		for (auto& svc : services) {
+			if (auto* ch = svc->getCharacteristic(uuid)) {
+				return ch;
+			}
+		}
+		return nullptr;
+	}
+	void set_last_error(int rc) { last_error = rc; }
+	uint32_t link_delay_us(bool to_peer, unsigned hops = 1) const;
+	void on_peer_disconnected(int reason);
+	void detach() {
+		peer = nullptr;
+		connected = false;
+		connecting = false;
+	}
+
+ private:
+	friend class NimBLEDevice;
+	NimBLEClientCallbacks* callbacks = nullptr;
+	fake_nimble::Peripheral* peer = nullptr;
+	NimBLEAddress peer_address;
+	std::vector<std::unique_ptr<NimBLERemoteService>> services;
+	int last_error = 0;
+	uint32_t connect_timeout = 30'000;
+	uint16_t conn_handle = 0xffff;
+	uint16_t min_interval = 24;
+	uint16_t max_interval = 40;
+	uint16_t latency = 0;
+	uint16_t supervision_timeout = 400;
+	uint16_t mtu = 23;
+	uint8_t phy = BLE_GAP_LE_PHY_1M;
+	/** time of a connection event, following events are every max_interval */
+	uint64_t anchor_us = 0;
+	bool connected = false;
+	bool connecting = false;
+
+	void establish(const NimBLEAddress& address, fake_nimble::Peripheral* peripheral, bool deleteAttributes);
+	bool teardown();
+};
@@ -0,0 +1,403 @@
+#pragma once
+/**
+ * Host stand-in of NimBLE-Arduino.
+ *
+ * Covers the part of the NimBLE-Arduino 2.x API used by libsesame3bt so that the library sources compile unchanged for
+ * the `native` environment. Peers, advertisements and timing are controlled through fake_nimble.h.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "NimBLEAddress.h"
+#include "NimBLEAdvertisedDevice.h"
+#include "NimBLEClient.h"
+#include "NimBLERemoteCharacteristic.h"
+#include "NimBLEScan.h"
+#include "NimBLEUUID.h"
+#include "fake_nimble.h"
+
+#define BLE_OWN_ADDR_PUBLIC (0x00)
+#define BLE_OWN_ADDR_RANDOM (0x01)
+
+class NimBLEDevice {
+ public:
+	static bool init(const std::string& /* deviceName */) {
+		initialized = true;
+		return true;
+	}
+	static bool deinit(bool clearAll = false) {
+		if (clearAll) {
+			while (!clients().empty()) {
+				deleteClient(clients().back().get());
+			}
+		}
+		initialized = false;
+		return true;
+	}
+	static bool isInitialized() { return initialized; }
+	static bool setOwnAddrType(uint8_t /* type */) { return true; }
+	static bool setOwnAddr(const NimBLEAddress& /* addr */) { return true; }
+	static NimBLEScan* getScan() {
+		static NimBLEScan scan;
+		return &scan;
+	}
+	static NimBLEClient* createClient() {
+		clients().push_back(std::make_unique<NimBLEClient>());
+		return clients().back().get();
+	}
+	static bool deleteClient(NimBLEClient* client) {
+		auto& list = clients();
+		auto it = std::find_if(list.begin(), list.end(), [client](auto& c) { return c.get() == client; });
+		if (it == list.end()) {
+			return false;
+		}
+		if (client->isConnected() && client->teardown() && client->get_callbacks()) {
+			client->get_callbacks()->onDisconnect(client, BLE_ERR_CONN_TERM_LOCAL);
+		}
+		// events already queued for the client may still run, keep the object until the process ends
+		client->setClientCallbacks(nullptr, false);
+		retired().push_back(std::move(*it));
+		list.erase(it);
+		return true;
+	}
+	static size_t getCreatedClientCount() { return clients().size(); }
+
+ private:
+	friend class NimBLEClient;
+	static inline bool initialized = false;
+	static std::vector<std::unique_ptr<NimBLEClient>>& clients() {
+		static std::vector<std::unique_ptr<NimBLEClient>> list;
+		return list;
+	}
+	static std::vector<std::unique_ptr<NimBLEClient>>& retired() {
+		static std::vector<std::unique_ptr<NimBLEClient>> list;
+		return list;
+	}
+};
+
+using BLEDevice = NimBLEDevice;
+using BLEAddress = NimBLEAddress;
+using BLEUUID = NimBLEUUID;
+
+inline NimBLEScanResults
+NimBLEScan::getResults(uint32_t duration, bool is_continue) {
+	start(duration, is_continue);
+	for (const auto& adv : fake_nimble::world().air) {
+		if (!scanning) {
+			break;
+		}
+		deliver(adv);
+	}
+	if (scanning) {
+		end(0);
+	}
+	return results;
+}
+
+inline bool
+NimBLERemoteCharacteristic::writeValue(const uint8_t* data, size_t length, bool /* response */) const {
+	auto* client = service->getClient();
+	auto* peer = client->get_peer();
+	if (!client->isConnected() || !peer) {
+		return false;
+	}
+	peer->writes++;
+	auto delay = client->link_delay_us(true);
+	if (peer->on_write) {
+		std::vector<uint8_t> copy{data, data + length};
+		auto uuid = this->uuid;
+		fake_nimble::post(
+		    [peer, uuid, copy]() {
+			    if (peer->on_write) {
+				    peer->on_write(*peer, uuid, copy.data(), copy.size());
+			    }
+		    },
+		    delay);
+	}
+	return true;
+}
+
+inline bool
+NimBLERemoteCharacteristic::subscribe(bool /* notifications */, const notify_callback notifyCallback, bool response) {
+	auto* peer = service->getClient()->get_peer();
+	if (!service->getClient()->isConnected() || !peer) {
+		return false;
+	}
+	// stale handle of a cached attribute table
+	bool known = std::any_of(peer->services.begin(), peer->services.end(), [this](const auto& svc) {
+		return std::any_of(svc.characteristics.begin(), svc.characteristics.end(),
+		                   [this](const auto& ch) { return ch.handle == handle && ch.uuid == uuid; });
+	});
+	if (!known) {
+		service->getClient()->set_last_error(BLE_HS_ERR_ATT_BASE + BLE_ATT_ERR_INVALID_HANDLE);
+		return false;
+	}
+	peer->subscriptions++;
+	callback = notifyCallback;
+	fake_nimble::post(
+	    [peer]() {
+		    if (peer->on_subscribe && peer->client) {
+			    peer->on_subscribe(*peer);
+		    }
+	    },
+	    service->getClient()->link_delay_us(true));
+	if (response) {  // CCCD write round trip
+		fake_nimble::run(fake_nimble::now_us() + service->getClient()->link_delay_us(true, 2));
+	}
+	return true;
+}
+
+inline bool
+NimBLEClient::connect(const NimBLEAddress& address, bool deleteAttributes, bool asyncConnect, bool /* exchangeMTU */) {
+	if (connected || connecting) {
+		last_error = connected ? BLE_HS_EDONE : BLE_HS_EALREADY;
+		return false;
+	}
+	// the host runs one connection attempt at a time
+	for (const auto& other : NimBLEDevice::clients()) {
+		if (other->connecting) {
+			last_error = BLE_HS_EALREADY;
+			return false;
+		}
+	}
+	auto* peripheral = fake_nimble::find_peripheral(address);
+	int reason = !peripheral ? BLE_HS_ETIMEOUT : peripheral->connect_error;
+	uint32_t latency = peripheral ? peripheral->hop_latency_us * 2 : connect_timeout * 1000;
+	if (!asyncConnect) {
+		fake_nimble::run(fake_nimble::now_us() + latency);
+		if (reason) {
+			last_error = reason;
+			return false;
+		}
+		establish(address, peripheral, deleteAttributes);
+		return true;
+	}
+	connecting = true;
+	fake_nimble::post(
+	    [this, address, peripheral, reason, deleteAttributes]() {
+		    if (!connecting) {
+			    return;
+		    }
+		    connecting = false;
+		    if (reason) {
+			    last_error = reason;
+			    if (callbacks) {
+				    callbacks->onConnectFail(this, reason);
+			    }
+			    return;
+		    }
+		    establish(address, peripheral, deleteAttributes);
+		    if (callbacks) {
+			    callbacks->onConnect(this);
+		    }
+	    },
+	    latency);
+	return true;
+}
+
+inline void
+NimBLEClient::establish(const NimBLEAddress& address, fake_nimble::Peripheral* peripheral, bool deleteAttributes) {
+	if (deleteAttributes || peer_address != address) {
+		services.clear();
+	}
+	peer = peripheral;
+	peer_address = address;
+	peer->client = this;
+	peer->connects++;
+	peer->last_due_us[0] = peer->last_due_us[1] = 0;
+	conn_handle = fake_nimble::world().next_conn_handle++;
+	mtu = 23;
+	phy = BLE_GAP_LE_PHY_1M;
+	anchor_us = fake_nimble::now_us();
+	connected = true;
+	last_error = 0;
+}
+
+inline bool
+NimBLEClient::teardown() {
+	connecting = false;
+	if (!connected) {
+		return false;
+	}
+	connected = false;
+	if (peer) {
+		peer->client = nullptr;
+		if (peer->on_disconnect) {
+			peer->on_disconnect(*peer);
+		}
+	}
+	peer = nullptr;
+	return true;
+}
+
+inline bool
+NimBLEClient::disconnect(uint8_t /* reason */) {
+	if (!connected) {
+		last_error = BLE_HS_ENOTCONN;
+		return false;
+	}
+	uint32_t latency = link_delay_us(true);
+	teardown();
+	fake_nimble::post(
+	    [this]() {
+		    if (callbacks) {
+			    callbacks->onDisconnect(this, BLE_ERR_CONN_TERM_LOCAL);
+		    }
+	    },
+	    latency);
+	return true;
+}
+
+inline void
+NimBLEClient::on_peer_disconnected(int reason) {
+	if (!teardown()) {
+		return;
+	}
+	if (callbacks) {
+		callbacks->onDisconnect(this, reason);
+	}
+}
+
+inline NimBLERemoteService*
+NimBLEClient::getService(const NimBLEUUID& uuid) {
+	for (auto& svc : services) {
+		if (svc->getUUID() == uuid) {
+			return svc.get();
+		}
+	}
+	if (!connected || !peer) {
+		last_error = BLE_HS_ENOTCONN;
+		return nullptr;
+	}
+	// service and characteristic discovery each cost a request/response round trip
+	peer->discoveries++;
+	fake_nimble::run(fake_nimble::now_us() + link_delay_us(true, 4));
+	for (auto& def : peer->services) {
+		if (def.uuid == uuid) {
+			services.push_back(std::make_unique<NimBLERemoteService>(this, uuid));
+			for (auto& ch : def.characteristics) {
+				services.back()->add_characteristic(ch.uuid, ch.handle);
+			}
+			return services.back().get();
+		}
+	}
+	last_error = BLE_HS_EDONE;
+	return nullptr;
+}
+
+inline bool
+NimBLEClient::exchangeMTU() {
+	if (!connected || !peer || peer->max_mtu == 0) {
+		last_error = connected ? BLE_HS_ETIMEOUT : BLE_HS_ENOTCONN;
+		return false;
+	}
+	fake_nimble::run(fake_nimble::now_us() + link_delay_us(true, 2));
+	mtu = std::min<uint16_t>(peer->max_mtu, 247);
+	return true;
+}
+
+inline bool
+NimBLEClient::setDataLen(uint16_t /* txOctets */) {
+	return connected;
+}
+
+inline bool
+NimBLEClient::updateConnParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout) {
+	if (!connected) {
+		last_error = BLE_HS_ENOTCONN;
+		return false;
+	}
+	// new parameters take effect from the next connection event
+	uint64_t interval = max_interval * 1'250ULL;
+	anchor_us += ((fake_nimble::now_us() - anchor_us) / interval + 1) * interval;
+	setConnectionParams(minInterval, maxInterval, latency, timeout);
+	return true;
+}
+
+inline bool
+NimBLEClient::updatePhy(uint8_t txPhysMask, uint8_t rxPhysMask, uint16_t /* phyOptions */) {
+	if (!connected || !peer) {
+		last_error = BLE_HS_ENOTCONN;
+		return false;
+	}
+	uint8_t common = txPhysMask & rxPhysMask & peer->supported_phys;
+	if (common & BLE_GAP_LE_PHY_2M_MASK) {
+		phy = BLE_GAP_LE_PHY_2M;
+	} else if (common & BLE_GAP_LE_PHY_CODED_MASK) {
+		phy = BLE_GAP_LE_PHY_CODED;
+	} else {
+		phy = BLE_GAP_LE_PHY_1M;
+	}
+	return true;
+}
+
+/**
+ * @brief Time for `hops` link layer messages alternating from the first direction (request, response, ...)
+ * @details Lost packets (Peripheral::loss_per_mille) add a retransmission each. A single hop is not delivered before
+ * the previous packet in the same direction.
+ * @param to_peer true if the first message is sent to the peripheral
+ */
+inline uint32_t
+NimBLEClient::link_delay_us(bool to_peer, unsigned hops) const {
+	if (!peer || hops == 0) {
+		return 0;
+	}
+	uint64_t delay = uint64_t{peer->hop_latency_us} * hops;
+	uint64_t interval = max_interval * 1'250ULL;
+	if (peer->connection_events) {
+		// each message waits for the next event, the peripheral listens on every (latency + 1)th event only but may send on any
+		uint64_t period = to_peer ? interval * (latency + 1) : interval;
+		delay += period - (fake_nimble::now_us() - anchor_us) % period + (hops - 1) * interval;
+	}
+	if (peer->loss_per_mille) {
+		uint64_t retry = peer->connection_events ? interval : peer->hop_latency_us;
+		for (unsigned i = 0; i < hops; i++) {
+			while (fake_nimble::random() % 1000 < peer->loss_per_mille) {
+				peer->retransmissions++;
+				delay += retry;
+			}
+		}
+	}
+	if (hops == 1) {
+		auto& last = peer->last_due_us[to_peer ? 1 : 0];
+		uint64_t due = std::max(fake_nimble::now_us() + delay, last);
+		last = due;
+		delay = due - fake_nimble::now_us();
+	}
+	return static_cast<uint32_t>(delay);
+}
+
+namespace fake_nimble {
+
+inline bool
+Peripheral::notify(const NimBLEUUID& uuid, const uint8_t* data, size_t size) {
+	if (!client) {
+		return false;
+	}
+	std::vector<uint8_t> copy{data, data + size};
+	auto* c = client;
+	post(
+	    [c, uuid, copy]() mutable {
+		    if (!c->isConnected()) {
+			    return;
+		    }
+		    if (auto* ch = c->find_characteristic(uuid)) {
+			    ch->deliver(copy.data(), copy.size());
+		    }
+	    },
+	    c->link_delay_us(false));
+	return true;
+}
+
+inline void
+Peripheral::disconnect(int reason) {
+	if (!client) {
+		return;
+	}
+	auto* c = client;
+	post([c, reason]() { c->on_peer_disconnected(reason); }, c->link_delay_us(false));
+}
+
+}  // namespace fake_nimble
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "NimBLEUUID.h"
+
+class NimBLEClient;
+class NimBLERemoteService;
+
+/**
+ * @brief Host stand-in of NimBLERemoteCharacteristic
+ * @details Writes are handed to the peripheral of the owning client through the fake event queue.
+ */
+class NimBLERemoteCharacteristic {
+ public:
+	using notify_callback = std::function<void(NimBLERemoteCharacteristic* pBLERemoteCharacteristic,
+	                                           uint8_t* pData,
+	                                           size_t length,
+	                                           bool isNotify)>;
+
+	NimBLERemoteCharacteristic(NimBLERemoteService* service, const NimBLEUUID& uuid, uint16_t handle)
+	    : service(service), uuid(uuid), handle(handle) {}
+	const NimBLEUUID& getUUID() const { return uuid; }
+	uint16_t getHandle() const { return handle; }
+	NimBLERemoteService* getRemoteService() const { return service; }
+	bool writeValue(const uint8_t* data, size_t length, bool response = false) const;
+	bool subscribe(bool notifications = true, const notify_callback notifyCallback = nullptr, bool response = true);
+	bool unsubscribe(bool /* response */ = true) {
+		callback = nullptr;
+		return true;
+	}
+
+	// fake controls
+	void deliver(uint8_t* data, size_t length) {
+		if (callback) {
+			callback(this, data, length, true);
+		}
+	}
+
+ private:
+	NimBLERemoteService* service;
+	NimBLEUUID uuid;
+	uint16_t handle;
+	notify_callback callback{};
+};
+
+class NimBLERemoteService {
+ public:
+	NimBLERemoteService(NimBLEClient* client, const NimBLEUUID& uuid) : client(client), uuid(uuid) {}
+	const NimBLEUUID& getUUID() const { return uuid; }
+	NimBLEClient* getClient() const { return client; }
+	NimBLERemoteCharacteristic* getCharacteristic(const NimBLEUUID& uuid) const {
+		for (auto& ch : characteristics) {
+			if (ch->getUUID() == uuid) {
+				return ch.get();
+			}
+		}
+		return nullptr;
+	}
+	void add_characteristic(const NimBLEUUID& uuid, uint16_t handle) {
+		characteristics.push_back(std::make_unique<NimBLERemoteCharacteristic>(this, uuid, handle));
+	}
+
+ private:
+	NimBLEClient* client;
+	NimBLEUUID uuid;
+	std::vector<std::unique_ptr<NimBLERemoteCharacteristic>> characteristics;
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "NimBLEAdvertisedDevice.h"
+
+class NimBLEScanResults {
+ public:
+	int getCount() const { return static_cast<int>(devices.size()); }
+	std::vector<const NimBLEAdvertisedDevice*>::const_iterator begin() const { return devices.begin(); }
+	std::vector<const NimBLEAdvertisedDevice*>::const_iterator end() const { return devices.end(); }
+
+ private:
+	friend class NimBLEScan;
+	std::vector<const NimBLEAdvertisedDevice*> devices;
+};
+
+class NimBLEScanCallbacks {
+ public:
+	virtual ~NimBLEScanCallbacks() = default;
+	virtual void onDiscovered(const NimBLEAdvertisedDevice* /* advertisedDevice */) {}
+	virtual void onResult(const NimBLEAdvertisedDevice* /* advertisedDevice */) {}
+	virtual void onScanEnd(const NimBLEScanResults& /* scanResults */, int /* reason */) {}
+};
+
+/**
+ * @brief Host stand-in of NimBLEScan
+ * @details Advertisements are injected with fake_nimble::advertise() while scanning. getResults() replays every
+ * advertisement registered by fake_nimble::add_advertisement() and then ends the scan.
+ */
+class NimBLEScan {
+ public:
+	void setScanCallbacks(NimBLEScanCallbacks* callbacks, bool /* wantDuplicates */ = false) { this->callbacks = callbacks; }
+	void setInterval(uint16_t intervalMs) { interval = intervalMs; }
+	void setWindow(uint16_t windowMs) { window = windowMs; }
+	void setActiveScan(bool active) { this->active = active; }
+	void setMaxResults(uint8_t maxResults) { max_results = maxResults; }
+	void setDuplicateFilter(uint8_t enabled) { duplicate_filter = enabled; }
+	bool start(uint32_t /* duration */, bool isContinue = false, bool /* restart */ = true) {
+		if (!isContinue) {
+			clearResults();
+		}
+		scanning = true;
+		starts++;
+		return true;
+	}
+	NimBLEScanResults getResults(uint32_t duration, bool is_continue = false);
+	NimBLEScanResults getResults() { return results; }
+	bool stop() {
+		if (!scanning) {
+			return true;
+		}
+		end(0);
+		return true;
+	}
+	bool isScanning() const { return scanning; }
+	void clearResults() { results.devices.clear(); }
+
+	// fake controls
+	void deliver(const NimBLEAdvertisedDevice& adv) {
+		if (!scanning || !callbacks) {
+			return;
+		}
+		callbacks->onDiscovered(&adv);
+		if (max_results > 0 && results.devices.size() < max_results) {
+			results.devices.push_back(&adv);
+		}
+		callbacks->onResult(&adv);
+	}
+	void end(int reason) {
+		scanning = false;
+		if (callbacks) {
+			callbacks->onScanEnd(results, reason);
+		}
+	}
+	uint16_t get_interval() const { return interval; }
+	uint16_t get_window() const { return window; }
+	bool is_active() const { return active; }
+	uint8_t get_max_results() const { return max_results; }
+	uint8_t get_duplicate_filter() const { return duplicate_filter; }
+	size_t get_start_count() const { return starts; }
+
+ private:
+	NimBLEScanCallbacks* callbacks = nullptr;
+	NimBLEScanResults results;
+	uint16_t interval = 100;
+	uint16_t window = 100;
+	bool active = false;
+	uint8_t max_results = 0xff;
+	uint8_t duplicate_filter = 1;
+	bool scanning = false;
+	size_t starts = 0;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+/**
+ * @brief Host stand-in of NimBLEUUID
+ * @details 16/32/128 bit UUIDs are kept in NimBLE byte order (least significant byte first).
+ */
+class NimBLEUUID {
+ public:
+	NimBLEUUID() = default;
+	NimBLEUUID(uint16_t uuid) : size(2) {
+		value[0] = uuid & 0xff;
+		value[1] = uuid >> 8;
+	}
+	NimBLEUUID(const uint8_t* data, size_t length) {
+		if (length != 2 && length != 4 && length != 16) {
+			return;
+		}
+		size = static_cast<uint8_t>(length);
+		std::memcpy(value, data, length);
+	}
+	NimBLEUUID(const char* str) : NimBLEUUID(std::string{str}) {}
+	NimBLEUUID(const std::string& str) {
+		std::string hex;
+		for (char c : str) {
+			if (c != '-') {
+				hex.push_back(c);
+			}
+		}
+		if (hex.length() != 4 && hex.length() != 8 && hex.length() != 32) {
+			return;
+		}
+		size = static_cast<uint8_t>(hex.length() / 2);
+		for (size_t i = 0; i < size; i++) {
+			unsigned int b;
+			if (std::sscanf(hex.c_str() + i * 2, "%2x", &b) != 1) {
+				size = 0;
+				return;
+			}
+			value[size - 1 - i] = static_cast<uint8_t>(b);
+		}
+	}
+	uint8_t bitSize() const { return size * 8; }
+	const uint8_t* getValue() const { return value; }
+	const NimBLEUUID& reverseByteOrder() {
+		std::reverse(value, value + size);
+		return *this;
+	}
+	std::string toString() const {
+		std::string str;
+		char buf[3];
+		for (size_t i = 0; i < size; i++) {
+			std::snprintf(buf, sizeof(buf), "%02x", value[size - 1 - i]);
+			str += buf;
+			if (size == 16 && (i == 3 || i == 5 || i == 7 || i == 9)) {
+				str += '-';
+			}
+		}
+		return str;
+	}
+	bool operator==(const NimBLEUUID& other) const { return size == other.size && std::memcmp(value, other.value, size) == 0; }
+	bool operator!=(const NimBLEUUID& other) const { return !(*this == other); }
+
+ private:
+	uint8_t value[16]{};
+	uint8_t size = 0;
+};
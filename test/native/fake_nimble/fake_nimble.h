@@ -0,0 +1,199 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include "NimBLEAddress.h"
+#include "NimBLEAdvertisedDevice.h"
+#include "NimBLEClient.h"
+#include "NimBLEUUID.h"
+
+/**
+ * Test controls of the host NimBLE stand-in.
+ *
+ * Everything that a real stack does on its host task (connect completion, notifications, peer disconnect) is queued
+ * as an event with a due time on a virtual clock and executed by run(), so tests are deterministic and never sleep.
+ */
+namespace fake_nimble {
+
+struct CharacteristicDef {
+	NimBLEUUID uuid;
+	uint16_t handle;
+};
+
+struct ServiceDef {
+	NimBLEUUID uuid;
+	std::vector<CharacteristicDef> characteristics;
+};
+
+class Peripheral {
+ public:
+	using write_handler_t = std::function<void(Peripheral& peripheral, const NimBLEUUID& uuid, const uint8_t* data, size_t size)>;
+	using event_handler_t = std::function<void(Peripheral& peripheral)>;
+
+	explicit Peripheral(const NimBLEAddress& address) : address(address) {}
+	Peripheral(const Peripheral&) = delete;
+	Peripheral& operator=(const Peripheral&) = delete;
+
+	const NimBLEAddress address;
+	std::vector<ServiceDef> services;
+	/** reason reported to the client on connect, 0 to accept */
+	int connect_error = 0;
+	/** largest ATT MTU accepted on exchange, 0 to reject the exchange */
+	uint16_t max_mtu = 23;
+	/** one-way latency of a link layer hop in microseconds */
+	uint32_t hop_latency_us = 0;
+	/**
+	 * Wait for the next connection event of the client's connection interval (max_interval) on each hop, and for
+	 * `latency` skipped events on hops to the peripheral. Off by default, hops then take hop_latency_us only.
+	 */
+	bool connection_events = false;
+	/**
+	 * Probability in 1/1000 that a link layer packet is lost. A lost packet is retransmitted on the next connection
+	 * event (after another hop_latency_us without connection_events), packets still arrive in order.
+	 */
+	uint16_t loss_per_mille = 0;
+	/** PHYs accepted by updatePhy() (BLE_GAP_LE_PHY_*_MASK) */
+	uint8_t supported_phys = BLE_GAP_LE_PHY_1M_MASK;
+	write_handler_t on_write{};
+	/** called when a CCCD write of the client arrives */
+	event_handler_t on_subscribe{};
+	/** called when the link to the client is closed by either side */
+	event_handler_t on_disconnect{};
+
+	size_t connects = 0;
+	size_t discoveries = 0;
+	size_t writes = 0;
+	size_t subscriptions = 0;
+	size_t retransmissions = 0;
+	NimBLEClient* client = nullptr;
+	/** due time of the last packet in each direction (0: to the client, 1: to the peripheral), keeps them in order */
+	uint64_t last_due_us[2] = {};
+
+	void add_service(const NimBLEUUID& uuid, std::vector<CharacteristicDef> characteristics) {
+		services.push_back({uuid, std::move(characteristics)});
+	}
+	bool notify(const NimBLEUUID& uuid, const uint8_t* data, size_t size);
+	void disconnect(int reason = BLE_ERR_REM_USER_CONN_TERM);
+};
+
+struct World {
+	struct Event {
+		uint64_t due_us;
+		uint64_t seq;
+		std::function<void()> fn;
+	};
+	uint64_t now_us = 0;
+	uint64_t seq = 0;
+	std::deque<Event> events;
+	std::map<std::string, std::unique_ptr<Peripheral>> peripherals;
+	std::vector<NimBLEAdvertisedDevice> air;
+	uint16_t next_conn_handle = 1;
+	/** state of random(), restarts on reset() */
+	uint32_t rng = 1;
+};
+
+inline World&
+world() {
+	static World instance;
+	return instance;
+}
+
+/** Current virtual time in microseconds */
+inline uint64_t
+now_us() {
+	return world().now_us;
+}
+
+/** Deterministic pseudo random number (xorshift32), see seed() */
+inline uint32_t
+random() {
+	auto& x = world().rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/** Restart random() from `value` (not 0) */
+inline void
+seed(uint32_t value) {
+	world().rng = value ? value : 1;
+}
+
+/** Queue an event to be executed by run() after `delay_us` of virtual time */
+inline void
+post(std::function<void()> fn, uint32_t delay_us = 0) {
+	auto& w = world();
+	World::Event ev{w.now_us + delay_us, w.seq++, std::move(fn)};
+	auto it = w.events.begin();
+	while (it != w.events.end() && (it->due_us < ev.due_us || (it->due_us == ev.due_us && it->seq < ev.seq))) {
+		++it;
+	}
+	w.events.insert(it, std::move(ev));
+}
+
+/**
+ * @brief Execute queued events in due order, advancing the virtual clock
+ * @param until_us Stop before events due after this time (virtual clock is advanced to it)
+ * @return number of executed events
+ */
+inline size_t
+run(uint64_t until_us = UINT64_MAX) {
+	auto& w = world();
+	size_t count = 0;
+	while (!w.events.empty() && w.events.front().due_us <= until_us) {
+		auto ev = std::move(w.events.front());
+		w.events.pop_front();
+		if (ev.due_us > w.now_us) {
+			w.now_us = ev.due_us;
+		}
+		ev.fn();
+		count++;
+	}
+	if (until_us != UINT64_MAX && w.now_us < until_us) {
+		w.now_us = until_us;
+	}
+	return count;
+}
+
+inline Peripheral&
+add_peripheral(const NimBLEAddress& address) {
+	auto& p = world().peripherals[address.toString()];
+	p = std::make_unique<Peripheral>(address);
+	return *p;
+}
+
+inline Peripheral*
+find_peripheral(const NimBLEAddress& address) {
+	auto& w = world();
+	auto it = w.peripherals.find(address.toString());
+	return it == w.peripherals.end() ? nullptr : it->second.get();
+}
+
+/** Register an advertisement replayed by NimBLEScan::getResults() */
+inline void
+add_advertisement(const NimBLEAdvertisedDevice& adv) {
+	world().air.push_back(adv);
+}
+
+/** Drop all peripherals, advertisements and pending events and rewind the virtual clock */
+inline void
+reset() {
+	auto& w = world();
+	for (auto& [addr, p] : w.peripherals) {
+		if (p->client) {
+			p->client->detach();
+		}
+	}
+	w.events.clear();
+	w.peripherals.clear();
+	w.air.clear();
+	w.now_us = 0;
+	w.seq = 0;
+	w.rng = 1;
+}
+
+}  // namespace fake_nimble
@@ -0,0 +1,236 @@
+#pragma once
+#include <Sesame.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "NimBLEAddress.h"
+#include "fake_nimble.h"
+
+namespace fake_nimble {
+
+using libsesame3bt::Sesame;
+
+/**
+ * @brief SesameClient stand-in for tests of the header-only schedulers
+ * @details Simulated device session: connection, authentication and history answers are delivered on the virtual
+ * clock. Like NimBLE, the controller accepts `gap_slots` pending connections (1 for NimBLE) and rejects further
+ * attempts (counted in `collisions`). Call reset_link() from setUp().
+ */
+class SimClient {
+ public:
+	enum class state_t { idle, connected, authenticating, active, connecting, connect_failed };
+	struct History {
+		Sesame::result_code_t result;
+		int32_t record_id;
+	};
+	struct Status {};
+	struct RegisteredDevice {};
+	class Listener {
+	 public:
+		virtual ~Listener() = default;
+		virtual void on_state(SimClient& /* client */, state_t /* state */) {}
+		virtual void on_status(SimClient& /* client */, Status /* status */) {}
+		virtual void on_history(SimClient& /* client */, const History& /* history */) {}
+		virtual void on_registered_devices(SimClient& /* client */, const std::vector<RegisteredDevice>& /* devices */) {}
+	};
+
+	static inline uint32_t connect_latency_us = 30'000;
+	static inline uint32_t auth_latency_us = 50'000;
+	/** pending connections accepted by the controller */
+	static inline size_t gap_slots = 1;
+	static inline size_t gap_busy = 0;
+	static inline size_t max_gap_busy = 0;
+	/** connect_async() while the controller had no free slot */
+	static inline size_t collisions = 0;
+	/** established connections */
+	static inline size_t live = 0;
+	static inline size_t max_live = 0;
+
+	static void reset_link() {
+		connect_latency_us = 30'000;
+		auth_latency_us = 50'000;
+		gap_slots = 1;
+		gap_busy = max_gap_busy = collisions = 0;
+		live = max_live = 0;
+	}
+
+	explicit SimClient(state_t initial = state_t::idle) : state(initial) {}
+	SimClient(const SimClient&) = delete;
+	SimClient& operator=(const SimClient&) = delete;
+
+	bool begin(const NimBLEAddress& address, Sesame::model_t model) {
+		this->address = address;
+		return model != Sesame::model_t::unknown;
+	}
+	bool set_keys(const char* /* pk */, const char* secret) { return secret && *secret; }
+	state_t get_state() const { return state; }
+	Listener* get_listener() const { return listener; }
+	void set_listener(Listener* listener) { this->listener = listener; }
+
+	bool connect_async() {
+		if (state != state_t::idle && state != state_t::connect_failed) {
+			return false;
+		}
+		if (gap_busy >= gap_slots) {
+			collisions++;
+			return false;
+		}
+		++session;
+		set_state(state_t::connecting);
+		start_connect();
+		return true;
+	}
+	bool start_authenticate() {
+		if (state != state_t::connected) {
+			return false;
+		}
+		set_state(state_t::authenticating);
+		auto s = session;
+		post(
+		    [this, s]() {
+			    if (s == session && respond) {
+				    set_state(state_t::active);
+			    }
+		    },
+		    auth_latency_us);
+		return true;
+	}
+	void disconnect() {
+		end_session();
+		disconnects++;
+	}
+	/** The device closes the session */
+	void peer_disconnect() { end_session(); }
+	/** Starts the connection retry like SesameClient::loop() */
+	void loop() {
+		loops++;
+		if (retry_pending && state == state_t::connecting && gap_busy < gap_slots) {
+			retry_pending = false;
+			start_connect();
+		}
+	}
+	bool unlock() {
+		if (state != state_t::active) {
+			return false;
+		}
+		unlocked++;
+		return true;
+	}
+	/** Answered with the front of `records`, `not_found` when empty */
+	bool request_history() {
+		if (state != state_t::active) {
+			return false;
+		}
+		auto n = requests++;
+		post(
+		    [this, n]() {
+			    History h{Sesame::result_code_t::not_found, 0};
+			    if (listed(busy, n)) {
+				    h = {Sesame::result_code_t::busy, 0};
+			    } else if (!records.empty()) {
+				    h = {Sesame::result_code_t::success, records.front()};
+				    records.pop_front();
+			    }
+			    if (listed(lost, n) || !listener) {
+				    return;
+			    }
+			    listener->on_history(*this, h);
+			    if (listed(doubled, n)) {
+				    listener->on_history(*this, h);
+			    }
+		    },
+		    history_latency_us);
+		return true;
+	}
+	void set_state(state_t state) {
+		this->state = state;
+		if (listener) {
+			listener->on_state(*this, state);
+		}
+	}
+
+	NimBLEAddress address;
+	/** false to fail connections */
+	bool reachable = true;
+	/** false to never finish authentication */
+	bool respond = true;
+	/** connection attempts failing before this one succeeds, retried from loop() */
+	int failed_attempts = 0;
+	int loops = 0;
+	int disconnects = 0;
+	int unlocked = 0;
+
+	/** history records returned oldest first, removed when answered */
+	std::deque<int32_t> records;
+	uint32_t history_latency_us = 20'000;
+	/** answers of these requests (0: first) are lost */
+	std::vector<size_t> lost;
+	/** answers of these requests are sent twice */
+	std::vector<size_t> doubled;
+	/** these requests are answered `busy` */
+	std::vector<size_t> busy;
+	size_t requests = 0;
+
+ private:
+	state_t state;
+	uint32_t session = 0;
+	bool retry_pending = false;
+	Listener* listener = nullptr;
+
+	static bool listed(const std::vector<size_t>& list, size_t n) { return std::find(list.begin(), list.end(), n) != list.end(); }
+
+	void start_connect() {
+		auto s = session;
+		gap_busy++;
+		max_gap_busy = std::max(max_gap_busy, gap_busy);
+		post(
+		    [this, s]() {
+			    if (s != session) {
+				    return;
+			    }
+			    gap_busy--;
+			    if (failed_attempts > 0) {
+				    failed_attempts--;
+				    retry_pending = true;
+				    return;
+			    }
+			    if (!reachable) {
+				    set_state(state_t::connect_failed);
+				    return;
+			    }
+			    live++;
+			    max_live = std::max(max_live, live);
+			    set_state(state_t::connected);
+		    },
+		    connect_latency_us);
+	}
+
+	void end_session() {
+		session++;
+		if (state == state_t::connecting && !retry_pending) {
+			gap_busy--;
+		} else if (state == state_t::connected || state == state_t::authenticating || state == state_t::active) {
+			live--;
+		}
+		retry_pending = false;
+		set_state(state_t::idle);
+	}
+};
+
+/**
+ * @brief Advance the virtual clock by `step_us` and call `loop` after each step, until `until_us` or `loop` returns false
+ */
+template <typename F>
+void
+drive(uint64_t until_us, F&& loop, uint32_t step_us = 10'000) {
+	while (now_us() < until_us) {
+		run(now_us() + step_us);
+		if (!loop()) {
+			break;
+		}
+	}
+}
+
+}  // namespace fake_nimble
@@ -0,0 +1,144 @@
+#pragma once
+#include <Sesame.h>
+#include <libsesame3bt/ServerCore.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "NimBLEDevice.h"
+
+namespace fake_nimble {
+
+/**
+ * @brief Loopback SESAME for host tests
+ * @details Registers a Peripheral with the SESAME service and answers the client with libsesame3bt-core's
+ * SesameServerCore, so the real protocol (initial token, authentication, encrypted commands and mecha status) runs
+ * over the fake GATT link on the virtual clock. Latency, connection events and loss are those of the Peripheral.
+ * Notifications of the server are re-fragmented to `fragment_size` bytes of payload to exercise reassembly.
+ * Destroy it after fake_nimble::reset() or when no event is pending.
+ */
+class VirtualSesame : private libsesame3bt::core::ServerBLEBackend {
+ public:
+	using Sesame = libsesame3bt::Sesame;
+
+	explicit VirtualSesame(const NimBLEAddress& address) : peripheral(add_peripheral(address)), core(*this, 1) {
+		peripheral.add_service(NimBLEUUID(Sesame::SESAME3_SRV_UUID),
+		                       {{NimBLEUUID(Sesame::TxUUID), 0x10}, {NimBLEUUID(Sesame::RxUUID), 0x12}});
+		peripheral.on_write = [this](Peripheral&, const NimBLEUUID& uuid, const uint8_t* data, size_t size) {
+			if (uuid == NimBLEUUID(Sesame::TxUUID) && session) {
+				core.on_received(session, reinterpret_cast<const std::byte*>(data), size);
+			}
+		};
+		peripheral.on_subscribe = [this](Peripheral& p) {
+			session = p.client->getConnHandle();
+			core.on_subscribed(session);
+		};
+		peripheral.on_disconnect = [this](Peripheral&) {
+			if (session) {
+				core.on_disconnected(session);
+				session = 0;
+			}
+		};
+	}
+	VirtualSesame(const VirtualSesame&) = delete;
+	VirtualSesame& operator=(const VirtualSesame&) = delete;
+	~VirtualSesame() {
+		peripheral.on_write = nullptr;
+		peripheral.on_subscribe = nullptr;
+		peripheral.on_disconnect = nullptr;
+	}
+
+	/**
+	 * @brief Start the server core with a registered secret
+	 * @param model model to emulate (SESAME 5 family)
+	 * @param secret 16 bytes secret in hex, as given to SesameClient::set_keys()
+	 */
+	bool begin(Sesame::model_t model, const char* secret) {
+		std::byte uuid[16]{};
+		for (size_t i = 0; i < sizeof(uuid); i++) {
+			uuid[i] = std::byte(peripheral.address.getVal()[i % 6] ^ i);
+		}
+		if (!core.begin(model, uuid) || !core.load_key(secret)) {
+			return false;
+		}
+		core.set_on_command_callback(
+		    [this](uint16_t, Sesame::item_code_t cmd, const std::string&, std::optional<libsesame3bt::trigger_type_t>) {
+			    commands++;
+			    if (cmd == Sesame::item_code_t::lock || cmd == Sesame::item_code_t::unlock) {
+				    locked = cmd == Sesame::item_code_t::lock;
+				    // the motor turns, then the new mecha status is published
+				    post([this]() { publish_status(); }, motor_us);
+			    }
+			    return Sesame::result_code_t::success;
+		    });
+		return true;
+	}
+
+	/** Publish the current mecha status to the connected client */
+	bool publish_status() {
+		if (!session) {
+			return false;
+		}
+		// mecha_status_5_t: battery (mV / 2), target, position, flags (bit 1: in lock, bit 2: in unlock)
+		int16_t position = locked ? lock_position : unlock_position;
+		uint16_t battery = 6'000 / 2;
+		auto lo = std::byte(position & 0xff);
+		auto hi = std::byte(position >> 8);
+		const std::byte status[] = {std::byte(battery & 0xff), std::byte(battery >> 8), lo, hi, lo, hi, std::byte(locked ? 0x02 : 0x04)};
+		return core.send_notify(session, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status, status, sizeof(status),
+		                        true);
+	}
+
+	Peripheral& peripheral;
+	/** payload bytes per notification fragment, 0 to send fragments as made by the server core */
+	size_t fragment_size = 0;
+	/** time from a lock / unlock command to the mecha status */
+	uint32_t motor_us = 0;
+	int16_t lock_position = 0;
+	int16_t unlock_position = 256;
+	bool locked = false;
+	size_t commands = 0;
+	/** notifications sent after re-fragmentation */
+	size_t notifications = 0;
+
+ private:
+	libsesame3bt::core::SesameServerCore core;
+	uint16_t session = 0;
+
+	bool send_notify(uint16_t session_id, const std::byte* data, size_t size) override {
+		if (session_id != session || size == 0) {
+			return false;
+		}
+		auto* bytes = reinterpret_cast<const uint8_t*>(data);
+		size_t payload = size - 1;
+		if (fragment_size == 0 || payload <= fragment_size) {
+			notifications++;
+			return peripheral.notify(NimBLEUUID(Sesame::RxUUID), bytes, size);
+		}
+		// header: bit 0 start of message, bits 1-2 end type (0: continued)
+		uint8_t start = bytes[0] & 1;
+		uint8_t end_type = bytes[0] & 0x06;
+		std::vector<uint8_t> frag;
+		for (size_t pos = 0; pos < payload; pos += fragment_size) {
+			size_t n = std::min(fragment_size, payload - pos);
+			frag.assign(1, static_cast<uint8_t>((pos == 0 ? start : 0) | (pos + n == payload ? end_type : 0)));
+			frag.insert(frag.end(), bytes + 1 + pos, bytes + 1 + pos + n);
+			notifications++;
+			if (!peripheral.notify(NimBLEUUID(Sesame::RxUUID), frag.data(), frag.size())) {
+				return false;
+			}
+		}
+		return true;
+	}
+	bool disconnect(uint16_t session_id) override {
+		if (session_id != session) {
+			return false;
+		}
+		peripheral.disconnect(BLE_ERR_REM_USER_CONN_TERM);
+		return true;
+	}
+};
+
+}  // namespace fake_nimble
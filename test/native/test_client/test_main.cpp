@@ -0,0 +1,789 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <virtual_sesame.h>
+#include "Executor.h"
+#include "SesameClient.h"
+#include "clock.h"
+
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameClient;
+using state_t = SesameClient::state_t;
+
+static const NimBLEAddress sesame_address{"01:23:45:67:89:ab", BLE_ADDR_RANDOM};
+static constexpr const char* SESAME_SECRET = "00112233445566778899aabbccddeeff";
+
+static fake_nimble::Peripheral&
+add_sesame() {
+	auto& p = fake_nimble::add_peripheral(sesame_address);
+	p.add_service(NimBLEUUID(Sesame::SESAME3_SRV_UUID), {{NimBLEUUID(Sesame::TxUUID), 0x10}, {NimBLEUUID(Sesame::RxUUID), 0x12}});
+	return p;
+}
+
+static void
+init_client(SesameClient& client, std::vector<state_t>& states) {
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", SESAME_SECRET));
+	client.set_state_callback([&states](auto&, auto state) { states.push_back(state); });
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	NimBLEDevice::init("");
+}
+
+void
+tearDown() {
+	NimBLEDevice::deinit(true);
+}
+
+void
+test_connect_without_keys() {
+	add_sesame();
+	SesameClient client{};
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_FALSE(client.connect());
+	TEST_ASSERT_FALSE(client.connect_async());
+}
+
+void
+test_connect_subscribes_rx() {
+	auto& p = add_sesame();
+	SesameClient client{};
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(1, p.connects);
+	TEST_ASSERT_EQUAL(1, p.discoveries);
+	TEST_ASSERT_EQUAL(1, p.subscriptions);
+	TEST_ASSERT_EQUAL(1, states.size());
+	TEST_ASSERT_TRUE(states[0] == state_t::connected);
+	client.disconnect();
+	TEST_ASSERT_FALSE(client.is_session_active());
+	TEST_ASSERT_NULL(p.client);
+}
+
+void
+test_connect_absent_device() {
+	SesameClient client{};
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_FALSE(client.connect(2));
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	TEST_ASSERT_TRUE(states.empty());
+}
+
+void
+test_connect_async() {
+	auto& p = add_sesame();
+	p.hop_latency_us = 3'000;
+	SesameClient client{};
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_TRUE(client.connect_async());
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connecting);
+	fake_nimble::run();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connected);
+	TEST_ASSERT_EQUAL(6'000, fake_nimble::now_us());
+	TEST_ASSERT_TRUE(client.start_authenticate());
+	TEST_ASSERT_EQUAL(1, p.subscriptions);
+	client.disconnect();
+}
+
+void
+test_connect_async_fail() {
+	auto& p = add_sesame();
+	p.connect_error = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT;
+	SesameClient client{};
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_TRUE(client.connect_async());
+	fake_nimble::run();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connect_failed);
+	client.disconnect();
+}
+
+void
+test_peer_disconnect() {
+	auto& p = add_sesame();
+	SesameClient client{};
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_TRUE(client.connect());
+	p.disconnect(BLE_ERR_CONN_SPVN_TMO);
+	fake_nimble::run();
+	TEST_ASSERT_FALSE(client.is_session_active());
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	TEST_ASSERT_NULL(p.client);
+	client.disconnect();
+}
+
+static void
+sleep_virtual(uint32_t ms) {
+	fake_nimble::run(fake_nimble::now_us() + ms * 1'000ULL);
+}
+
+void
+test_connect_retry() {
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	libsesame3bt::sysclock::set_sleeper(sleep_virtual);
+	auto& p = add_sesame();
+	p.hop_latency_us = 5'000;
+	p.connect_error = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT;
+	// the device comes into range after 300ms
+	fake_nimble::post([&p]() { p.connect_error = 0; }, 300'000);
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	client.set_retry_policy(libsesame3bt::RetryPolicy::standard());
+	TEST_ASSERT_TRUE(client.connect());
+	// attempts at 0ms, 160-210ms (backoff 200ms - 25%) and after another 300-400ms
+	auto& failures = client.get_connect_failures();
+	TEST_ASSERT_EQUAL(2, failures.total());
+	TEST_ASSERT_EQUAL(2, failures.retries());
+	TEST_ASSERT_EQUAL(2, failures.count(BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT));
+	TEST_ASSERT_GREATER_OR_EQUAL(470, fake_nimble::now_us() / 1'000);
+	TEST_ASSERT_EQUAL(1, p.connects);
+	client.disconnect();
+
+	// fatal reason is not retried
+	client.clear_connect_failures();
+	p.connect_error = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_LIMIT;
+	TEST_ASSERT_FALSE(client.connect(5));
+	TEST_ASSERT_EQUAL(1, failures.total());
+	TEST_ASSERT_EQUAL(1, failures.fatal());
+	TEST_ASSERT_EQUAL(0, failures.retries());
+	libsesame3bt::sysclock::set_sleeper(nullptr);
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+static void
+run_loop(SesameClient& client, uint64_t until_us) {
+	while (fake_nimble::now_us() < until_us) {
+		fake_nimble::run(fake_nimble::now_us() + 1'000);
+		client.loop();
+	}
+}
+
+void
+test_connect_async_retry() {
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	auto& p = add_sesame();
+	p.hop_latency_us = 5'000;
+	p.connect_error = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	client.set_retry_policy({3, 100, 1'000, 2, 0, 0});
+	auto& failures = client.get_connect_failures();
+
+	// stays connecting while retrying, then fails
+	TEST_ASSERT_TRUE(client.connect_async());
+	run_loop(client, 1'000'000);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connect_failed);
+	TEST_ASSERT_EQUAL(2, states.size());
+	TEST_ASSERT_EQUAL(3, failures.total());
+	TEST_ASSERT_EQUAL(2, failures.retries());
+
+	// succeeds on a retry
+	fake_nimble::post([&p]() { p.connect_error = 0; }, 50'000);
+	TEST_ASSERT_TRUE(client.connect_async());
+	run_loop(client, 1'500'000);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connected);
+	TEST_ASSERT_EQUAL(4, failures.total());
+	TEST_ASSERT_EQUAL(1, p.connects);
+	client.disconnect();
+
+	// disconnect() cancels a pending retry
+	p.connect_error = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT;
+	TEST_ASSERT_TRUE(client.connect_async());
+	run_loop(client, 1'520'000);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connecting);
+	client.disconnect();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	run_loop(client, 3'000'000);
+	TEST_ASSERT_EQUAL(5, failures.total());
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+
+	// rejected at once while another client is connecting: retried by loop() like a failed attempt
+	p.connect_error = 0;
+	auto* other = NimBLEDevice::createClient();
+	TEST_ASSERT_TRUE(other->connect(sesame_address, true, true));
+	TEST_ASSERT_TRUE(client.connect_async());
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connecting);
+	TEST_ASSERT_EQUAL(1, failures.count(BLE_HS_EALREADY));
+	run_loop(client, 3'500'000);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connected);
+	client.disconnect();
+	NimBLEDevice::deleteClient(other);
+
+	// the policy gives up: rejected at once
+	client.set_retry_policy(libsesame3bt::RetryPolicy::none());
+	other = NimBLEDevice::createClient();
+	TEST_ASSERT_TRUE(other->connect(sesame_address, true, true));
+	TEST_ASSERT_FALSE(client.connect_async());
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	fake_nimble::run();
+	NimBLEDevice::deleteClient(other);
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_uuid_to_ble_address() {
+	TEST_ASSERT_TRUE(SesameClient::uuid_to_ble_address(NimBLEUUID(Sesame::SESAME3_SRV_UUID)).isNull());
+	auto addr = SesameClient::uuid_to_ble_address(NimBLEUUID("f0e1d2c3-b4a5-9687-7869-5a4b3c2d1e0f"));
+	TEST_ASSERT_FALSE(addr.isNull());
+	TEST_ASSERT_EQUAL(BLE_ADDR_RANDOM, addr.getType());
+}
+
+static uint64_t fake_time_us;
+
+void
+test_command_queue_before_session() {
+	using Command = SesameClient::Command;
+	using result_t = SesameClient::command_result_t;
+	add_sesame();
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	std::vector<result_t> results;
+	auto record = [&results](auto&, result_t result) { results.push_back(result); };
+
+	// commands are accepted without session
+	TEST_ASSERT_TRUE(client.enqueue(Command::unlock("tag"), record));
+	TEST_ASSERT_TRUE(client.enqueue(Command::click(uint8_t{3}), record));
+	TEST_ASSERT_TRUE(client.enqueue(Command::request_status()));
+	TEST_ASSERT_TRUE(client.enqueue(Command::lock(libsesame3bt::history_tag_type_t::remote,
+	                                              NimBLEUUID("0f1e2d3c-4b5a-6978-8796-a5b4c3d2e1f0")),
+	                                record));
+	TEST_ASSERT_EQUAL(SesameClient::CMD_QUEUE_SIZE, client.get_queued_count());
+	TEST_ASSERT_FALSE(client.enqueue(Command::lock("full"), record));
+	TEST_ASSERT_FALSE(client.enqueue(Command::lock(libsesame3bt::history_tag_type_t::remote, NimBLEUUID(uint16_t{0x1234}))));
+	TEST_ASSERT_TRUE(results.empty());
+
+	// connection without authentication does not send
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(SesameClient::CMD_QUEUE_SIZE, client.get_queued_count());
+	client.disconnect();
+	TEST_ASSERT_EQUAL(SesameClient::CMD_QUEUE_SIZE, client.get_queued_count());
+
+	client.clear_queue();
+	TEST_ASSERT_EQUAL(0, client.get_queued_count());
+	TEST_ASSERT_EQUAL(3, results.size());
+	for (auto r : results) {
+		TEST_ASSERT_EQUAL(result_t::cancelled, r);
+	}
+}
+
+void
+test_command_queue_expiry() {
+	using Command = SesameClient::Command;
+	using result_t = SesameClient::command_result_t;
+	libsesame3bt::sysclock::set_source([]() { return fake_time_us; });
+	fake_time_us = 0;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	client.set_command_timeout(1'000);
+	std::vector<result_t> results;
+	auto record = [&results](auto&, result_t result) { results.push_back(result); };
+	for (size_t i = 0; i < SesameClient::CMD_QUEUE_SIZE; i++) {
+		TEST_ASSERT_TRUE(client.enqueue(Command::unlock("old"), record));
+	}
+	fake_time_us = 500'000;
+	TEST_ASSERT_FALSE(client.enqueue(Command::lock("new"), record));
+	// old commands are dropped to make room
+	fake_time_us = 1'100'000;
+	TEST_ASSERT_TRUE(client.enqueue(Command::lock("new"), record));
+	TEST_ASSERT_EQUAL(1, client.get_queued_count());
+	TEST_ASSERT_EQUAL(SesameClient::CMD_QUEUE_SIZE, results.size());
+	TEST_ASSERT_EQUAL(result_t::expired, results.back());
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+// run client loop every 10ms (virtual) until `until_us`
+static void
+drive(SesameClient& client, uint64_t until_us) {
+	while (fake_nimble::now_us() < until_us) {
+		fake_nimble::run(fake_nimble::now_us() + 10'000);
+		client.loop();
+	}
+}
+
+void
+test_operate_async_connect_failed() {
+	using result_t = SesameClient::operation_result_t;
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	auto& p = add_sesame();
+	p.connect_error = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT;
+	p.hop_latency_us = 5'000;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	std::vector<SesameClient::OperationReport> reports;
+	TEST_ASSERT_TRUE(client.operate_async(SesameClient::Command::unlock("op"), [&reports](auto&, const auto& r) { reports.push_back(r); }));
+	TEST_ASSERT_TRUE(client.is_operating());
+	TEST_ASSERT_FALSE(client.operate_async(SesameClient::Command::lock("op"), nullptr));
+	drive(client, 1'000'000);
+	TEST_ASSERT_FALSE(client.is_operating());
+	TEST_ASSERT_EQUAL(1, reports.size());
+	TEST_ASSERT_EQUAL(result_t::connect_failed, reports[0].result);
+	TEST_ASSERT_EQUAL(0, reports[0].connect_ms);
+	TEST_ASSERT_EQUAL(10, reports[0].total_ms);
+	TEST_ASSERT_NULL(client.get_ble_client());
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_operate_async_deadline() {
+	using result_t = SesameClient::operation_result_t;
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	auto& p = add_sesame();
+	p.hop_latency_us = 5'000;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	std::vector<SesameClient::OperationReport> reports;
+	auto record = [&reports](auto&, const auto& r) { reports.push_back(r); };
+	// device never answers authentication
+	TEST_ASSERT_TRUE(client.operate_async(SesameClient::Command::unlock("op"), record, 500));
+	drive(client, 1'000'000);
+	TEST_ASSERT_EQUAL(1, reports.size());
+	TEST_ASSERT_EQUAL(result_t::timeout, reports[0].result);
+	TEST_ASSERT_EQUAL(10, reports[0].connect_ms);
+	TEST_ASSERT_EQUAL(0, reports[0].authenticate_ms);
+	TEST_ASSERT_EQUAL(510, reports[0].total_ms);
+	TEST_ASSERT_EQUAL(1, p.subscriptions);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	TEST_ASSERT_NULL(p.client);
+
+	// peer disconnects during authentication
+	TEST_ASSERT_TRUE(client.operate_async(SesameClient::Command::unlock("op"), record, 5'000));
+	drive(client, 1'100'000);
+	p.disconnect(BLE_ERR_REM_USER_CONN_TERM);
+	drive(client, 1'200'000);
+	TEST_ASSERT_EQUAL(2, reports.size());
+	TEST_ASSERT_EQUAL(result_t::auth_failed, reports[1].result);
+	TEST_ASSERT_FALSE(client.is_operating());
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_session_timing() {
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	auto& p = add_sesame();
+	p.hop_latency_us = 3'000;
+	libsesame3bt::SessionStats stats;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	client.set_session_stats(&stats);
+	TEST_ASSERT_TRUE(client.connect());
+	fake_nimble::run(fake_nimble::now_us() + 10'000);
+	client.disconnect();
+	const auto& t = client.get_session_timing();
+	TEST_ASSERT_EQUAL(0, t.started_at);
+	TEST_ASSERT_EQUAL(6'000, t.connected_us);
+	// discovery: 4 hops, CCCD write: 2 hops
+	TEST_ASSERT_EQUAL(18'000, t.discovered_us);
+	TEST_ASSERT_EQUAL(24'000, t.subscribed_us);
+	TEST_ASSERT_EQUAL(0, t.active_us);
+	TEST_ASSERT_EQUAL(34'000, t.disconnected_us);
+	TEST_ASSERT_EQUAL(1, stats.get_session_count());
+	TEST_ASSERT_EQUAL(1, stats.connect.count());
+	TEST_ASSERT_UINT32_WITHIN(6'000 / 8, 6'000, stats.connect.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(12'000 / 8, 12'000, stats.discovery.percentile(50));
+	TEST_ASSERT_EQUAL(1, stats.subscribe.count());
+	TEST_ASSERT_EQUAL(0, stats.authenticate.count());
+	TEST_ASSERT_EQUAL(0, stats.setup.count());
+
+	// next session starts a new timing
+	TEST_ASSERT_TRUE(client.connect_async());
+	TEST_ASSERT_EQUAL(0, client.get_session_timing().connected_us);
+	fake_nimble::run();
+	TEST_ASSERT_EQUAL(6'000, client.get_session_timing().connected_us);
+	p.disconnect();
+	fake_nimble::run();
+	TEST_ASSERT_EQUAL(2, stats.get_session_count());
+	TEST_ASSERT_EQUAL(9'000, client.get_session_timing().disconnected_us);
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_session_timing_full() {
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	fake_nimble::VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 3'000;
+	libsesame3bt::SessionStats stats;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	client.set_session_stats(&stats);
+	size_t statuses = 0;
+	client.set_status_callback([&statuses](auto&, auto) { statuses++; });
+
+	// connect -> active -> status -> disconnect
+	TEST_ASSERT_TRUE(client.connect());
+	fake_nimble::run(fake_nimble::now_us() + 100'000);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::active);
+	TEST_ASSERT_TRUE(sesame.publish_status());
+	fake_nimble::run(fake_nimble::now_us() + 10'000);
+	TEST_ASSERT_EQUAL(1, statuses);
+	client.disconnect();
+	fake_nimble::run();
+	const auto& t = client.get_session_timing();
+	TEST_ASSERT_NOT_EQUAL(0, t.active_us);
+	TEST_ASSERT_GREATER_THAN(t.active_us, t.first_status_us);
+	TEST_ASSERT_NOT_EQUAL(0, t.disconnected_us);
+	TEST_ASSERT_GREATER_THAN(t.first_status_us, t.disconnected_us);
+	// recorded once, at the first status
+	TEST_ASSERT_EQUAL(1, stats.get_session_count());
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_attribute_cache() {
+	auto& p = add_sesame();
+	p.hop_latency_us = 3'000;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	client.set_attribute_cache(true);
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(1, p.discoveries);
+	client.disconnect();
+	TEST_ASSERT_NULL(p.client);
+	fake_nimble::run();
+
+	// reconnect skips discovery
+	auto started = fake_nimble::now_us();
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(1, p.discoveries);
+	TEST_ASSERT_EQUAL(2, p.subscriptions);
+	TEST_ASSERT_EQUAL(12'000, fake_nimble::now_us() - started);
+	client.disconnect();
+	fake_nimble::run();
+
+	// firmware update changed the attribute table: discovered again
+	p.services.clear();
+	p.add_service(NimBLEUUID(Sesame::SESAME3_SRV_UUID), {{NimBLEUUID(Sesame::TxUUID), 0x20}, {NimBLEUUID(Sesame::RxUUID), 0x22}});
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(2, p.discoveries);
+	TEST_ASSERT_EQUAL(3, p.subscriptions);
+	TEST_ASSERT_EQUAL(0x22, client.get_ble_client()->find_characteristic(NimBLEUUID(Sesame::RxUUID))->getHandle());
+
+	// peer disconnection keeps the cache
+	p.disconnect();
+	fake_nimble::run();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(2, p.discoveries);
+	client.disconnect();
+	// the kept client holds a NimBLE client slot until the cache is disabled
+	TEST_ASSERT_EQUAL(1, NimBLEDevice::getCreatedClientCount());
+
+	// without cache, attributes are discovered on every connection
+	client.set_attribute_cache(false);
+	TEST_ASSERT_EQUAL(0, NimBLEDevice::getCreatedClientCount());
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(3, p.discoveries);
+	client.disconnect();
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(4, p.discoveries);
+	client.disconnect();
+}
+
+void
+test_connection_params() {
+	using Params = SesameClient::ConnectionParams;
+	auto& p = add_sesame();
+	p.connection_events = true;
+	p.supported_phys = BLE_GAP_LE_PHY_1M_MASK | BLE_GAP_LE_PHY_2M_MASK;
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_FALSE(client.set_connection_params({6, 12, 0, 5}));        // timeout shorter than two intervals
+	TEST_ASSERT_FALSE(client.set_connection_params({40, 24, 0, 400}));     // min > max
+	TEST_ASSERT_FALSE(client.set_connection_params({80, 160, 500, 3200}));  // latency too large
+	TEST_ASSERT_FALSE(client.get_connection_params().has_value());
+
+	auto fast = Params::fast();
+	fast.phy_mask = BLE_GAP_LE_PHY_2M_MASK;
+	TEST_ASSERT_TRUE(client.set_connection_params(fast));
+	auto started = fake_nimble::now_us();
+	TEST_ASSERT_TRUE(client.connect());
+	// service discovery (4 hops) and subscription (2 hops) on consecutive 15ms connection events
+	TEST_ASSERT_EQUAL(6 * 15'000, fake_nimble::now_us() - started);
+	auto* blec = client.get_ble_client();
+	TEST_ASSERT_EQUAL(6, blec->get_min_interval());
+	TEST_ASSERT_EQUAL(12, blec->get_max_interval());
+	TEST_ASSERT_EQUAL(200, blec->get_supervision_timeout());
+	uint8_t tx_phy, rx_phy;
+	TEST_ASSERT_TRUE(blec->getPhy(&tx_phy, &rx_phy));
+	TEST_ASSERT_EQUAL(BLE_GAP_LE_PHY_2M, tx_phy);
+
+	// mid-session update
+	TEST_ASSERT_TRUE(client.set_connection_params(Params::relaxed()));
+	TEST_ASSERT_EQUAL(80, blec->get_min_interval());
+	TEST_ASSERT_EQUAL(160, blec->get_max_interval());
+	TEST_ASSERT_EQUAL(4, blec->get_latency());
+	TEST_ASSERT_EQUAL(600, blec->get_supervision_timeout());
+	client.disconnect();
+	fake_nimble::run();
+
+	// kept for the next connection
+	started = fake_nimble::now_us();
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_EQUAL(160, client.get_ble_client()->get_max_interval());
+	TEST_ASSERT_TRUE(fake_nimble::now_us() - started >= 6 * 200'000);
+	client.disconnect();
+}
+
+void
+test_events_through_executor() {
+	add_sesame();
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	libsesame3bt::QueueExecutor exec;
+	client.set_executor(&exec);
+	// disconnect from the state callback is allowed on the executor
+	client.set_state_callback([&states](SesameClient& c, state_t state) {
+		states.push_back(state);
+		if (state == state_t::connected) {
+			c.disconnect();
+		}
+	});
+	TEST_ASSERT_TRUE(client.connect_async());
+	fake_nimble::run();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connected);
+	TEST_ASSERT_TRUE(states.empty());
+	TEST_ASSERT_EQUAL(2, exec.get_depth());  // connecting, connected
+	TEST_ASSERT_EQUAL(3, exec.run_pending());
+	TEST_ASSERT_EQUAL(3, states.size());
+	TEST_ASSERT_TRUE(states[0] == state_t::connecting);
+	TEST_ASSERT_TRUE(states[1] == state_t::connected);
+	TEST_ASSERT_TRUE(states[2] == state_t::idle);
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	TEST_ASSERT_EQUAL(3, exec.get_stats().executed);
+}
+
+void
+test_history_tag() {
+	using Command = SesameClient::Command;
+	using Tag = SesameClient::Tag;
+	// 10 x 3 bytes characters, truncated on character boundary
+	auto text = Tag::text(u8"あいうえおかきくけこ");
+	TEST_ASSERT_TRUE(text.is_valid());
+	TEST_ASSERT_FALSE(text.is_uuid());
+	TEST_ASSERT_EQUAL(SesameClient::MAX_CMD_TAG_SIZE / 3 * 3, text.get_text_size());
+	TEST_ASSERT_EQUAL(text.get_text_size(), std::strlen(text.get_text()));
+	auto cmd = Command::unlock(text);
+	TEST_ASSERT_TRUE(cmd.valid);
+	TEST_ASSERT_EQUAL_STRING(text.get_text(), cmd.tag);
+
+	auto uuid = Tag::uuid(libsesame3bt::history_tag_type_t::remote, NimBLEUUID("00112233-4455-6677-8899-aabbccddeeff"));
+	TEST_ASSERT_TRUE(uuid.is_valid());
+	TEST_ASSERT_TRUE(uuid.is_uuid());
+	TEST_ASSERT_EQUAL(0x00, static_cast<uint8_t>(uuid.get_uuid()[0]));
+	TEST_ASSERT_EQUAL(0xff, static_cast<uint8_t>(uuid.get_uuid()[15]));
+	cmd = Command::lock(uuid);
+	TEST_ASSERT_TRUE(cmd.valid);
+	TEST_ASSERT_TRUE(cmd.tag_uuid == uuid.get_uuid());
+	TEST_ASSERT_FALSE(Command::click(uuid).valid);
+
+	TEST_ASSERT_FALSE(Tag::uuid(libsesame3bt::history_tag_type_t::remote, NimBLEUUID("1234")).is_valid());
+	TEST_ASSERT_FALSE(Tag::uuid(libsesame3bt::history_tag_type_t::none, NimBLEUUID("00112233-4455-6677-8899-aabbccddeeff")).is_valid());
+	SesameClient client;
+	TEST_ASSERT_FALSE(client.lock(Tag::uuid(libsesame3bt::history_tag_type_t::remote, NimBLEUUID("1234"))));
+}
+
+// device side of LoopbackTransport: sends the initial token when the channel is opened
+class LoopbackSesame : public libsesame3bt::LoopbackTransport::Peer {
+ public:
+	std::vector<std::vector<uint8_t>> written;
+	size_t opened = 0;
+	size_t closed = 0;
+
+	void on_open(libsesame3bt::LoopbackTransport& link) override {
+		opened++;
+		const uint8_t initial[] = {0x03, 0x08, 0x0e, 0x01, 0x02, 0x03, 0x04};
+		link.notify(initial, sizeof(initial));
+	}
+	void on_write(libsesame3bt::LoopbackTransport&, const uint8_t* data, size_t size) override {
+		written.emplace_back(data, data + size);
+	}
+	void on_close(libsesame3bt::LoopbackTransport&) override { closed++; }
+};
+
+void
+test_loopback_transport() {
+	LoopbackSesame peer;
+	libsesame3bt::LoopbackTransport link{peer};
+	SesameClient client;
+	std::vector<state_t> states;
+	init_client(client, states);
+	TEST_ASSERT_TRUE(client.set_transport(&link));
+	TEST_ASSERT_TRUE(&client.get_transport() == &link);
+
+	// no NimBLE peripheral is registered, the session runs in memory
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_NULL(client.get_ble_client());
+	TEST_ASSERT_EQUAL(1, peer.opened);
+	TEST_ASSERT_FALSE(client.set_transport(nullptr));
+	client.loop();
+	TEST_ASSERT_EQUAL(1, client.get_rx_fragments().messages());
+	// the initial token starts authentication
+	TEST_ASSERT_TRUE(client.get_state() == state_t::authenticating);
+	TEST_ASSERT_FALSE(peer.written.empty());
+	TEST_ASSERT_EQUAL(peer.written.size(), client.get_tx_fragments().fragments());
+	TEST_ASSERT_EQUAL(23, client.get_mtu());
+
+	// closed by the device
+	link.close();
+	client.loop();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::idle);
+	TEST_ASSERT_EQUAL(0, client.get_mtu());
+	TEST_ASSERT_EQUAL(0, peer.closed);
+
+	// asynchronous connect completes in loop()
+	TEST_ASSERT_TRUE(client.connect_async());
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connecting);
+	client.loop();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connected);
+	client.disconnect();
+	TEST_ASSERT_EQUAL(1, peer.closed);
+	link.set_connect_error(BLE_ERR_CONN_ESTABLISHMENT);
+	TEST_ASSERT_TRUE(client.connect_async());
+	client.loop();
+	TEST_ASSERT_TRUE(client.get_state() == state_t::connect_failed);
+	TEST_ASSERT_TRUE(client.set_transport(nullptr));
+	TEST_ASSERT_TRUE(&client.get_transport() != &link);
+}
+
+/** Status stand-in for StatusFilter::is_changed() */
+struct FakeStatus {
+	bool lock = false, unlock = false, critical = false, clutch_failed = false, battery = false, stop = false;
+	uint8_t motor = 0;
+	int16_t tgt = 0, pos = 0;
+	float volt = 6.0f;
+	bool in_lock() const { return lock; }
+	bool in_unlock() const { return unlock; }
+	bool is_critical() const { return critical; }
+	bool is_clutch_failed() const { return clutch_failed; }
+	bool battery_critical() const { return battery; }
+	bool stopped() const { return stop; }
+	uint8_t motor_status() const { return motor; }
+	int16_t target() const { return tgt; }
+	int16_t position() const { return pos; }
+	float voltage() const { return volt; }
+};
+
+void
+test_status_filter_fields() {
+	using filter_t = SesameClient::StatusFilter;
+	const FakeStatus last;
+	const std::pair<filter_t::field_t, void (*)(FakeStatus&)> changes[] = {
+	    {filter_t::IN_LOCK, [](FakeStatus& s) { s.lock = true; }},
+	    {filter_t::IN_UNLOCK, [](FakeStatus& s) { s.unlock = true; }},
+	    {filter_t::CRITICAL, [](FakeStatus& s) { s.critical = true; }},
+	    {filter_t::CLUTCH_FAILED, [](FakeStatus& s) { s.clutch_failed = true; }},
+	    {filter_t::BATTERY_CRITICAL, [](FakeStatus& s) { s.battery = true; }},
+	    {filter_t::STOPPED, [](FakeStatus& s) { s.stop = true; }},
+	    {filter_t::MOTOR_STATUS, [](FakeStatus& s) { s.motor = 2; }},
+	    {filter_t::TARGET, [](FakeStatus& s) { s.tgt = 10; }},
+	    {filter_t::POSITION, [](FakeStatus& s) { s.pos = 10; }},
+	    {filter_t::VOLTAGE, [](FakeStatus& s) { s.volt = 5.0f; }},
+	};
+	filter_t filter;
+	TEST_ASSERT_FALSE(filter.is_changed(last, last, 0));
+	for (const auto& [field, change] : changes) {
+		FakeStatus status;
+		change(status);
+		// each change is seen through its own bit only
+		filter.fields = field;
+		TEST_ASSERT_TRUE(filter.is_changed(last, status, 0));
+		filter.fields = filter_t::ALL & ~field;
+		TEST_ASSERT_FALSE(filter.is_changed(last, status, 0));
+	}
+}
+
+void
+test_status_filter_hysteresis() {
+	SesameClient::StatusFilter filter;
+	filter.position_hysteresis = 8;
+	filter.voltage_hysteresis = 0.25f;
+	FakeStatus last;
+	last.pos = 100;
+	last.volt = 5.5f;
+	FakeStatus status = last;
+	// a change equal to the hysteresis is ignored, one step more is delivered
+	status.pos = 108;
+	TEST_ASSERT_FALSE(filter.is_changed(last, status, 0));
+	status.pos = 92;
+	TEST_ASSERT_FALSE(filter.is_changed(last, status, 0));
+	status.pos = 109;
+	TEST_ASSERT_TRUE(filter.is_changed(last, status, 0));
+	status.pos = 91;
+	TEST_ASSERT_TRUE(filter.is_changed(last, status, 0));
+	status = last;
+	status.volt = 5.75f;
+	TEST_ASSERT_FALSE(filter.is_changed(last, status, 0));
+	status.volt = 5.25f;
+	TEST_ASSERT_FALSE(filter.is_changed(last, status, 0));
+	status.volt = 5.8125f;
+	TEST_ASSERT_TRUE(filter.is_changed(last, status, 0));
+	status.volt = 5.1875f;
+	TEST_ASSERT_TRUE(filter.is_changed(last, status, 0));
+}
+
+void
+test_status_filter_interval() {
+	SesameClient::StatusFilter filter;
+	filter.min_interval_ms = 1'000;
+	FakeStatus last;
+	FakeStatus moved = last;
+	moved.pos = 100;
+	moved.volt = 5.0f;
+	// position and voltage wait for the interval
+	TEST_ASSERT_FALSE(filter.is_changed(last, moved, 0));
+	TEST_ASSERT_FALSE(filter.is_changed(last, moved, 999));
+	TEST_ASSERT_TRUE(filter.is_changed(last, moved, 1'000));
+	// flags do not
+	FakeStatus locked = last;
+	locked.lock = true;
+	TEST_ASSERT_TRUE(filter.is_changed(last, locked, 0));
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_connect_without_keys);
+	RUN_TEST(test_connect_subscribes_rx);
+	RUN_TEST(test_connect_absent_device);
+	RUN_TEST(test_connect_async);
+	RUN_TEST(test_connect_async_fail);
+	RUN_TEST(test_peer_disconnect);
+	RUN_TEST(test_connect_retry);
+	RUN_TEST(test_connect_async_retry);
+	RUN_TEST(test_uuid_to_ble_address);
+	RUN_TEST(test_command_queue_before_session);
+	RUN_TEST(test_command_queue_expiry);
+	RUN_TEST(test_operate_async_connect_failed);
+	RUN_TEST(test_operate_async_deadline);
+	RUN_TEST(test_session_timing);
+	RUN_TEST(test_session_timing_full);
+	RUN_TEST(test_attribute_cache);
+	RUN_TEST(test_connection_params);
+	RUN_TEST(test_events_through_executor);
+	RUN_TEST(test_history_tag);
+	RUN_TEST(test_loopback_transport);
+	RUN_TEST(test_status_filter_fields);
+	RUN_TEST(test_status_filter_hysteresis);
+	RUN_TEST(test_status_filter_interval);
+	return UNITY_END();
+}
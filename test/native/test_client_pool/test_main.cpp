@@ -0,0 +1,191 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <sim_client.h>
+#include <algorithm>
+#include <vector>
+#include "SesameClientPool.h"
+#include "clock.h"
+
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameClientPool;
+
+using fake_nimble::SimClient;
+
+using Pool = SesameClientPool<SimClient>;
+
+static NimBLEAddress
+device_address(int i) {
+	const uint8_t raw[6] = {static_cast<uint8_t>(i), 0x00, 0x00, 0x00, 0x00, 0xc0};
+	return NimBLEAddress{raw, BLE_ADDR_RANDOM};
+}
+
+static void
+add_devices(Pool& pool, int count) {
+	for (int i = 0; i < count; i++) {
+		TEST_ASSERT_EQUAL(i, pool.add(device_address(i), Sesame::model_t::sesame_5, "", "00112233445566778899aabbccddeeff"));
+	}
+}
+
+static void
+run_pool(Pool& pool, uint64_t until_us) {
+	fake_nimble::drive(until_us, [&pool]() {
+		pool.loop();
+		return true;
+	});
+}
+
+static bool
+unlock_op(SimClient& client) {
+	return client.unlock();
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	SimClient::reset_link();
+}
+
+void
+tearDown() {
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_pool_serves_more_devices_than_slots() {
+	Pool pool{3};
+	add_devices(pool, 12);
+	TEST_ASSERT_EQUAL(-1, pool.add(device_address(99), Sesame::model_t::unknown, "", "00"));
+	std::vector<int> done;
+	for (int i = 0; i < 12; i++) {
+		TEST_ASSERT_TRUE(pool.submit(i, unlock_op, [&done](int device, bool ok) {
+			TEST_ASSERT_TRUE(ok);
+			done.push_back(device);
+		}));
+	}
+	TEST_ASSERT_FALSE(pool.submit(12, unlock_op));
+	run_pool(pool, 2'000'000);
+	TEST_ASSERT_EQUAL(12, done.size());
+	TEST_ASSERT_EQUAL(3, SimClient::max_live);
+	// connections are started one at a time
+	TEST_ASSERT_EQUAL(0, SimClient::collisions);
+	TEST_ASSERT_LESS_OR_EQUAL(3, pool.get_connection_count());
+	for (int i = 0; i < 12; i++) {
+		TEST_ASSERT_EQUAL(1, pool.get_client(i)->unlocked);
+	}
+	// first come, first served
+	TEST_ASSERT_TRUE(std::is_sorted(done.begin(), done.end()));
+	const auto& m = pool.get_metrics();
+	TEST_ASSERT_EQUAL(12, m.submitted);
+	TEST_ASSERT_EQUAL(12, m.completed);
+	TEST_ASSERT_EQUAL(0, m.failed);
+	TEST_ASSERT_EQUAL(12, m.connects);
+	TEST_ASSERT_EQUAL(9, m.evictions);
+	// connect + authenticate take 80ms; connections are serialized, one is started per ~40ms (30ms + loop period)
+	TEST_ASSERT_GREATER_OR_EQUAL(80, m.mean_wait_ms());
+	TEST_ASSERT_LESS_OR_EQUAL(12 * 40 + 50, m.max_wait_ms);
+	TEST_ASSERT_GREATER_THAN(0.0f, m.throughput(libsesame3bt::sysclock::now_ms()));
+}
+
+void
+test_pool_reuses_session_and_evicts_lru() {
+	Pool pool{2};
+	add_devices(pool, 3);
+	pool.submit(0, unlock_op);
+	pool.submit(1, unlock_op);
+	run_pool(pool, 500'000);
+	TEST_ASSERT_EQUAL(2, pool.get_metrics().connects);
+	// active session is used without reconnecting
+	run_pool(pool, 600'000);
+	pool.submit(0, unlock_op);
+	run_pool(pool, 700'000);
+	TEST_ASSERT_EQUAL(2, pool.get_metrics().connects);
+	TEST_ASSERT_EQUAL(2, pool.get_client(0)->unlocked);
+	// device 1 is least recently used
+	pool.submit(2, unlock_op);
+	run_pool(pool, 1'000'000);
+	TEST_ASSERT_EQUAL(1, pool.get_metrics().evictions);
+	TEST_ASSERT_EQUAL(SimClient::state_t::active, pool.get_client(0)->get_state());
+	TEST_ASSERT_EQUAL(SimClient::state_t::idle, pool.get_client(1)->get_state());
+	TEST_ASSERT_EQUAL(SimClient::state_t::active, pool.get_client(2)->get_state());
+
+	// session lost by peer is reopened on demand
+	pool.get_client(2)->peer_disconnect();
+	run_pool(pool, 1'100'000);
+	TEST_ASSERT_EQUAL(1, pool.get_connection_count());
+	pool.submit(2, unlock_op);
+	run_pool(pool, 1'500'000);
+	TEST_ASSERT_EQUAL(2, pool.get_client(2)->unlocked);
+	// connection retries of the client are started by its loop(), run by the pool
+	pool.get_client(1)->failed_attempts = 1;
+	pool.submit(1, unlock_op);
+	run_pool(pool, 2'000'000);
+	TEST_ASSERT_EQUAL(2, pool.get_client(1)->unlocked);
+	TEST_ASSERT_EQUAL(0, pool.get_metrics().connect_failures);
+
+	// idle sessions are closed
+	pool.set_idle_timeout(1'000);
+	run_pool(pool, 4'000'000);
+	TEST_ASSERT_EQUAL(0, pool.get_connection_count());
+	TEST_ASSERT_EQUAL(0, SimClient::live);
+}
+
+void
+test_pool_gives_up_unreachable_device() {
+	Pool pool{1};
+	add_devices(pool, 2);
+	pool.get_client(0)->reachable = false;
+	pool.set_max_attempts(3);
+	pool.set_retry_delay(200);
+	int result0 = -1;
+	int result1 = -1;
+	pool.submit(0, unlock_op, [&result0](int, bool ok) { result0 = ok; });
+	pool.submit(1, unlock_op, [&result1](int, bool ok) { result1 = ok; });
+	run_pool(pool, 2'000'000);
+	TEST_ASSERT_EQUAL(0, result0);
+	TEST_ASSERT_EQUAL(1, result1);
+	const auto& m = pool.get_metrics();
+	TEST_ASSERT_EQUAL(3, m.connect_failures);
+	TEST_ASSERT_EQUAL(0, SimClient::collisions);
+	TEST_ASSERT_EQUAL(1, m.completed);
+	TEST_ASSERT_EQUAL(1, m.failed);
+
+	// connection attempts rejected by the controller are failures too
+	SimClient::gap_slots = 0;
+	pool.set_max_attempts(2);
+	result1 = -1;
+	pool.submit(1, unlock_op, [&result1](int, bool ok) { result1 = ok; });
+	run_pool(pool, 3'000'000);
+	TEST_ASSERT_EQUAL(0, result1);
+	TEST_ASSERT_EQUAL(5, m.connect_failures);
+	TEST_ASSERT_EQUAL(0, SimClient::live);
+}
+
+void
+test_pool_session_timeout_and_queue_limit() {
+	Pool pool{1};
+	add_devices(pool, 1);
+	SimClient::auth_latency_us = 5'000'000;
+	pool.set_session_timeout(1'000);
+	pool.set_max_attempts(1);
+	for (size_t i = 0; i < Pool::MAX_PENDING; i++) {
+		TEST_ASSERT_TRUE(pool.submit(0, unlock_op));
+	}
+	TEST_ASSERT_FALSE(pool.submit(0, unlock_op));
+	TEST_ASSERT_EQUAL(1, pool.get_metrics().rejected);
+	run_pool(pool, 1'500'000);
+	SimClient::auth_latency_us = 50'000;
+	TEST_ASSERT_EQUAL(0, pool.get_pending_count());
+	TEST_ASSERT_EQUAL(Pool::MAX_PENDING, pool.get_metrics().failed);
+	TEST_ASSERT_EQUAL(0, SimClient::live);
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_pool_serves_more_devices_than_slots);
+	RUN_TEST(test_pool_reuses_session_and_evicts_lru);
+	RUN_TEST(test_pool_gives_up_unreachable_device);
+	RUN_TEST(test_pool_session_timeout_and_queue_limit);
+	return UNITY_END();
+}
@@ -0,0 +1,181 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <sim_client.h>
+#include <vector>
+#include "ConnectScheduler.h"
+#include "clock.h"
+
+using libsesame3bt::ConnectScheduler;
+
+using fake_nimble::SimClient;
+
+using Scheduler = ConnectScheduler<SimClient>;
+
+struct Result {
+	SimClient* client;
+	Scheduler::Report report;
+};
+
+// until all requests are done or `until_us`
+static void
+drive(Scheduler& scheduler, uint64_t until_us) {
+	fake_nimble::drive(until_us, [&scheduler]() {
+		scheduler.loop();
+		return scheduler.get_queued_count() || scheduler.get_running_count();
+	});
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	SimClient::reset_link();
+}
+
+void
+tearDown() {
+	libsesame3bt::sysclock::set_source(nullptr);
+	fake_nimble::reset();
+}
+
+void
+test_back_to_back() {
+	constexpr size_t N = 6;
+	SimClient clients[N];
+	Scheduler scheduler;
+	std::vector<Result> results;
+	for (auto& c : clients) {
+		TEST_ASSERT_TRUE(scheduler.request(c, [&results](auto& c, const auto& r) { results.push_back({&c, r}); }));
+	}
+	TEST_ASSERT_FALSE(scheduler.request(clients[0]));
+	TEST_ASSERT_EQUAL(N, scheduler.get_queued_count());
+	drive(scheduler, 1'000'000);
+
+	TEST_ASSERT_EQUAL(0, SimClient::collisions);
+	TEST_ASSERT_EQUAL(1, SimClient::max_gap_busy);
+	TEST_ASSERT_EQUAL(N, results.size());
+	for (size_t i = 0; i < N; i++) {
+		// connected in request order
+		TEST_ASSERT_EQUAL_PTR(&clients[i], results[i].client);
+		TEST_ASSERT_EQUAL(Scheduler::result_t::active, results[i].report.result);
+		TEST_ASSERT_GREATER_OR_EQUAL(30, results[i].report.connect_ms);
+		TEST_ASSERT_GREATER_OR_EQUAL(50, results[i].report.authenticate_ms);
+		TEST_ASSERT_EQUAL(SimClient::state_t::active, clients[i].get_state());
+	}
+	// authentication overlaps with the next connection: less than N * (connect + authenticate)
+	TEST_ASSERT_LESS_THAN(N * 80, fake_nimble::now_us() / 1'000);
+	TEST_ASSERT_LESS_THAN(results[1].report.wait_ms, results[0].report.wait_ms);
+	TEST_ASSERT_LESS_THAN(results[N - 1].report.wait_ms, results[N - 2].report.wait_ms);
+
+	auto& m = scheduler.get_metrics();
+	TEST_ASSERT_EQUAL(N, m.requested);
+	TEST_ASSERT_EQUAL(N, m.succeeded);
+	TEST_ASSERT_EQUAL(0, m.failed);
+	TEST_ASSERT_EQUAL(N, m.max_depth);
+	TEST_ASSERT_EQUAL(results[N - 1].report.wait_ms, m.max_wait_ms);
+	TEST_ASSERT_GREATER_THAN(0, m.mean_wait_ms());
+	TEST_ASSERT_LESS_THAN(m.max_wait_ms, m.mean_wait_ms());
+}
+
+void
+test_concurrent_limit() {
+	SimClient::gap_slots = 2;
+	SimClient clients[5];
+	Scheduler scheduler{2};
+	for (auto& c : clients) {
+		TEST_ASSERT_TRUE(scheduler.request(c));
+	}
+	scheduler.loop();
+	TEST_ASSERT_EQUAL(3, scheduler.get_queued_count());
+	TEST_ASSERT_EQUAL(2, scheduler.get_running_count());
+	drive(scheduler, 1'000'000);
+	TEST_ASSERT_EQUAL(0, SimClient::collisions);
+	TEST_ASSERT_EQUAL(2, SimClient::max_gap_busy);
+	TEST_ASSERT_EQUAL(5, scheduler.get_metrics().succeeded);
+}
+
+void
+test_failures() {
+	SimClient clients[3];
+	clients[0].reachable = false;
+	clients[1].respond = false;
+	Scheduler scheduler;
+	scheduler.set_session_timeout(500);
+	std::vector<Result> results;
+	for (auto& c : clients) {
+		TEST_ASSERT_TRUE(scheduler.request(c, [&results](auto& c, const auto& r) { results.push_back({&c, r}); }));
+	}
+	drive(scheduler, 2'000'000);
+
+	TEST_ASSERT_EQUAL(3, results.size());
+	TEST_ASSERT_EQUAL_PTR(&clients[0], results[0].client);
+	TEST_ASSERT_EQUAL(Scheduler::result_t::connect_failed, results[0].report.result);
+	// a failed connection does not hold the queue
+	TEST_ASSERT_EQUAL_PTR(&clients[2], results[1].client);
+	TEST_ASSERT_EQUAL(Scheduler::result_t::active, results[1].report.result);
+	TEST_ASSERT_EQUAL_PTR(&clients[1], results[2].client);
+	TEST_ASSERT_EQUAL(Scheduler::result_t::timeout, results[2].report.result);
+	TEST_ASSERT_EQUAL(1, clients[1].disconnects);
+	TEST_ASSERT_EQUAL(SimClient::state_t::idle, clients[1].get_state());
+	TEST_ASSERT_EQUAL(0, SimClient::gap_busy);
+
+	auto& m = scheduler.get_metrics();
+	TEST_ASSERT_EQUAL(1, m.succeeded);
+	TEST_ASSERT_EQUAL(2, m.failed);
+	// a failed client may be requested again
+	TEST_ASSERT_TRUE(scheduler.request(clients[0]));
+}
+
+void
+test_client_retry() {
+	// connection retries of the client are started by its loop(), run by the scheduler
+	SimClient client;
+	client.failed_attempts = 2;
+	Scheduler scheduler;
+	std::vector<Result> results;
+	TEST_ASSERT_TRUE(scheduler.request(client, [&results](auto& c, const auto& r) { results.push_back({&c, r}); }));
+	drive(scheduler, 1'000'000);
+
+	TEST_ASSERT_EQUAL(1, results.size());
+	TEST_ASSERT_EQUAL(Scheduler::result_t::active, results[0].report.result);
+	TEST_ASSERT_GREATER_OR_EQUAL(90, results[0].report.connect_ms);
+	TEST_ASSERT_GREATER_THAN(0, client.loops);
+}
+
+void
+test_cancel() {
+	SimClient clients[3];
+	Scheduler scheduler;
+	std::vector<Result> results;
+	for (auto& c : clients) {
+		TEST_ASSERT_TRUE(scheduler.request(c, [&results](auto& c, const auto& r) { results.push_back({&c, r}); }));
+	}
+	scheduler.loop();
+	TEST_ASSERT_FALSE(scheduler.cancel(clients[0]));  // already connecting
+	TEST_ASSERT_TRUE(scheduler.cancel(clients[1]));
+	TEST_ASSERT_FALSE(scheduler.is_requested(clients[1]));
+	TEST_ASSERT_EQUAL(1, results.size());
+	TEST_ASSERT_EQUAL(Scheduler::result_t::cancelled, results[0].report.result);
+	drive(scheduler, 1'000'000);
+
+	TEST_ASSERT_EQUAL(3, results.size());
+	TEST_ASSERT_EQUAL_PTR(&clients[2], results[2].client);
+	TEST_ASSERT_EQUAL(SimClient::state_t::idle, clients[1].get_state());
+	auto& m = scheduler.get_metrics();
+	TEST_ASSERT_EQUAL(2, m.succeeded);
+	TEST_ASSERT_EQUAL(1, m.cancelled);
+	TEST_ASSERT_EQUAL(0, m.failed);
+	scheduler.reset_metrics();
+	TEST_ASSERT_EQUAL(0, scheduler.get_metrics().requested);
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_back_to_back);
+	RUN_TEST(test_concurrent_limit);
+	RUN_TEST(test_failures);
+	RUN_TEST(test_client_retry);
+	RUN_TEST(test_cancel);
+	return UNITY_END();
+}
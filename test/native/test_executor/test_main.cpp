@@ -0,0 +1,174 @@
+#include <unity.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+#include "Executor.h"
+#include "clock.h"
+
+using libsesame3bt::QueueExecutor;
+using libsesame3bt::Task;
+using libsesame3bt::TaskExecutor;
+
+static uint64_t fake_time_us;
+static std::atomic<size_t> allocations{0};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void*
+operator new(size_t size) {
+	allocations++;
+	if (void* p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void
+operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+void
+setUp() {
+	fake_time_us = 0;
+}
+
+void
+tearDown() {
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_queue_executor() {
+	libsesame3bt::sysclock::set_source([]() { return fake_time_us; });
+	QueueExecutor exec{2};
+	std::vector<int> order;
+	TEST_ASSERT_TRUE(exec.post([&order]() { order.push_back(1); }));
+	fake_time_us = 1'000;
+	TEST_ASSERT_TRUE(exec.post([&order]() { order.push_back(2); }));
+	TEST_ASSERT_FALSE(exec.post([&order]() { order.push_back(3); }));  // full
+	TEST_ASSERT_EQUAL(2, exec.get_depth());
+	TEST_ASSERT_TRUE(order.empty());
+
+	fake_time_us = 5'000;
+	TEST_ASSERT_EQUAL(2, exec.run_pending());
+	TEST_ASSERT_EQUAL(2, order.size());
+	TEST_ASSERT_EQUAL(1, order[0]);
+	TEST_ASSERT_EQUAL(2, order[1]);
+	auto stats = exec.get_stats();
+	TEST_ASSERT_EQUAL(2, stats.posted);
+	TEST_ASSERT_EQUAL(2, stats.executed);
+	TEST_ASSERT_EQUAL(1, stats.dropped);
+	TEST_ASSERT_EQUAL(2, stats.max_depth);
+	TEST_ASSERT_EQUAL(2, stats.latency.count());
+	TEST_ASSERT_UINT32_WITHIN(5'000 / 8, 5'000, stats.latency.max());
+	TEST_ASSERT_UINT32_WITHIN(4'000 / 8, 4'000, stats.latency.min());
+
+	// tasks posted by a task run in the same call, up to max_count
+	exec.post([&]() { exec.post([&order]() { order.push_back(4); }); });
+	TEST_ASSERT_EQUAL(1, exec.run_pending(1));
+	TEST_ASSERT_EQUAL(1, exec.get_depth());
+	TEST_ASSERT_EQUAL(1, exec.run_pending());
+	TEST_ASSERT_EQUAL(4, order.back());
+	exec.reset_stats();
+	TEST_ASSERT_EQUAL(0, exec.get_stats().posted);
+}
+
+void
+test_task_storage() {
+	QueueExecutor exec{4};
+	auto counter = std::make_shared<int>(0);
+	// scan result sized closure: stored in the preallocated slot
+	std::array<uint8_t, 32> info{};
+	info[0] = 1;
+	auto before = allocations.load();
+	TEST_ASSERT_TRUE(exec.post([counter, info]() { *counter += info[0]; }));
+	TEST_ASSERT_EQUAL(1, exec.run_pending());
+	TEST_ASSERT_EQUAL(before, allocations.load());
+	TEST_ASSERT_EQUAL(1, *counter);
+	TEST_ASSERT_EQUAL(1, counter.use_count());
+
+	// larger closure: on the heap, released after run
+	std::array<uint8_t, Task::INLINE_SIZE + 1> big{};
+	big[0] = 2;
+	Task task{[counter, big]() { *counter += big[0]; }};
+	TEST_ASSERT_FALSE(task.is_inline());
+	Task moved{std::move(task)};
+	TEST_ASSERT_FALSE(static_cast<bool>(task));
+	TEST_ASSERT_TRUE(exec.post(std::move(moved)));
+	TEST_ASSERT_EQUAL(1, exec.run_pending());
+	TEST_ASSERT_EQUAL(3, *counter);
+	TEST_ASSERT_EQUAL(1, counter.use_count());
+
+	// dropped task releases its closure
+	for (int i = 0; i < 5; i++) {
+		exec.post([counter]() { (*counter)++; });
+	}
+	TEST_ASSERT_EQUAL(5, counter.use_count());
+	exec.run_pending();
+	TEST_ASSERT_EQUAL(7, *counter);
+	TEST_ASSERT_EQUAL(1, counter.use_count());
+}
+
+void
+test_task_executor() {
+	TaskExecutor exec{8};
+	std::atomic<int> done{0};
+	std::atomic<bool> in_worker{true};
+	auto caller = std::this_thread::get_id();
+	// posted before start()
+	TEST_ASSERT_TRUE(exec.post([&done]() { done++; }));
+	TEST_ASSERT_TRUE(exec.start());
+	TEST_ASSERT_FALSE(exec.start());
+	int posted = 1;
+	for (int i = 0; i < 100; i++) {
+		while (!exec.post([&, caller]() {
+			if (std::this_thread::get_id() == caller) {
+				in_worker = false;
+			}
+			done++;
+		})) {
+			std::this_thread::yield();  // queue full, worker is behind
+		}
+		posted++;
+	}
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (done < posted && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	exec.stop();
+	TEST_ASSERT_FALSE(exec.is_running());
+	TEST_ASSERT_EQUAL(101, done.load());
+	TEST_ASSERT_TRUE(in_worker);
+	auto stats = exec.get_stats();
+	TEST_ASSERT_EQUAL(101, stats.executed);
+	TEST_ASSERT_LESS_OR_EQUAL(8, stats.max_depth);
+
+	// stopped: tasks stay queued
+	TEST_ASSERT_TRUE(exec.post([&done]() { done++; }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	TEST_ASSERT_EQUAL(1, exec.get_depth());
+	TEST_ASSERT_EQUAL(1, exec.run_pending());
+	TEST_ASSERT_EQUAL(102, done.load());
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_queue_executor);
+	RUN_TEST(test_task_storage);
+	RUN_TEST(test_task_executor);
+	return UNITY_END();
+}
@@ -0,0 +1,197 @@
+#include <unity.h>
+#include <unistd.h>
+#include <cstdio>
+#include <optional>
+#include <vector>
+#include "HistoryJournal.h"
+
+using libsesame3bt::HistoryJournal;
+using libsesame3bt::Sesame;
+
+// Fields of SesameClient::History used by the journal
+struct FakeHistory {
+	time_t time;
+	int32_t record_id;
+	Sesame::history_type_t type;
+	std::optional<uint8_t> history_tag_type;
+	size_t tag_len;
+	char tag[Sesame::MAX_HISTORY_TAG_SIZE + 1];
+	float scaled_voltage;
+	float scaled_voltage2;
+	std::vector<std::byte> extra;
+};
+
+static const char* path = "test_history_journal.bin";
+
+static FakeHistory
+history(int32_t id) {
+	FakeHistory h{};
+	h.time = 1'700'000'000 + id * 60;
+	h.record_id = id;
+	h.type = Sesame::history_type_t::manual_locked;
+	if (id % 2) {
+		h.history_tag_type = 3;
+	}
+	h.tag_len = std::snprintf(h.tag, sizeof(h.tag), "tag%d", id);
+	h.scaled_voltage = 5.5f;
+	h.scaled_voltage2 = 6.0f;
+	h.extra.assign(id % 40, std::byte{0x5a});
+	return h;
+}
+
+static void
+fill(HistoryJournal& journal, int32_t from, int32_t to) {
+	for (int32_t id = from; id < to; id++) {
+		TEST_ASSERT_TRUE(journal.append(history(id)));
+	}
+}
+
+void
+setUp() {
+	std::remove(path);
+}
+
+void
+tearDown() {
+	std::remove(path);
+}
+
+void
+test_append_and_read() {
+	HistoryJournal journal;
+	journal.set_sync(false);
+	TEST_ASSERT_TRUE(journal.open(path));
+	fill(journal, 0, 10);
+	TEST_ASSERT_EQUAL(10, journal.size());
+	HistoryJournal::Entry e;
+	TEST_ASSERT_TRUE(journal.read(3, e));
+	TEST_ASSERT_EQUAL(3, e.record_id);
+	TEST_ASSERT_EQUAL(1'700'000'180, e.time);
+	TEST_ASSERT_EQUAL(3, e.tag_type);
+	TEST_ASSERT_EQUAL(4, e.tag_len);
+	TEST_ASSERT_EQUAL_MEMORY("tag3", e.tag, 4);
+	TEST_ASSERT_EQUAL(3, e.extra_len);
+	TEST_ASSERT_TRUE(journal.read(2, e));
+	TEST_ASSERT_EQUAL(HistoryJournal::NO_TAG_TYPE, e.tag_type);
+	TEST_ASSERT_FALSE(journal.read(10, e));
+	journal.close();
+
+	// extra is truncated
+	TEST_ASSERT_TRUE(journal.open(path));
+	TEST_ASSERT_EQUAL(10, journal.size());
+	TEST_ASSERT_EQUAL(0, journal.get_recovered_count());
+	fill(journal, 39, 40);
+	TEST_ASSERT_TRUE(journal.read(10, e));
+	TEST_ASSERT_EQUAL(HistoryJournal::EXTRA_SIZE, e.extra_len);
+}
+
+void
+test_range_query() {
+	HistoryJournal journal;
+	journal.set_sync(false);
+	TEST_ASSERT_TRUE(journal.open(path));
+	fill(journal, 0, 1000);
+	journal.close();
+	TEST_ASSERT_TRUE(journal.open(path));  // index is rebuilt
+	std::vector<int32_t> ids;
+	auto n = journal.query(1'700'000'000 + 300 * 60, 1'700'000'000 + 309 * 60, [&ids](const auto& e) {
+		ids.push_back(e.record_id);
+		return true;
+	});
+	TEST_ASSERT_EQUAL(10, n);
+	for (size_t i = 0; i < ids.size(); i++) {
+		TEST_ASSERT_EQUAL(300 + i, ids[i]);
+	}
+	// between records
+	TEST_ASSERT_EQUAL(128, journal.lower_bound(1'700'000'000 + 127 * 60 + 1));
+	TEST_ASSERT_EQUAL(0, journal.lower_bound(0));
+	TEST_ASSERT_EQUAL(1000, journal.lower_bound(1'800'000'000));
+	// stop from visitor
+	n = journal.query(0, 1'800'000'000, [](const auto& e) { return e.record_id < 4; });
+	TEST_ASSERT_EQUAL(5, n);
+	TEST_ASSERT_EQUAL(0, journal.query(1'800'000'000, 1'900'000'000, [](const auto&) { return true; }));
+}
+
+void
+test_tail_recovery() {
+	HistoryJournal journal;
+	TEST_ASSERT_TRUE(journal.open(path));
+	fill(journal, 0, 5);
+	journal.close();
+
+	// torn write: half of an entry, and a corrupted last entry
+	auto* f = std::fopen(path, "r+b");
+	std::fseek(f, -8, SEEK_END);
+	std::fputc(0xff, f);
+	std::fseek(f, 0, SEEK_END);
+	std::vector<uint8_t> half(sizeof(HistoryJournal::Entry) / 2, 0xaa);
+	std::fwrite(half.data(), half.size(), 1, f);
+	std::fclose(f);
+
+	TEST_ASSERT_TRUE(journal.open(path));
+	TEST_ASSERT_EQUAL(4, journal.size());
+	TEST_ASSERT_EQUAL(2, journal.get_recovered_count());
+	fill(journal, 4, 6);
+	journal.close();
+	TEST_ASSERT_TRUE(journal.open(path));
+	TEST_ASSERT_EQUAL(6, journal.size());
+	TEST_ASSERT_EQUAL(0, journal.get_recovered_count());
+	HistoryJournal::Entry e;
+	TEST_ASSERT_TRUE(journal.read(5, e));
+	TEST_ASSERT_EQUAL(5, e.record_id);
+}
+
+void
+test_short_file() {
+	// created but the header was not written (power loss)
+	std::fclose(std::fopen(path, "wb"));
+	HistoryJournal journal;
+	TEST_ASSERT_TRUE(journal.open(path));
+	TEST_ASSERT_EQUAL(0, journal.size());
+	fill(journal, 0, 3);
+	journal.close();
+	TEST_ASSERT_TRUE(journal.open(path));
+	TEST_ASSERT_EQUAL(3, journal.size());
+	journal.close();
+
+	// torn header
+	auto* f = std::fopen(path, "r+b");
+	std::vector<uint8_t> head(5);
+	TEST_ASSERT_EQUAL(head.size(), std::fread(head.data(), 1, head.size(), f));
+	std::fclose(f);
+	f = std::fopen(path, "wb");
+	std::fwrite(head.data(), head.size(), 1, f);
+	std::fclose(f);
+	TEST_ASSERT_TRUE(journal.open(path));
+	TEST_ASSERT_EQUAL(0, journal.size());
+	TEST_ASSERT_TRUE(journal.append(history(1)));
+	journal.close();
+
+	// short file of something else is kept
+	f = std::fopen(path, "wb");
+	std::fputs("abc", f);
+	std::fclose(f);
+	TEST_ASSERT_FALSE(journal.open(path));
+}
+
+void
+test_reject_other_file() {
+	auto* f = std::fopen(path, "wb");
+	std::fputs("not a journal at all", f);
+	std::fclose(f);
+	HistoryJournal journal;
+	TEST_ASSERT_FALSE(journal.open(path));
+	TEST_ASSERT_FALSE(journal.is_open());
+	TEST_ASSERT_FALSE(journal.append(history(1)));
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_append_and_read);
+	RUN_TEST(test_range_query);
+	RUN_TEST(test_tail_recovery);
+	RUN_TEST(test_short_file);
+	RUN_TEST(test_reject_other_file);
+	return UNITY_END();
+}
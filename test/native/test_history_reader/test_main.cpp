@@ -0,0 +1,272 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <sim_client.h>
+#include <algorithm>
+#include <vector>
+#include "HistoryReader.h"
+#include "clock.h"
+
+using libsesame3bt::RecordIdWindow;
+using libsesame3bt::Sesame;
+
+using fake_nimble::SimClient;
+
+// listener of the application
+class AppListener : public SimClient::Listener {
+ public:
+	void on_state(SimClient&, SimClient::state_t) override { states++; }
+	void on_history(SimClient&, const SimClient::History&) override { histories++; }
+	int states = 0;
+	int histories = 0;
+};
+
+using Reader = libsesame3bt::HistoryReader<SimClient>;
+
+static void
+run_reader(Reader& reader, uint64_t until_us) {
+	fake_nimble::drive(until_us, [&reader]() {
+		reader.loop();
+		return reader.is_running();
+	});
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+}
+
+void
+tearDown() {
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+void
+test_record_id_window() {
+	RecordIdWindow w;
+	TEST_ASSERT_TRUE(w.insert(1000));
+	TEST_ASSERT_FALSE(w.insert(1000));
+	TEST_ASSERT_TRUE(w.insert(999));
+	TEST_ASSERT_TRUE(w.contains(999));
+	TEST_ASSERT_FALSE(w.contains(1001));
+	// slide up, 1000 stays in the window, 999 falls out
+	TEST_ASSERT_TRUE(w.insert(999 + RecordIdWindow::WINDOW));
+	TEST_ASSERT_FALSE(w.contains(999));
+	TEST_ASSERT_FALSE(w.insert(1000));
+	// slide down
+	TEST_ASSERT_TRUE(w.insert(-5));
+	TEST_ASSERT_FALSE(w.contains(999 + RecordIdWindow::WINDOW));
+	TEST_ASSERT_FALSE(w.insert(-5));
+	w.clear();
+	TEST_ASSERT_TRUE(w.insert(-5));
+}
+
+void
+test_drain_all_records() {
+	SimClient client{SimClient::state_t::active};
+	for (int32_t id = 100; id < 150; id++) {
+		client.records.push_back(id);
+	}
+	Reader reader{client};
+	std::vector<int32_t> ids;
+	int done_count = 0;
+	Reader::result_t result{};
+	TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); },
+	                              [&](SimClient&, Reader::result_t r) {
+		                              done_count++;
+		                              result = r;
+	                              }));
+	TEST_ASSERT_FALSE(reader.start(nullptr));
+	run_reader(reader, 10'000'000);
+	TEST_ASSERT_FALSE(reader.is_running());
+	TEST_ASSERT_EQUAL(1, done_count);
+	TEST_ASSERT_TRUE(result == Reader::result_t::drained);
+	TEST_ASSERT_EQUAL(50, ids.size());
+	for (size_t i = 0; i < ids.size(); i++) {
+		TEST_ASSERT_EQUAL(100 + i, ids[i]);
+	}
+	// pipelined: 3 requests per round trip
+	TEST_ASSERT_LESS_THAN(1'000'000, fake_nimble::now_us());
+	TEST_ASSERT_EQUAL(50, reader.get_stats().records);
+	TEST_ASSERT_EQUAL(0, reader.get_stats().retries);
+}
+
+void
+test_duplicates_and_lost_answers() {
+	SimClient client{SimClient::state_t::active};
+	for (int32_t id = 1; id <= 20; id++) {
+		client.records.push_back(id);
+	}
+	client.lost = {4, 9};
+	client.doubled = {2, 6};
+	Reader reader{client};
+	reader.set_timeout(500);
+	std::vector<int32_t> ids;
+	Reader::result_t result{};
+	TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); },
+	                              [&result](SimClient&, Reader::result_t r) { result = r; }));
+	run_reader(reader, 30'000'000);
+	TEST_ASSERT_TRUE(result == Reader::result_t::drained);
+	// records of lost answers are gone from the device, the rest arrives once and in order
+	TEST_ASSERT_EQUAL(18, ids.size());
+	TEST_ASSERT_TRUE(std::is_sorted(ids.begin(), ids.end()));
+	TEST_ASSERT_TRUE(std::adjacent_find(ids.begin(), ids.end()) == ids.end());
+	TEST_ASSERT_EQUAL(2, reader.get_stats().duplicates);
+	TEST_ASSERT_GREATER_THAN(0, reader.get_stats().retries);
+
+	// the same records are not delivered by the next drain
+	client.records = {19, 20, 21};
+	ids.clear();
+	TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); }));
+	run_reader(reader, fake_nimble::now_us() + 10'000'000);
+	TEST_ASSERT_EQUAL(1, ids.size());
+	TEST_ASSERT_EQUAL(21, ids[0]);
+}
+
+void
+test_out_of_order_records() {
+	SimClient client{SimClient::state_t::active};
+	client.records = {5, 3, 4, 1, 2};
+	Reader reader{client};
+	std::vector<int32_t> ids;
+	TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); }));
+	run_reader(reader, 10'000'000);
+	TEST_ASSERT_EQUAL(5, ids.size());
+	for (size_t i = 0; i < ids.size(); i++) {
+		TEST_ASSERT_EQUAL(1 + i, ids[i]);
+	}
+}
+
+void
+test_descending_past_max_held() {
+	SimClient client{SimClient::state_t::active};
+	// newest first, more than MAX_HELD records
+	for (int32_t id = 40; id >= 1; id--) {
+		client.records.push_back(id);
+	}
+	Reader reader{client};
+	std::vector<int32_t> ids;
+	TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); }));
+	run_reader(reader, 10'000'000);
+	TEST_ASSERT_EQUAL(40, ids.size());
+	// 40..25 are held, exceeding MAX_HELD with 24 delivers 24..40 in order, 23..1 arrive late and are delivered at once
+	static_assert(Reader::MAX_HELD == 16);
+	for (int i = 0; i < 17; i++) {
+		TEST_ASSERT_EQUAL(24 + i, ids[i]);
+	}
+	for (int i = 17; i < 40; i++) {
+		TEST_ASSERT_EQUAL(23 - (i - 17), ids[i]);
+	}
+	auto sorted = ids;
+	std::sort(sorted.begin(), sorted.end());
+	TEST_ASSERT_TRUE(std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end());
+	TEST_ASSERT_EQUAL(23, reader.get_stats().late);
+	TEST_ASSERT_EQUAL(40, reader.get_stats().records);
+}
+
+void
+test_chains_listener() {
+	SimClient client{SimClient::state_t::active};
+	client.records = {1, 2, 3};
+	AppListener app;
+	client.set_listener(&app);
+	std::vector<int32_t> ids;
+	{
+		Reader reader{client};
+		TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); }));
+		TEST_ASSERT_TRUE(client.get_listener() != &app);
+		// events other than history reach the application
+		client.get_listener()->on_state(client, SimClient::state_t::active);
+		TEST_ASSERT_EQUAL(1, app.states);
+		run_reader(reader, 10'000'000);
+		TEST_ASSERT_FALSE(reader.is_running());
+		TEST_ASSERT_EQUAL(3, ids.size());
+		// answers are passed on (3 records and the end of history), listener restored after reading
+		TEST_ASSERT_GREATER_OR_EQUAL(4, app.histories);
+		TEST_ASSERT_EQUAL_PTR(&app, client.get_listener());
+
+		// destroyed while reading
+		client.records = {4};
+		TEST_ASSERT_TRUE(reader.start(nullptr));
+		TEST_ASSERT_TRUE(client.get_listener() != &app);
+	}
+	TEST_ASSERT_EQUAL_PTR(&app, client.get_listener());
+	fake_nimble::run();
+}
+
+void
+test_busy_in_drain() {
+	SimClient client{SimClient::state_t::active};
+	for (int32_t id = 1; id <= 30; id++) {
+		client.records.push_back(id);
+	}
+	// one of three pipelined requests, then two in a row
+	client.busy = {4, 10, 11};
+	Reader reader{client};
+	reader.set_retry_delay(100);
+	std::vector<int32_t> ids;
+	Reader::result_t result{};
+	TEST_ASSERT_TRUE(reader.start([&ids](SimClient&, const SimClient::History& h) { ids.push_back(h.record_id); },
+	                              [&result](SimClient&, Reader::result_t r) { result = r; }));
+	run_reader(reader, 10'000'000);
+	TEST_ASSERT_TRUE(result == Reader::result_t::drained);
+	TEST_ASSERT_EQUAL(30, ids.size());
+	for (size_t i = 0; i < ids.size(); i++) {
+		TEST_ASSERT_EQUAL(1 + i, ids[i]);
+	}
+	TEST_ASSERT_EQUAL(3, reader.get_stats().retries);
+	TEST_ASSERT_EQUAL(0, reader.get_stats().duplicates);
+
+	// a device that stays busy
+	client.records = {31};
+	client.busy.clear();
+	for (size_t n = client.requests; n < client.requests + 50; n++) {
+		client.busy.push_back(n);
+	}
+	reader.set_max_retries(2);
+	TEST_ASSERT_TRUE(reader.start(nullptr, [&result](SimClient&, Reader::result_t r) { result = r; }));
+	run_reader(reader, fake_nimble::now_us() + 10'000'000);
+	TEST_ASSERT_FALSE(reader.is_running());
+	TEST_ASSERT_TRUE(result == Reader::result_t::error);
+	TEST_ASSERT_EQUAL(1, client.records.size());
+}
+
+void
+test_no_answer_and_disconnect() {
+	SimClient client{SimClient::state_t::active};
+	client.records = {1, 2, 3};
+	client.lost = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+	Reader reader{client};
+	reader.set_timeout(500);
+	reader.set_max_retries(2);
+	Reader::result_t result{};
+	TEST_ASSERT_TRUE(reader.start(nullptr, [&result](SimClient&, Reader::result_t r) { result = r; }));
+	run_reader(reader, 10'000'000);
+	TEST_ASSERT_FALSE(reader.is_running());
+	TEST_ASSERT_TRUE(result == Reader::result_t::timeout);
+	TEST_ASSERT_EQUAL(6, reader.get_stats().retries);
+
+	client.records = {1, 2, 3};
+	client.lost.clear();
+	client.history_latency_us = 1'000'000;
+	TEST_ASSERT_TRUE(reader.start(nullptr, [&result](SimClient&, Reader::result_t r) { result = r; }));
+	reader.loop();
+	client.set_state(SimClient::state_t::idle);
+	reader.loop();
+	TEST_ASSERT_TRUE(result == Reader::result_t::disconnected);
+	TEST_ASSERT_FALSE(reader.start(nullptr));
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_record_id_window);
+	RUN_TEST(test_drain_all_records);
+	RUN_TEST(test_duplicates_and_lost_answers);
+	RUN_TEST(test_out_of_order_records);
+	RUN_TEST(test_descending_past_max_held);
+	RUN_TEST(test_chains_listener);
+	RUN_TEST(test_busy_in_drain);
+	RUN_TEST(test_no_answer_and_disconnect);
+	return UNITY_END();
+}
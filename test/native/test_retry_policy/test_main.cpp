@@ -0,0 +1,121 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <algorithm>
+#include <cstdint>
+#include "RetryPolicy.h"
+
+using libsesame3bt::FailureCounter;
+using libsesame3bt::RetryPolicy;
+using reason_class_t = RetryPolicy::reason_class_t;
+
+static constexpr int CONN_ESTABLISHMENT = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_ESTABLISHMENT;
+
+void
+setUp() {}
+
+void
+tearDown() {}
+
+void
+test_backoff() {
+	RetryPolicy policy{8, 100, 1'000, 2, 0, 0};
+	TEST_ASSERT_EQUAL(100, policy.backoff_ms(1));
+	TEST_ASSERT_EQUAL(200, policy.backoff_ms(2));
+	TEST_ASSERT_EQUAL(400, policy.backoff_ms(3));
+	TEST_ASSERT_EQUAL(800, policy.backoff_ms(4));
+	TEST_ASSERT_EQUAL(1'000, policy.backoff_ms(5));
+	TEST_ASSERT_EQUAL(1'000, policy.backoff_ms(255));
+	// no jitter: the delay is the backoff
+	TEST_ASSERT_EQUAL(400, *policy.next_delay(3, CONN_ESTABLISHMENT, 0));
+}
+
+void
+test_jitter() {
+	RetryPolicy policy{4, 1'000, 5'000, 2, 25, 0};
+	uint32_t lowest = UINT32_MAX;
+	uint32_t highest = 0;
+	for (int i = 0; i < 1'000; i++) {
+		auto delay = policy.next_delay(1, CONN_ESTABLISHMENT, 0);
+		TEST_ASSERT_TRUE(delay.has_value());
+		lowest = std::min(lowest, *delay);
+		highest = std::max(highest, *delay);
+	}
+	TEST_ASSERT_GREATER_OR_EQUAL(750, lowest);
+	TEST_ASSERT_LESS_OR_EQUAL(1'000, highest);
+	// delays are spread, clients failing together do not retry together
+	TEST_ASSERT_GREATER_THAN(100, highest - lowest);
+}
+
+void
+test_give_up() {
+	auto policy = RetryPolicy::standard();
+	policy.jitter_pct = 0;
+	TEST_ASSERT_TRUE(policy.next_delay(1, CONN_ESTABLISHMENT, 0).has_value());
+	TEST_ASSERT_TRUE(policy.next_delay(3, BLE_HS_ETIMEOUT, 0).has_value());
+	// attempts exhausted
+	TEST_ASSERT_FALSE(policy.next_delay(4, CONN_ESTABLISHMENT, 0).has_value());
+	// the next attempt would start after the deadline
+	TEST_ASSERT_FALSE(policy.next_delay(1, CONN_ESTABLISHMENT, 9'900).has_value());
+	TEST_ASSERT_TRUE(policy.next_delay(1, CONN_ESTABLISHMENT, 9'700).has_value());
+	// fatal reason
+	TEST_ASSERT_FALSE(policy.next_delay(1, BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_LIMIT, 0).has_value());
+	// default policy does not retry
+	TEST_ASSERT_FALSE(RetryPolicy{}.next_delay(1, CONN_ESTABLISHMENT, 0).has_value());
+}
+
+void
+test_classify() {
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_ETIMEOUT) == reason_class_t::retryable);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_EBUSY) == reason_class_t::retryable);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(CONN_ESTABLISHMENT) == reason_class_t::retryable);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_SPVN_TMO) == reason_class_t::retryable);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(0) == reason_class_t::retryable);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_EINVAL) == reason_class_t::fatal);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_ENOMEM) == reason_class_t::fatal);
+	// connection attempt in progress / already connected
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_EALREADY) == reason_class_t::retryable);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_EDONE) == reason_class_t::fatal);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_LIMIT) == reason_class_t::fatal);
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_ERR_HCI_BASE + BLE_ERR_UNSUPPORTED) == reason_class_t::fatal);
+	// HCI codes are not mistaken for host codes of the same value
+	TEST_ASSERT_TRUE(RetryPolicy::classify(BLE_HS_ERR_HCI_BASE + BLE_HS_EINVAL) == reason_class_t::retryable);
+}
+
+void
+test_failure_counter() {
+	FailureCounter counter;
+	counter.add(CONN_ESTABLISHMENT);
+	counter.add(BLE_HS_ETIMEOUT);
+	counter.add(CONN_ESTABLISHMENT);
+	counter.add(BLE_HS_EINVAL);
+	counter.add_retry();
+	TEST_ASSERT_EQUAL(4, counter.total());
+	TEST_ASSERT_EQUAL(1, counter.fatal());
+	TEST_ASSERT_EQUAL(1, counter.retries());
+	TEST_ASSERT_EQUAL(2, counter.count(CONN_ESTABLISHMENT));
+	TEST_ASSERT_EQUAL(1, counter.count(BLE_HS_ETIMEOUT));
+	TEST_ASSERT_EQUAL(0, counter.count(BLE_HS_EBUSY));
+	TEST_ASSERT_EQUAL(3, counter.end() - counter.begin());
+	TEST_ASSERT_EQUAL(CONN_ESTABLISHMENT, counter.begin()->reason);
+
+	for (int i = 0; i < static_cast<int>(FailureCounter::REASON_SLOTS); i++) {
+		counter.add(BLE_HS_ERR_HCI_BASE + 0x80 + i);
+	}
+	TEST_ASSERT_EQUAL(FailureCounter::REASON_SLOTS, counter.end() - counter.begin());
+	TEST_ASSERT_EQUAL(3, counter.other());
+	TEST_ASSERT_EQUAL(4 + FailureCounter::REASON_SLOTS, counter.total());
+	counter.clear();
+	TEST_ASSERT_EQUAL(0, counter.total());
+	TEST_ASSERT_EQUAL(0, counter.end() - counter.begin());
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_backoff);
+	RUN_TEST(test_jitter);
+	RUN_TEST(test_give_up);
+	RUN_TEST(test_classify);
+	RUN_TEST(test_failure_counter);
+	return UNITY_END();
+}
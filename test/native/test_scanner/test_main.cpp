@@ -0,0 +1,410 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "Executor.h"
+#include "SesameScanner.h"
+#include "clock.h"
+
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameInfo;
+using libsesame3bt::SesameScanner;
+
+static const uint8_t sesame_uuid[16] = {0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78,
+                                        0x87, 0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0};
+
+static NimBLEAdvertisedDevice
+sesame_adv(const char* address, Sesame::model_t model, bool registered, int8_t rssi = -60, uint8_t uuid_tail = 0xf0) {
+	std::vector<uint8_t> payload{0x02, 0x01, 0x06, 0x03, 0x03, 0x81, 0xfd, 0x16, 0xff, 0x5a, 0x05, static_cast<uint8_t>(model), 0x00,
+	                             static_cast<uint8_t>(registered ? 1 : 0)};
+	payload.insert(payload.end(), std::begin(sesame_uuid), std::end(sesame_uuid));
+	payload.back() = uuid_tail;
+	payload[7] = static_cast<uint8_t>(payload.size() - 8);
+	return {NimBLEAddress{address, BLE_ADDR_RANDOM}, rssi, payload};
+}
+
+static NimBLEAdvertisedDevice
+beacon_adv(const char* address) {
+	return {NimBLEAddress{address, BLE_ADDR_RANDOM},
+	        -70,
+	        {0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c,
+	         0x0d, 0x0e, 0x0f, 0x10, 0x00, 0x01, 0x00, 0x02, 0xc5}};
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	NimBLEDevice::init("");
+}
+
+void
+tearDown() {
+	NimBLEDevice::deinit(true);
+}
+
+void
+test_scan_filters_sesame() {
+	fake_nimble::add_advertisement(beacon_adv("11:22:33:44:55:66"));
+	fake_nimble::add_advertisement(sesame_adv("01:23:45:67:89:ab", Sesame::model_t::sesame_5, true));
+	fake_nimble::add_advertisement(beacon_adv("11:22:33:44:55:67"));
+	std::vector<SesameInfo> results;
+	int end_count = 0;
+	SesameScanner::get().scan(1'000, [&](SesameScanner&, const SesameInfo* info) {
+		if (info) {
+			results.push_back(*info);
+		} else {
+			end_count++;
+		}
+	});
+	fake_nimble::reset();  // scan results are gone, copies must stay valid
+	TEST_ASSERT_EQUAL(1, results.size());
+	TEST_ASSERT_EQUAL(1, end_count);
+	const auto& info = results[0];
+	TEST_ASSERT_TRUE(info.model == Sesame::model_t::sesame_5);
+	TEST_ASSERT_TRUE(info.flags.registered);
+	TEST_ASSERT_EQUAL(-60, info.rssi);
+	TEST_ASSERT_TRUE(info.address() == NimBLEAddress("01:23:45:67:89:ab", BLE_ADDR_RANDOM));
+	TEST_ASSERT_EQUAL(BLE_ADDR_RANDOM, info.address().getType());
+	TEST_ASSERT_EQUAL_STRING("0f1e2d3c-4b5a-6978-8796-a5b4c3d2e1f0", info.uuid().toString().c_str());
+}
+
+void
+test_sesame_info_layout() {
+	static_assert(std::is_trivially_copyable_v<SesameInfo>);
+	TEST_ASSERT_EQUAL(32, sizeof(SesameInfo));
+	SesameInfo infos[4];
+	TEST_ASSERT_TRUE(infos[3].model == Sesame::model_t::unknown);
+	TEST_ASSERT_FALSE(infos[3].flags.registered);
+	TEST_ASSERT_TRUE(infos[3].address().isNull());
+}
+
+void
+test_scan_async_stop() {
+	int found = 0;
+	int end_count = 0;
+	TEST_ASSERT_TRUE(SesameScanner::get().scan_async(10'000, [&](SesameScanner& scanner, const SesameInfo* info) {
+		if (info) {
+			found++;
+			scanner.stop();
+		} else {
+			end_count++;
+		}
+	}));
+	auto* scan = NimBLEDevice::getScan();
+	TEST_ASSERT_TRUE(scan->isScanning());
+	TEST_ASSERT_TRUE(scan->is_active());
+	scan->deliver(beacon_adv("11:22:33:44:55:66"));
+	TEST_ASSERT_EQUAL(0, found);
+	scan->deliver(sesame_adv("01:23:45:67:89:ab", Sesame::model_t::sesame_bot_2, false));
+	TEST_ASSERT_EQUAL(1, found);
+	TEST_ASSERT_EQUAL(1, end_count);
+	TEST_ASSERT_FALSE(scan->isScanning());
+}
+
+void
+test_is_sesame_payload() {
+	auto sesame = sesame_adv("01:23:45:67:89:ab", Sesame::model_t::sesame_5, true).getPayload();
+	TEST_ASSERT_TRUE(SesameScanner::is_sesame_payload(sesame.data(), sesame.size()));
+	// truncated manufacturer data AD structure
+	TEST_ASSERT_FALSE(SesameScanner::is_sesame_payload(sesame.data(), 10));
+	auto beacon = beacon_adv("11:22:33:44:55:66").getPayload();
+	TEST_ASSERT_FALSE(SesameScanner::is_sesame_payload(beacon.data(), beacon.size()));
+	const uint8_t service_only[] = {0x02, 0x01, 0x06, 0x05, 0x03, 0x0f, 0x18, 0x81, 0xfd};
+	TEST_ASSERT_FALSE(SesameScanner::is_sesame_payload(service_only, sizeof(service_only)));
+	const uint8_t other_company[] = {0x03, 0x03, 0x81, 0xfd, 0x03, 0xff, 0x4c, 0x00};
+	TEST_ASSERT_FALSE(SesameScanner::is_sesame_payload(other_company, sizeof(other_company)));
+	const uint8_t zero_length[] = {0x03, 0x03, 0x81, 0xfd, 0x00, 0x03, 0xff, 0x5a, 0x05};
+	TEST_ASSERT_FALSE(SesameScanner::is_sesame_payload(zero_length, sizeof(zero_length)));
+	TEST_ASSERT_FALSE(SesameScanner::is_sesame_payload(nullptr, 0));
+}
+
+void
+test_scan_profile() {
+	using libsesame3bt::ScanProfile;
+	auto& scanner = SesameScanner::get();
+	auto* scan = NimBLEDevice::getScan();
+
+	scanner.scan(0, nullptr);
+	TEST_ASSERT_EQUAL(1349, scan->get_interval());
+	TEST_ASSERT_EQUAL(449, scan->get_window());
+	TEST_ASSERT_TRUE(scan->is_active());
+	TEST_ASSERT_EQUAL(0, scan->get_max_results());
+
+	TEST_ASSERT_TRUE(scanner.scan_async(0, nullptr, ScanProfile::low_duty()));
+	TEST_ASSERT_EQUAL(1280, scan->get_interval());
+	TEST_ASSERT_EQUAL(64, scan->get_window());
+	scanner.stop();
+
+	scanner.scan(0, nullptr, ScanProfile::passive());
+	TEST_ASSERT_FALSE(scan->is_active());
+
+	scanner.scan(0, nullptr, ScanProfile{100, 200, true});
+	TEST_ASSERT_EQUAL(100, scan->get_interval());
+	TEST_ASSERT_EQUAL(100, scan->get_window());
+}
+
+void
+test_scan_buffered() {
+	auto& scanner = SesameScanner::get();
+	auto* scan = NimBLEDevice::getScan();
+	std::vector<NimBLEAdvertisedDevice> advs;
+	for (int i = 0; i < 120; i++) {
+		advs.push_back(sesame_adv("01:23:45:67:89:ab", Sesame::model_t::sesame_5, true, static_cast<int8_t>(-i)));
+		advs.push_back(beacon_adv("11:22:33:44:55:66"));
+	}
+	TEST_ASSERT_TRUE(scanner.scan_buffered(0));
+	TEST_ASSERT_TRUE(scanner.is_scanning());
+	// BLE host task
+	std::thread producer{[&]() {
+		for (const auto& adv : advs) {
+			scan->deliver(adv);
+			std::this_thread::yield();
+		}
+		scan->end(0);
+	}};
+	size_t received = 0;
+	int8_t last_rssi = 1;
+	bool ordered = true;
+	SesameInfo info;
+	while (scanner.pop(info, 1'000)) {
+		if (info.rssi >= last_rssi) {
+			ordered = false;
+		}
+		last_rssi = info.rssi;
+		received++;
+	}
+	producer.join();
+	TEST_ASSERT_FALSE(scanner.is_scanning());
+	TEST_ASSERT_TRUE(ordered);
+	TEST_ASSERT_EQUAL(120, received + scanner.get_dropped_count());
+	TEST_ASSERT_FALSE(scanner.poll(info));
+}
+
+void
+test_scan_buffered_overflow() {
+	auto& scanner = SesameScanner::get();
+	auto* scan = NimBLEDevice::getScan();
+	TEST_ASSERT_TRUE(scanner.scan_buffered(0));
+	auto adv = sesame_adv("01:23:45:67:89:ab", Sesame::model_t::sesame_5, true);
+	for (size_t i = 0; i < LIBSESAME3BT_SCAN_QUEUE_SIZE + 5; i++) {
+		scan->deliver(adv);
+	}
+	TEST_ASSERT_EQUAL(5, scanner.get_dropped_count());
+	SesameInfo info;
+	TEST_ASSERT_TRUE(scanner.pop(info, 0));
+	scanner.stop();
+	size_t left = 0;
+	while (scanner.pop(info, 100)) {
+		left++;
+	}
+	TEST_ASSERT_EQUAL(LIBSESAME3BT_SCAN_QUEUE_SIZE - 1, left);
+}
+
+void
+test_subscribe_filters() {
+	using libsesame3bt::ScanFilter;
+	auto& scanner = SesameScanner::get();
+	auto* scan = NimBLEDevice::getScan();
+	int all = 0, locks = 0, by_uuid = 0, unregistered = 0, near = 0;
+	auto id_all = scanner.subscribe(ScanFilter{}, [&](auto&, auto&) { all++; });
+	auto id_locks = scanner.subscribe(ScanFilter{}.model(Sesame::model_t::sesame_5).model(Sesame::model_t::sesame_5_pro),
+	                                  [&](auto&, const SesameInfo& info) {
+		                                  TEST_ASSERT_TRUE(info.model == Sesame::model_t::sesame_5 || info.model == Sesame::model_t::sesame_5_pro);
+		                                  locks++;
+	                                  });
+	auto id_uuid =
+	    scanner.subscribe(ScanFilter{}.uuid(NimBLEUUID("0f1e2d3c-4b5a-6978-8796-a5b4c3d2e1aa")), [&](auto&, auto&) { by_uuid++; });
+	auto id_unreg = scanner.subscribe(ScanFilter{}.registered(false), [&](auto&, auto&) { unregistered++; });
+	auto id_near = scanner.subscribe(ScanFilter{}.model(Sesame::model_t::sesame_bot_2).rssi_floor(-50), [&](auto&, auto&) { near++; });
+	TEST_ASSERT_NOT_EQUAL(0, id_all);
+	TEST_ASSERT_NOT_EQUAL(0, id_locks);
+	TEST_ASSERT_NOT_EQUAL(0, id_uuid);
+	TEST_ASSERT_NOT_EQUAL(0, id_unreg);
+	TEST_ASSERT_NOT_EQUAL(0, id_near);
+
+	TEST_ASSERT_TRUE(scanner.scan_async(0, nullptr));
+	scan->deliver(sesame_adv("01:23:45:67:89:01", Sesame::model_t::sesame_5, true, -70));
+	scan->deliver(sesame_adv("01:23:45:67:89:02", Sesame::model_t::sesame_5_pro, true, -70, 0xaa));
+	scan->deliver(sesame_adv("01:23:45:67:89:03", Sesame::model_t::sesame_bot_2, false, -60));
+	scan->deliver(sesame_adv("01:23:45:67:89:04", Sesame::model_t::sesame_bot_2, true, -40));
+	scan->deliver(beacon_adv("11:22:33:44:55:66"));
+	TEST_ASSERT_EQUAL(4, all);
+	TEST_ASSERT_EQUAL(2, locks);
+	TEST_ASSERT_EQUAL(1, by_uuid);
+	TEST_ASSERT_EQUAL(1, unregistered);
+	TEST_ASSERT_EQUAL(1, near);
+
+	// subscriptions survive scan restart
+	scanner.stop();
+	TEST_ASSERT_TRUE(scanner.scan_async(0, nullptr));
+	TEST_ASSERT_TRUE(scanner.unsubscribe(id_all));
+	TEST_ASSERT_FALSE(scanner.unsubscribe(id_all));
+	scan->deliver(sesame_adv("01:23:45:67:89:01", Sesame::model_t::sesame_5, true, -70));
+	TEST_ASSERT_EQUAL(4, all);
+	TEST_ASSERT_EQUAL(3, locks);
+	scanner.stop();
+	for (auto id : {id_locks, id_uuid, id_unreg, id_near}) {
+		TEST_ASSERT_TRUE(scanner.unsubscribe(id));
+	}
+}
+
+void
+test_subscribe_limits() {
+	using libsesame3bt::ScanFilter;
+	auto& scanner = SesameScanner::get();
+	auto* scan = NimBLEDevice::getScan();
+	std::vector<uint32_t> ids;
+	int count = 0;
+	for (size_t i = 0; i < SesameScanner::MAX_SUBSCRIBERS; i++) {
+		ids.push_back(scanner.subscribe(ScanFilter{}, [&](auto&, auto&) { count++; }));
+		TEST_ASSERT_NOT_EQUAL(0, ids.back());
+	}
+	TEST_ASSERT_EQUAL(0, scanner.subscribe(ScanFilter{}, [&](auto&, auto&) {}));
+	for (auto id : ids) {
+		scanner.unsubscribe(id);
+	}
+	ScanFilter many;
+	for (int i = 0; i <= static_cast<int>(SesameScanner::MAX_FILTER_UUIDS); i++) {
+		uint8_t v[16]{};
+		v[0] = static_cast<uint8_t>(i);
+		many.uuid(NimBLEUUID{v, sizeof(v)});
+	}
+	TEST_ASSERT_EQUAL(0, scanner.subscribe(many, [](auto&, auto&) {}));
+	TEST_ASSERT_EQUAL(0, scanner.subscribe(ScanFilter{}.uuid(NimBLEUUID{uint16_t{0x1234}}), [](auto&, auto&) {}));
+
+	// unsubscribe from subscriber
+	uint32_t self = 0;
+	self = scanner.subscribe(ScanFilter{}, [&](SesameScanner& s, auto&) {
+		count++;
+		s.unsubscribe(self);
+	});
+	TEST_ASSERT_TRUE(scanner.scan_async(0, nullptr));
+	count = 0;
+	scan->deliver(sesame_adv("01:23:45:67:89:01", Sesame::model_t::sesame_5, true));
+	scan->deliver(sesame_adv("01:23:45:67:89:01", Sesame::model_t::sesame_5, true));
+	TEST_ASSERT_EQUAL(1, count);
+	scanner.stop();
+}
+
+static uint64_t fake_time_us;
+
+void
+test_ranked_candidates() {
+	using libsesame3bt::ScanFilter;
+	namespace sysclock = libsesame3bt::sysclock;
+	auto& scanner = SesameScanner::get();
+	auto* scan = NimBLEDevice::getScan();
+	sysclock::set_source([]() { return fake_time_us; });
+	scanner.clear_signals();
+	TEST_ASSERT_TRUE(scanner.scan_async(0, nullptr));
+	for (uint32_t t = 0; t < 1000; t += 100) {
+		fake_time_us = t * 1000;
+		scan->deliver(sesame_adv("01:00:00:00:00:0b", Sesame::model_t::sesame_5, true, -60, 0x0b));
+		scan->deliver(sesame_adv("01:00:00:00:00:0d", Sesame::model_t::sesame_5, true, -80, 0x0d));
+		if (t < 500) {
+			scan->deliver(sesame_adv("01:00:00:00:00:0c", Sesame::model_t::sesame_bot_2, true, -55, 0x0c));
+		}
+	}
+	scan->deliver(sesame_adv("01:00:00:00:00:0a", Sesame::model_t::sesame_5, true, -58, 0x0a));
+	scanner.stop();
+	fake_time_us = 950'000;
+
+	SesameScanner::Candidate candidates[8];
+	auto n = scanner.get_candidates(candidates, 8);
+	TEST_ASSERT_EQUAL(4, n);
+	// steady beats single strong advertisement, stale device is demoted
+	TEST_ASSERT_EQUAL_HEX8(0x0b, candidates[0].info.ble_address[0]);
+	TEST_ASSERT_EQUAL_HEX8(0x0a, candidates[1].info.ble_address[0]);
+	TEST_ASSERT_EQUAL_HEX8(0x0c, candidates[2].info.ble_address[0]);
+	TEST_ASSERT_EQUAL_HEX8(0x0d, candidates[3].info.ble_address[0]);
+	TEST_ASSERT_EQUAL(10, candidates[0].samples);
+	TEST_ASSERT_EQUAL(100, candidates[0].interval_ms);
+	TEST_ASSERT_EQUAL_FLOAT(-60.0f, candidates[0].rssi);
+	TEST_ASSERT_EQUAL_FLOAT(-60.0f, candidates[0].score);
+	TEST_ASSERT_EQUAL(0, candidates[1].interval_ms);
+	TEST_ASSERT_EQUAL_FLOAT(-64.0f, candidates[1].score);
+	TEST_ASSERT_EQUAL_FLOAT(-55.0f - 5 * 3, candidates[2].score);
+
+	TEST_ASSERT_EQUAL(2, scanner.get_candidates(candidates, 2));
+	TEST_ASSERT_EQUAL(3, scanner.get_candidates(candidates, 8, ScanFilter{}, 500));
+	TEST_ASSERT_EQUAL(1, scanner.get_candidates(candidates, 8, ScanFilter{}.model(Sesame::model_t::sesame_bot_2)));
+	TEST_ASSERT_EQUAL_HEX8(0x0c, candidates[0].info.ble_address[0]);
+	TEST_ASSERT_EQUAL(1, scanner.get_candidates(candidates, 8, ScanFilter{}.uuid(NimBLEUUID("0f1e2d3c-4b5a-6978-8796-a5b4c3d2e10d"))));
+	TEST_ASSERT_EQUAL_HEX8(0x0d, candidates[0].info.ble_address[0]);
+
+	// RSSI is smoothed
+	scanner.clear_signals();
+	TEST_ASSERT_TRUE(scanner.scan_async(0, nullptr));
+	scan->deliver(sesame_adv("01:00:00:00:00:0e", Sesame::model_t::sesame_5, true, -70, 0x0e));
+	fake_time_us += 200'000;
+	scan->deliver(sesame_adv("01:00:00:00:00:0e", Sesame::model_t::sesame_5, true, -50, 0x0e));
+	scanner.stop();
+	TEST_ASSERT_EQUAL(1, scanner.get_candidates(candidates, 8));
+	TEST_ASSERT_EQUAL_FLOAT(-65.0f, candidates[0].rssi);
+	TEST_ASSERT_EQUAL(-50, candidates[0].info.rssi);
+	TEST_ASSERT_EQUAL(200, candidates[0].interval_ms);
+	sysclock::set_source(nullptr);
+}
+
+void
+test_signal_table_eviction() {
+	libsesame3bt::SignalTracker tracker;
+	constexpr uint8_t uuid[16]{};
+	for (uint32_t i = 0; i < libsesame3bt::SignalTracker::TABLE_SIZE + 4; i++) {
+		const uint8_t raw[6] = {static_cast<uint8_t>(i), 0, 0, 0, 0, 0xc5};
+		tracker.update(SesameInfo{NimBLEAddress{raw, BLE_ADDR_RANDOM}, Sesame::model_t::sesame_5, std::byte{1}, uuid, -60, i * 10});
+	}
+	libsesame3bt::SignalTracker::Candidate out[libsesame3bt::SignalTracker::TABLE_SIZE + 4];
+	auto n = tracker.rank(out, std::size(out), 1000, 10'000);
+	TEST_ASSERT_EQUAL(libsesame3bt::SignalTracker::TABLE_SIZE, n);
+	for (size_t i = 0; i < n; i++) {
+		TEST_ASSERT_GREATER_OR_EQUAL(4, out[i].info.ble_address[0]);
+	}
+}
+
+void
+test_scan_through_executor() {
+	fake_nimble::add_advertisement(sesame_adv("01:23:45:67:89:ab", Sesame::model_t::sesame_5, true));
+	fake_nimble::add_advertisement(sesame_adv("01:23:45:67:89:ac", Sesame::model_t::sesame_bot, true));
+	auto& scanner = SesameScanner::get();
+	libsesame3bt::QueueExecutor exec;
+	scanner.set_executor(&exec);
+	std::vector<SesameInfo> results;
+	int subscribed = 0;
+	int end_count = 0;
+	auto id = scanner.subscribe(libsesame3bt::ScanFilter{}.model(Sesame::model_t::sesame_5), [&subscribed](auto&, auto&) { subscribed++; });
+	scanner.scan(1'000, [&](SesameScanner&, const SesameInfo* info) {
+		if (info) {
+			results.push_back(*info);
+		} else {
+			end_count++;
+		}
+	});
+	TEST_ASSERT_TRUE(results.empty());
+	TEST_ASSERT_EQUAL(0, subscribed);
+	TEST_ASSERT_EQUAL(3, exec.run_pending());
+	TEST_ASSERT_EQUAL(2, results.size());
+	TEST_ASSERT_EQUAL(1, subscribed);
+	TEST_ASSERT_EQUAL(1, end_count);
+	scanner.unsubscribe(id);
+	scanner.set_executor(nullptr);
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_scan_filters_sesame);
+	RUN_TEST(test_sesame_info_layout);
+	RUN_TEST(test_scan_async_stop);
+	RUN_TEST(test_is_sesame_payload);
+	RUN_TEST(test_scan_profile);
+	RUN_TEST(test_scan_buffered);
+	RUN_TEST(test_scan_buffered_overflow);
+	RUN_TEST(test_subscribe_filters);
+	RUN_TEST(test_subscribe_limits);
+	RUN_TEST(test_ranked_candidates);
+	RUN_TEST(test_signal_table_eviction);
+	RUN_TEST(test_scan_through_executor);
+	return UNITY_END();
+}
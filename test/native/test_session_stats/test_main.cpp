@@ -0,0 +1,118 @@
+#include <unity.h>
+#include <cstdint>
+#include "SessionStats.h"
+
+using libsesame3bt::FragmentCounter;
+using libsesame3bt::LatencyHistogram;
+using libsesame3bt::SessionStats;
+using libsesame3bt::SessionTiming;
+
+void
+setUp() {}
+
+void
+tearDown() {}
+
+void
+test_bucket_bounds() {
+	for (uint32_t v : {0u, 1u, 7u, 8u, 9u, 15u, 16u, 17u, 1000u, 65'535u, 1'000'000u, UINT32_MAX}) {
+		auto b = LatencyHistogram::bucket_of(v);
+		TEST_ASSERT_LESS_THAN(LatencyHistogram::BUCKETS, b);
+		TEST_ASSERT_LESS_OR_EQUAL(v, LatencyHistogram::lower_bound(b));
+		TEST_ASSERT_GREATER_THAN(v - LatencyHistogram::lower_bound(b), LatencyHistogram::width(b));
+		// relative error within 1/8
+		TEST_ASSERT_LESS_OR_EQUAL(LatencyHistogram::lower_bound(b) / 8 + 1, LatencyHistogram::width(b));
+	}
+	TEST_ASSERT_EQUAL(LatencyHistogram::BUCKETS - 1, LatencyHistogram::bucket_of(UINT32_MAX));
+}
+
+void
+test_percentiles() {
+	LatencyHistogram h;
+	TEST_ASSERT_EQUAL(0, h.percentile(50));
+	TEST_ASSERT_EQUAL(0, h.min());
+	for (uint32_t i = 1; i <= 1000; i++) {
+		h.add(i * 1000);
+	}
+	TEST_ASSERT_EQUAL(1000, h.count());
+	TEST_ASSERT_UINT32_WITHIN(1000 / 8, 1000, h.min());
+	TEST_ASSERT_UINT32_WITHIN(1'000'000 / 8, 1'000'000, h.max());
+	TEST_ASSERT_UINT32_WITHIN(500'000 / 8, 500'000, h.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(990'000 / 8, 990'000, h.percentile(99));
+	h.clear();
+	TEST_ASSERT_EQUAL(0, h.count());
+}
+
+void
+test_rolling_decay() {
+	LatencyHistogram h;
+	for (uint32_t i = 0; i < LatencyHistogram::DECAY_AT; i++) {
+		h.add(100);
+	}
+	// recent samples dominate after a few decays
+	for (uint32_t i = 0; i < LatencyHistogram::DECAY_AT * 4; i++) {
+		h.add(10'000);
+	}
+	TEST_ASSERT_LESS_OR_EQUAL(LatencyHistogram::DECAY_AT, h.count());
+	TEST_ASSERT_UINT32_WITHIN(10'000 / 8, 10'000, h.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(10'000 / 8, 10'000, h.percentile(1));
+}
+
+void
+test_session_stats_record() {
+	SessionStats stats;
+	stats.record(SessionTiming{0, 20'000, 60'000, 80'000, 81'000, 300'000, 350'000, 0});
+	// connect failure: nothing but the connect phase is missing
+	stats.record(SessionTiming{0, 0, 0, 0, 0, 0, 0, 0});
+	TEST_ASSERT_EQUAL(2, stats.get_session_count());
+	TEST_ASSERT_EQUAL(1, stats.connect.count());
+	TEST_ASSERT_UINT32_WITHIN(40'000 / 8, 40'000, stats.discovery.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(20'000 / 8, 20'000, stats.subscribe.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(220'000 / 8, 220'000, stats.authenticate.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(50'000 / 8, 50'000, stats.first_status.percentile(50));
+	TEST_ASSERT_UINT32_WITHIN(300'000 / 8, 300'000, stats.setup.percentile(50));
+	stats.clear();
+	TEST_ASSERT_EQUAL(0, stats.get_session_count());
+	TEST_ASSERT_EQUAL(0, stats.setup.count());
+}
+
+void
+test_fragment_counter() {
+	// header: bit 0 start of message, bits 1-2 end of message (plain / encrypted)
+	static const uint8_t single[] = {0x05, 0x01, 0x02};
+	static const uint8_t first[20] = {0x01};
+	static const uint8_t middle[20] = {0x00};
+	static const uint8_t last[8] = {0x04};
+	FragmentCounter c;
+	TEST_ASSERT_EQUAL_FLOAT(0.0f, c.per_message());
+	c.add(single, sizeof(single));
+	c.add(first, sizeof(first));
+	c.add(middle, sizeof(middle));
+	c.add(middle, sizeof(middle));
+	c.add(last, sizeof(last));
+	TEST_ASSERT_EQUAL(2, c.messages());
+	TEST_ASSERT_EQUAL(5, c.fragments());
+	TEST_ASSERT_EQUAL(4, c.max_fragments());
+	TEST_ASSERT_EQUAL(20, c.max_size());
+	TEST_ASSERT_EQUAL_FLOAT(2.5f, c.per_message());
+
+	// incomplete message is not averaged, a new start discards it
+	c.add(first, sizeof(first));
+	TEST_ASSERT_EQUAL_FLOAT(2.5f, c.per_message());
+	c.add(single, sizeof(single));
+	TEST_ASSERT_EQUAL(3, c.messages());
+	TEST_ASSERT_EQUAL(4, c.max_fragments());
+	c.clear();
+	TEST_ASSERT_EQUAL(0, c.fragments());
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_bucket_bounds);
+	RUN_TEST(test_percentiles);
+	RUN_TEST(test_rolling_decay);
+	RUN_TEST(test_session_stats_record);
+	RUN_TEST(test_fragment_counter);
+	return UNITY_END();
+}
@@ -0,0 +1,103 @@
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "SpscRing.h"
+
+using libsesame3bt::SpscRing;
+
+struct Item {
+	uint32_t seq;
+	uint32_t check;
+};
+
+void
+setUp() {}
+
+void
+tearDown() {}
+
+void
+test_push_pop() {
+	SpscRing<Item, 4> ring;
+	Item item;
+	TEST_ASSERT_TRUE(ring.empty());
+	TEST_ASSERT_FALSE(ring.pop(item));
+	for (uint32_t i = 0; i < 4; i++) {
+		TEST_ASSERT_TRUE(ring.push({i, ~i}));
+	}
+	TEST_ASSERT_EQUAL(4, ring.size());
+	TEST_ASSERT_FALSE(ring.push({4, ~4u}));
+	TEST_ASSERT_EQUAL(1, ring.dropped());
+	for (uint32_t i = 0; i < 4; i++) {
+		TEST_ASSERT_TRUE(ring.pop(item));
+		TEST_ASSERT_EQUAL(i, item.seq);
+	}
+	TEST_ASSERT_FALSE(ring.pop(item));
+	TEST_ASSERT_EQUAL(1, ring.reset_dropped());
+	TEST_ASSERT_EQUAL(0, ring.dropped());
+}
+
+void
+test_wrap_around() {
+	SpscRing<Item, 8> ring;
+	Item item;
+	for (uint32_t i = 0; i < 1000; i++) {
+		TEST_ASSERT_TRUE(ring.push({i, ~i}));
+		TEST_ASSERT_TRUE(ring.push({i, ~i}));
+		TEST_ASSERT_TRUE(ring.pop(item));
+		TEST_ASSERT_TRUE(ring.pop(item));
+		TEST_ASSERT_EQUAL(i, item.seq);
+	}
+	ring.push({0, 0});
+	ring.clear();
+	TEST_ASSERT_TRUE(ring.empty());
+}
+
+void
+test_two_threads() {
+	constexpr uint32_t COUNT = 2'000'000;
+	static SpscRing<Item, 64> ring;
+	std::atomic<bool> done{false};
+	uint32_t pushed = 0;
+	std::thread producer{[&]() {
+		for (uint32_t i = 0; i < COUNT; i++) {
+			if (ring.push({i, ~i})) {
+				pushed++;
+			}
+		}
+		done = true;
+	}};
+	uint32_t received = 0;
+	uint32_t last = 0;
+	bool ordered = true;
+	bool intact = true;
+	Item item;
+	for (;;) {
+		if (ring.pop(item)) {
+			if (received > 0 && item.seq <= last) {
+				ordered = false;
+			}
+			if (item.check != ~item.seq) {
+				intact = false;
+			}
+			last = item.seq;
+			received++;
+		} else if (done && ring.empty()) {
+			break;
+		}
+	}
+	producer.join();
+	TEST_ASSERT_TRUE(ordered);
+	TEST_ASSERT_TRUE(intact);
+	TEST_ASSERT_EQUAL(pushed, received);
+	TEST_ASSERT_EQUAL(COUNT, received + ring.dropped());
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_push_pop);
+	RUN_TEST(test_wrap_around);
+	RUN_TEST(test_two_threads);
+	return UNITY_END();
+}
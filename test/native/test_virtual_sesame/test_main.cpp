@@ -0,0 +1,297 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <vector>
+#include <virtual_sesame.h>
+#include "SesameClient.h"
+#include "clock.h"
+
+using fake_nimble::VirtualSesame;
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameClient;
+using result_t = SesameClient::operation_result_t;
+
+// connect -> authenticate -> lock -> status against SesameServerCore over the fake GATT link
+
+static const NimBLEAddress sesame_address{"01:23:45:67:89:ab", BLE_ADDR_RANDOM};
+static constexpr const char* SESAME_SECRET = "00112233445566778899aabbccddeeff";
+
+static void
+drive(SesameClient& client, uint64_t until_us) {
+	while (fake_nimble::now_us() < until_us && client.is_operating()) {
+		fake_nimble::run(fake_nimble::now_us() + 1'000);
+		client.loop();
+	}
+}
+
+/** Run one operate_async() session to the end */
+static SesameClient::OperationReport
+operate(SesameClient& client, const SesameClient::Command& cmd) {
+	SesameClient::OperationReport report{};
+	report.result = result_t::timeout;
+	TEST_ASSERT_TRUE(client.operate_async(cmd, [&report](auto&, const auto& r) { report = r; }, 5'000));
+	drive(client, fake_nimble::now_us() + 10'000'000);
+	TEST_ASSERT_FALSE(client.is_operating());
+	fake_nimble::run();
+	return report;
+}
+
+static void
+init_client(SesameClient& client) {
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", SESAME_SECRET));
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	NimBLEDevice::init("");
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+}
+
+void
+tearDown() {
+	libsesame3bt::sysclock::set_source(nullptr);
+	NimBLEDevice::deinit(true);
+	fake_nimble::reset();
+}
+
+void
+test_lossy_link_keeps_order() {
+	auto& p = fake_nimble::add_peripheral(sesame_address);
+	p.add_service(NimBLEUUID(Sesame::SESAME3_SRV_UUID), {{NimBLEUUID(Sesame::TxUUID), 0x10}, {NimBLEUUID(Sesame::RxUUID), 0x12}});
+	p.hop_latency_us = 1'000;
+	p.loss_per_mille = 300;
+	size_t subscribed = 0;
+	size_t closed = 0;
+	p.on_subscribe = [&subscribed](auto&) { subscribed++; };
+	p.on_disconnect = [&closed](auto&) { closed++; };
+	auto* c = NimBLEDevice::createClient();
+	TEST_ASSERT_TRUE(c->connect(sesame_address));
+	auto* rx = c->getService(NimBLEUUID(Sesame::SESAME3_SRV_UUID))->getCharacteristic(NimBLEUUID(Sesame::RxUUID));
+	std::vector<uint8_t> received;
+	TEST_ASSERT_TRUE(rx->subscribe(true, [&received](auto*, uint8_t* data, size_t, bool) { received.push_back(data[0]); }));
+	TEST_ASSERT_EQUAL(1, subscribed);
+	for (uint8_t i = 0; i < 100; i++) {
+		TEST_ASSERT_TRUE(p.notify(NimBLEUUID(Sesame::RxUUID), &i, 1));
+	}
+	fake_nimble::run();
+	TEST_ASSERT_GREATER_THAN(0, p.retransmissions);
+	TEST_ASSERT_EQUAL(100, received.size());
+	for (size_t i = 0; i < received.size(); i++) {
+		TEST_ASSERT_EQUAL(i, received[i]);
+	}
+	TEST_ASSERT_TRUE(c->disconnect());
+	TEST_ASSERT_EQUAL(1, closed);
+	NimBLEDevice::deleteClient(c);
+}
+
+void
+test_lock_round_trip() {
+	VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 2'000;
+	sesame.motor_us = 300'000;
+	SesameClient client;
+	init_client(client);
+	std::vector<bool> in_lock;
+	client.set_status_callback([&in_lock](auto&, auto status) { in_lock.push_back(status.in_lock()); });
+
+	auto report = operate(client, SesameClient::Command::lock("e2e"));
+	TEST_ASSERT_EQUAL(result_t::success, report.result);
+	TEST_ASSERT_TRUE(sesame.locked);
+	TEST_ASSERT_EQUAL(1, sesame.commands);
+	TEST_ASSERT_GREATER_THAN(0, report.connect_ms);
+	TEST_ASSERT_GREATER_THAN(0, report.authenticate_ms);
+	TEST_ASSERT_GREATER_OR_EQUAL(300, report.confirm_ms);
+	TEST_ASSERT_FALSE(in_lock.empty());
+	TEST_ASSERT_TRUE(in_lock.back());
+	TEST_ASSERT_NULL(sesame.peripheral.client);
+
+	report = operate(client, SesameClient::Command::unlock("e2e"));
+	TEST_ASSERT_EQUAL(result_t::success, report.result);
+	TEST_ASSERT_FALSE(sesame.locked);
+	TEST_ASSERT_FALSE(in_lock.back());
+	TEST_ASSERT_EQUAL(2, sesame.peripheral.connects);
+}
+
+void
+test_fragmented_notifications() {
+	VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.fragment_size = 3;
+	SesameClient client;
+	init_client(client);
+	auto report = operate(client, SesameClient::Command::lock("frag"));
+	TEST_ASSERT_EQUAL(result_t::success, report.result);
+	// every message is split, the client reassembles them
+	TEST_ASSERT_GREATER_THAN(client.get_rx_fragments().messages(), sesame.notifications);
+}
+
+void
+test_lossy_connection_events() {
+	VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 500;
+	sesame.peripheral.connection_events = true;
+	sesame.peripheral.loss_per_mille = 100;
+	SesameClient client;
+	init_client(client);
+	for (int i = 0; i < 20; i++) {
+		auto report = operate(client, i % 2 ? SesameClient::Command::unlock("loss") : SesameClient::Command::lock("loss"));
+		TEST_ASSERT_EQUAL(result_t::success, report.result);
+	}
+	TEST_ASSERT_EQUAL(20, sesame.commands);
+	TEST_ASSERT_GREATER_THAN(0, sesame.peripheral.retransmissions);
+}
+
+void
+test_many_sessions() {
+	VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 3'000;
+	SesameClient client;
+	init_client(client);
+	// session throughput is measured by native_bench/test_hot_paths
+	constexpr int SESSIONS = 20;
+	for (int i = 0; i < SESSIONS; i++) {
+		auto report = operate(client, SesameClient::Command::lock("many"));
+		TEST_ASSERT_EQUAL(result_t::success, report.result);
+	}
+	TEST_ASSERT_EQUAL(SESSIONS, sesame.commands);
+	TEST_ASSERT_EQUAL(SESSIONS, sesame.peripheral.connects);
+}
+
+void
+test_status_filter_session() {
+	VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 1'000;
+	SesameClient client;
+	init_client(client);
+	SesameClient::StatusFilter filter;
+	// VirtualSesame publishes the position as the target too
+	filter.fields = SesameClient::StatusFilter::ALL & ~SesameClient::StatusFilter::TARGET;
+	filter.position_hysteresis = 10;
+	filter.min_interval_ms = 1'000;
+	client.set_status_filter(filter);
+	std::vector<int16_t> positions;
+	client.set_status_callback([&positions](auto&, auto status) { positions.push_back(status.position()); });
+	auto step = [&client](uint32_t ms) {
+		auto until = fake_nimble::now_us() + ms * 1'000;
+		while (fake_nimble::now_us() < until) {
+			fake_nimble::run(fake_nimble::now_us() + 1'000);
+			client.loop();
+		}
+	};
+	auto session = [&]() {
+		TEST_ASSERT_TRUE(client.connect_async());
+		step(100);
+		TEST_ASSERT_TRUE(client.get_state() == SesameClient::state_t::connected);
+		TEST_ASSERT_TRUE(client.start_authenticate());
+		step(100);
+		TEST_ASSERT_TRUE(client.get_state() == SesameClient::state_t::active);
+		positions.clear();
+		// the first status of the session is delivered even if it repeats the last one
+		TEST_ASSERT_TRUE(sesame.publish_status());
+		step(50);
+		TEST_ASSERT_EQUAL(1, positions.size());
+		TEST_ASSERT_EQUAL(sesame.unlock_position, positions.back());
+	};
+
+	session();
+	auto suppressed = client.get_suppressed_status_count();
+	TEST_ASSERT_TRUE(sesame.publish_status());
+	step(50);
+	TEST_ASSERT_EQUAL(1, positions.size());
+	TEST_ASSERT_EQUAL(suppressed + 1, client.get_suppressed_status_count());
+
+	// within the hysteresis: never delivered
+	sesame.unlock_position += 10;
+	TEST_ASSERT_TRUE(sesame.publish_status());
+	step(2'000);
+	TEST_ASSERT_EQUAL(1, positions.size());
+
+	// beyond the hysteresis after the interval: delivered at once
+	sesame.unlock_position += 10;
+	TEST_ASSERT_TRUE(sesame.publish_status());
+	step(50);
+	TEST_ASSERT_EQUAL(2, positions.size());
+	TEST_ASSERT_EQUAL(sesame.unlock_position, positions.back());
+
+	// within the interval: the last suppressed change is delivered by loop() once the interval has passed
+	sesame.unlock_position += 20;
+	TEST_ASSERT_TRUE(sesame.publish_status());
+	step(50);
+	sesame.unlock_position += 20;
+	TEST_ASSERT_TRUE(sesame.publish_status());
+	step(500);
+	TEST_ASSERT_EQUAL(2, positions.size());
+	step(500);
+	TEST_ASSERT_EQUAL(3, positions.size());
+	TEST_ASSERT_EQUAL(sesame.unlock_position, positions.back());
+	step(2'000);
+	TEST_ASSERT_EQUAL(3, positions.size());
+
+	client.disconnect();
+	step(50);
+	session();
+}
+
+void
+test_connect_failure_classes() {
+	using libsesame3bt::RetryPolicy;
+	VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 1'000;
+	SesameClient client;
+	init_client(client);
+	client.set_retry_policy({4, 20, 100, 2, 0, 0});
+
+	// a timeout is retried, the session completes once the device answers
+	constexpr int TIMEOUT = BLE_HS_ETIMEOUT;
+	TEST_ASSERT_TRUE(RetryPolicy::classify(TIMEOUT) == RetryPolicy::reason_class_t::retryable);
+	sesame.peripheral.connect_error = TIMEOUT;
+	SesameClient::OperationReport report{};
+	report.result = result_t::timeout;
+	TEST_ASSERT_TRUE(client.operate_async(SesameClient::Command::lock("retry"), [&report](auto&, const auto& r) { report = r; }, 5'000));
+	while (client.is_operating()) {
+		fake_nimble::run(fake_nimble::now_us() + 1'000);
+		if (client.get_connect_failures().total() == 2) {
+			sesame.peripheral.connect_error = 0;
+		}
+		client.loop();
+	}
+	fake_nimble::run();
+	TEST_ASSERT_EQUAL(result_t::success, report.result);
+	const auto& failures = client.get_connect_failures();
+	TEST_ASSERT_EQUAL(2, failures.count(TIMEOUT));
+	TEST_ASSERT_EQUAL(2, failures.retries());
+	TEST_ASSERT_EQUAL(0, failures.fatal());
+	TEST_ASSERT_EQUAL(1, sesame.commands);
+
+	// an authentication failure is not retried
+	client.clear_connect_failures();
+	constexpr int AUTH_FAIL = BLE_HS_ERR_HCI_BASE + BLE_ERR_AUTH_FAIL;
+	TEST_ASSERT_TRUE(RetryPolicy::classify(AUTH_FAIL) == RetryPolicy::reason_class_t::fatal);
+	sesame.peripheral.connect_error = AUTH_FAIL;
+	report = operate(client, SesameClient::Command::unlock("retry"));
+	TEST_ASSERT_EQUAL(result_t::connect_failed, report.result);
+	TEST_ASSERT_EQUAL(1, failures.total());
+	TEST_ASSERT_EQUAL(1, failures.count(AUTH_FAIL));
+	TEST_ASSERT_EQUAL(1, failures.fatal());
+	TEST_ASSERT_EQUAL(0, failures.retries());
+	TEST_ASSERT_EQUAL(1, sesame.commands);
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_lossy_link_keeps_order);
+	RUN_TEST(test_lock_round_trip);
+	RUN_TEST(test_fragmented_notifications);
+	RUN_TEST(test_lossy_connection_events);
+	RUN_TEST(test_many_sessions);
+	RUN_TEST(test_status_filter_session);
+	RUN_TEST(test_connect_failure_classes);
+	return UNITY_END();
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <NimBLEDevice.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+/**
+ * Helpers shared by the host benchmarks.
+ *
+ * Include from exactly one translation unit per benchmark program: it replaces the global operator new to count heap
+ * allocations of the whole program.
+ */
+
+namespace bench {
+
+inline size_t allocations = 0;
+
+/** keep `value` alive for the optimizer */
+template <typename T>
+inline void
+keep(const T& value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result {
+	double ns_per_op;
+	double allocs_per_op;
+};
+
+constexpr int TRIALS = 5;
+constexpr auto TRIAL_MS = std::chrono::milliseconds(200);
+
+/**
+ * @brief Measure `round`, which executes `ops` operations per call
+ * @details Prints the median of TRIALS runs of at least TRIAL_MS, after one warm-up run.
+ */
+template <typename F>
+Result
+measure(const char* label, size_t ops, F&& round) {
+	using clock = std::chrono::steady_clock;
+	std::vector<double> ns;
+	double allocs = 0;
+	for (int trial = -1; trial < TRIALS; trial++) {
+		size_t rounds = 0;
+		auto alloc_start = allocations;
+		auto start = clock::now();
+		auto elapsed = clock::duration{};
+		do {
+			round();
+			rounds++;
+			elapsed = clock::now() - start;
+		} while (elapsed < TRIAL_MS);
+		if (trial < 0) {
+			continue;  // warm-up
+		}
+		ns.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / (rounds * ops));
+		allocs = static_cast<double>(allocations - alloc_start) / (rounds * ops);
+	}
+	std::sort(ns.begin(), ns.end());
+	Result r{ns[TRIALS / 2], allocs};
+	std::printf("%-44s %10.1f ns/op (min %8.1f, max %8.1f) %6.2f allocs/op\n", label, r.ns_per_op, ns.front(), ns.back(),
+	            r.allocs_per_op);
+	return r;
+}
+
+/**
+ * @brief Advertisement mix of a crowded place
+ * @param count number of packets
+ * @param sesame_every one SESAME 5 in this many packets, the others are beacons, sensors and phones
+ */
+inline std::vector<NimBLEAdvertisedDevice>
+make_advertisements(uint8_t count, uint8_t sesame_every) {
+	std::vector<NimBLEAdvertisedDevice> advs;
+	for (uint8_t i = 0; i < count; i++) {
+		const uint8_t raw_addr[6] = {i, 0x11, 0x22, 0x33, 0x44, 0xc5};
+		NimBLEAddress addr{raw_addr, BLE_ADDR_RANDOM};
+		if (i % sesame_every == sesame_every - 1) {  // SESAME 5
+			std::vector<uint8_t> p{0x02, 0x01, 0x06, 0x03, 0x03, 0x81, 0xfd, 0x16, 0xff, 0x5a, 0x05, 0x05, 0x00, 0x01};
+			for (uint8_t b = 0; b < 16; b++) {
+				p.push_back(i + b);
+			}
+			advs.emplace_back(addr, -55, p);
+			continue;
+		}
+		switch (i % 4) {
+			case 0:  // iBeacon
+				advs.emplace_back(addr, -70,
+				                  std::vector<uint8_t>{0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+				                                       0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x00, 0x01, 0x00, i, 0xc5});
+				break;
+			case 1:  // Eddystone URL
+				advs.emplace_back(addr, -80,
+				                  std::vector<uint8_t>{0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x0e, 0x16, 0xaa, 0xfe, 0x10, 0xeb, 0x03, 'e',
+				                                       'x', 'a', 'm', 'p', 'l', 'e', 0x07});
+				break;
+			case 2:  // named sensor with several services
+				advs.emplace_back(addr, -65,
+				                  std::vector<uint8_t>{0x02, 0x01, 0x06, 0x07, 0x03, 0x0f, 0x18, 0x0a, 0x18, 0x1a, 0x18, 0x08, 0x09, 'S', 'e', 'n',
+				                                       's', 'o', 'r', '1', 0x05, 0xff, 0x59, 0x00, 0x01, i});
+				break;
+			default:  // phone
+				advs.emplace_back(addr, -75, std::vector<uint8_t>{0x02, 0x01, 0x1a, 0x0a, 0xff, 0x4c, 0x00, 0x10, 0x05, 0x01, 0x18, 0x4e, 0x3e, i});
+				break;
+		}
+	}
+	return advs;
+}
+
+}  // namespace bench
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void*
+operator new(size_t size) {
+	bench::allocations++;
+	if (void* p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void
+operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
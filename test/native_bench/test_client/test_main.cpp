@@ -0,0 +1,194 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include "SesameClient.h"
+#include "SessionStats.h"
+#include "bench.h"
+#include "clock.h"
+
+using libsesame3bt::LatencyHistogram;
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameClient;
+using Params = SesameClient::ConnectionParams;
+
+// Command-to-status latency in virtual time: the simulated SESAME answers every write on TX with a notification on RX
+// after `PROCESSING_US`, both directions wait for connection events of the negotiated interval.
+
+using bench::allocations;
+
+static const NimBLEAddress sesame_address{"01:23:45:67:89:ab", BLE_ADDR_RANDOM};
+static constexpr uint32_t HOP_US = 400;
+static constexpr uint32_t PROCESSING_US = 2'000;
+static constexpr int COMMANDS = 500;
+
+static fake_nimble::Peripheral&
+add_sesame() {
+	auto& p = fake_nimble::add_peripheral(sesame_address);
+	p.add_service(NimBLEUUID(Sesame::SESAME3_SRV_UUID), {{NimBLEUUID(Sesame::TxUUID), 0x10}, {NimBLEUUID(Sesame::RxUUID), 0x12}});
+	p.hop_latency_us = HOP_US;
+	p.connection_events = true;
+	p.on_write = [](fake_nimble::Peripheral& peer, const NimBLEUUID&, const uint8_t*, size_t) {
+		fake_nimble::post(
+		    [&peer]() {
+			    static const uint8_t status[] = {0x08, 0x51, 0x00};
+			    peer.notify(NimBLEUUID(Sesame::RxUUID), status, sizeof(status));
+		    },
+		    PROCESSING_US);
+	};
+	return p;
+}
+
+void
+setUp() {
+	fake_nimble::reset();
+	NimBLEDevice::init("");
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+}
+
+void
+tearDown() {
+	NimBLEDevice::deinit(true);
+	libsesame3bt::sysclock::set_source(nullptr);
+}
+
+/**
+ * Send commands at pseudo random times and record the time until the response notification.
+ */
+static void
+measure_commands(SesameClient& client, LatencyHistogram& hist) {
+	auto* blec = client.get_ble_client();
+	auto* tx = blec->find_characteristic(NimBLEUUID(Sesame::TxUUID));
+	auto* rx = blec->find_characteristic(NimBLEUUID(Sesame::RxUUID));
+	TEST_ASSERT_NOT_NULL(tx);
+	TEST_ASSERT_NOT_NULL(rx);
+	uint64_t received_at = 0;
+	rx->subscribe(true, [&received_at](NimBLERemoteCharacteristic*, uint8_t*, size_t, bool) { received_at = fake_nimble::now_us(); },
+	              false);
+	uint32_t seed = 12345;
+	for (int i = 0; i < COMMANDS; i++) {
+		seed = seed * 1'103'515'245 + 12'345;
+		fake_nimble::run(fake_nimble::now_us() + 50'000 + (seed >> 8) % 1'000'000);
+		static const uint8_t command[] = {0x05, 0x52};
+		auto sent_at = fake_nimble::now_us();
+		received_at = 0;
+		TEST_ASSERT_TRUE(tx->writeValue(command, sizeof(command), false));
+		fake_nimble::run();
+		TEST_ASSERT_NOT_EQUAL(0, received_at);
+		hist.add(static_cast<uint32_t>(received_at - sent_at));
+	}
+}
+
+static void
+bench_params(const char* label, const Params& params, uint32_t& p50_us) {
+	add_sesame();
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", "00112233445566778899aabbccddeeff"));
+	TEST_ASSERT_TRUE(client.set_connection_params(params));
+	TEST_ASSERT_TRUE(client.connect());
+	uint32_t setup_us = client.get_session_timing().subscribed_us;
+	LatencyHistogram hist;
+	measure_commands(client, hist);
+	std::printf("%-34s setup %7.1f ms  command-to-status p50 %7.1f ms  p99 %7.1f ms  max %7.1f ms\n", label, setup_us / 1000.0,
+	            hist.percentile(50) / 1000.0, hist.percentile(99) / 1000.0, hist.max() / 1000.0);
+	client.disconnect();
+	p50_us = hist.percentile(50);
+}
+
+void
+bench_connection_params() {
+	uint32_t fast, balanced, relaxed;
+	bench_params("fast (7.5-15ms)", Params::fast(), fast);
+	bench_params("balanced (30-50ms)", Params::balanced(), balanced);
+	bench_params("relaxed (100-200ms, latency 4)", Params::relaxed(), relaxed);
+	TEST_ASSERT_LESS_THAN(balanced, fast);
+	TEST_ASSERT_LESS_THAN(relaxed, balanced);
+}
+
+void
+bench_mid_session_update() {
+	add_sesame();
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", "00112233445566778899aabbccddeeff"));
+	TEST_ASSERT_TRUE(client.set_connection_params(Params::relaxed()));
+	TEST_ASSERT_TRUE(client.connect());
+	LatencyHistogram idle, updated;
+	measure_commands(client, idle);
+	// switch to the short interval before sending commands
+	TEST_ASSERT_TRUE(client.set_connection_params(Params::fast()));
+	measure_commands(client, updated);
+	std::printf("%-34s p50 %7.1f ms -> %7.1f ms\n", "update relaxed -> fast", idle.percentile(50) / 1000.0,
+	            updated.percentile(50) / 1000.0);
+	TEST_ASSERT_LESS_THAN(idle.percentile(50), updated.percentile(50));
+	client.disconnect();
+}
+
+template <typename F>
+static double
+measure_calls(const char* label, F&& call) {
+	using clock = std::chrono::steady_clock;
+	constexpr size_t BATCH = 10'000;
+	size_t calls = 0;
+	auto start = clock::now();
+	auto elapsed = clock::duration{};
+	do {
+		for (size_t i = 0; i < BATCH; i++) {
+			call();
+		}
+		calls += BATCH;
+		elapsed = clock::now() - start;
+	} while (elapsed < std::chrono::milliseconds(300));
+	double ns = std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+	std::printf("%-34s %8.2f ns/call\n", label, ns);
+	return ns;
+}
+
+struct Context {
+	uint64_t count;
+	char name[32];
+	void* owner;
+};
+
+struct CountingListener : SesameClient::Listener {
+	Context ctx{};
+	void on_state(SesameClient&, SesameClient::state_t) override { ctx.count++; }
+};
+
+// State change dispatch before the Listener interface: the core calls a std::function which calls the
+// application's std::function member, against one virtual call now.
+void
+bench_listener_dispatch() {
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	std::printf("sizeof(SesameClient) %zu (callbacks %zu more when set_*_callback() is used)\n", sizeof(SesameClient),
+	            4 * sizeof(std::function<void()>));
+
+	Context ctx{};
+	auto before = allocations;
+	client.set_state_callback([ctx](auto&, auto) mutable { ctx.count++; });
+	std::printf("%-34s %zu allocations\n", "set_state_callback(40 byte capture)", allocations - before);
+	CountingListener listener;
+	before = allocations;
+	client.set_listener(&listener);
+	std::printf("%-34s %zu allocations\n", "set_listener()", allocations - before);
+	TEST_ASSERT_EQUAL(0, allocations - before);
+
+	std::function<void(SesameClient&, SesameClient::state_t)> app_callback = [ctx](auto&, auto) mutable { ctx.count++; };
+	std::function<void(SesameClient::state_t)> core_callback = [&client, &app_callback](auto state) { app_callback(client, state); };
+	SesameClient::Listener* volatile target = &listener;
+	measure_calls("std::function -> std::function", [&core_callback]() { core_callback(SesameClient::state_t::active); });
+	measure_calls("Listener::on_state()", [&client, &target]() { target->on_state(client, SesameClient::state_t::active); });
+	TEST_ASSERT_NOT_EQUAL(0, listener.ctx.count);
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(bench_connection_params);
+	RUN_TEST(bench_mid_session_update);
+	RUN_TEST(bench_listener_dispatch);
+	return UNITY_END();
+}
@@ -0,0 +1,221 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include <cstdio>
+#include <iterator>
+#include <virtual_sesame.h>
+#include "SesameClient.h"
+#include "SesameScanner.h"
+#include "Transport.h"
+#include "bench.h"
+#include "clock.h"
+
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameClient;
+using libsesame3bt::SesameInfo;
+using libsesame3bt::SesameScanner;
+
+// ns/op and allocations/op of the paths run for every packet, notification or command.
+
+using bench::keep;
+using bench::measure;
+
+static const NimBLEAddress sesame_address{"01:23:45:67:89:ab", BLE_ADDR_RANDOM};
+static constexpr const char* SESAME_SECRET = "00112233445566778899aabbccddeeff";
+
+void
+setUp() {
+	fake_nimble::reset();
+	NimBLEDevice::init("");
+}
+
+void
+tearDown() {
+	NimBLEDevice::deinit(true);
+}
+
+void
+bench_scanner_on_result() {
+	auto advs = bench::make_advertisements(64, 8);
+	size_t found = 0;
+	auto& scanner = SesameScanner::get();
+	TEST_ASSERT_TRUE(scanner.scan_async(0, [&found](SesameScanner&, const SesameInfo* info) {
+		if (info) {
+			found++;
+		}
+	}));
+	auto* scan = NimBLEDevice::getScan();
+	measure("SesameScanner::onResult (1/8 SESAME)", advs.size(), [&]() {
+		for (const auto& adv : advs) {
+			scan->deliver(adv);
+		}
+	});
+	auto id = scanner.subscribe(libsesame3bt::ScanFilter{}.model(Sesame::model_t::sesame_5), [&found](auto&, auto&) { found++; });
+	measure("SesameScanner::onResult + subscriber", advs.size(), [&]() {
+		for (const auto& adv : advs) {
+			scan->deliver(adv);
+		}
+	});
+	scanner.stop();
+
+	// results queued to the preallocated slots of the executor
+	libsesame3bt::QueueExecutor exec{64};
+	scanner.set_executor(&exec);
+	TEST_ASSERT_TRUE(scanner.scan_async(0, [&found](SesameScanner&, const SesameInfo* info) {
+		if (info) {
+			found++;
+		}
+	}));
+	measure("SesameScanner::onResult + QueueExecutor", advs.size(), [&]() {
+		for (const auto& adv : advs) {
+			scan->deliver(adv);
+		}
+		exec.run_pending();
+	});
+	scanner.unsubscribe(id);
+	scanner.stop();
+	exec.run_pending();
+	scanner.set_executor(nullptr);
+	TEST_ASSERT_GREATER_THAN(0, found);
+}
+
+void
+bench_client_notification() {
+	auto& p = fake_nimble::add_peripheral(sesame_address);
+	p.add_service(NimBLEUUID(Sesame::SESAME3_SRV_UUID), {{NimBLEUUID(Sesame::TxUUID), 0x10}, {NimBLEUUID(Sesame::RxUUID), 0x12}});
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", SESAME_SECRET));
+	TEST_ASSERT_TRUE(client.connect());
+	auto* rx = client.get_ble_client()->find_characteristic(NimBLEUUID(Sesame::RxUUID));
+	TEST_ASSERT_NOT_NULL(rx);
+
+	// plaintext single fragment: publish / initial with 4 bytes token, as sent by SESAME 5 after connection
+	uint8_t initial[] = {0x03, 0x08, 0x0e, 0x01, 0x02, 0x03, 0x04};
+	measure("notification -> core (rx->subscribe lambda)", 1, [&]() { rx->deliver(initial, sizeof(initial)); });
+	TEST_ASSERT_GREATER_THAN(0, client.get_rx_fragments().messages());
+
+	client.disconnect();
+}
+
+// encrypt, fragment and write a command, decrypt the status: against SesameServerCore over the fake GATT link with no
+// latency, so the figure is the client path plus the fake stack and the server core
+void
+bench_command_round_trip() {
+	fake_nimble::VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", SESAME_SECRET));
+	size_t statuses = 0;
+	client.set_status_callback([&statuses](auto&, auto) { statuses++; });
+	TEST_ASSERT_TRUE(client.connect());
+	TEST_ASSERT_TRUE(client.start_authenticate());
+	fake_nimble::run();
+	TEST_ASSERT_TRUE(client.get_state() == SesameClient::state_t::active);
+	static const auto tag = SesameClient::Tag::text("bench");
+	bool lock = true;
+	measure("lock/unlock -> status (VirtualSesame)", 1, [&]() {
+		TEST_ASSERT_TRUE(lock ? client.lock(tag) : client.unlock(tag));
+		fake_nimble::run();
+		lock = !lock;
+	});
+	TEST_ASSERT_EQUAL(sesame.commands, statuses);
+	TEST_ASSERT_GREATER_THAN(0, client.get_tx_fragments().fragments());
+	client.disconnect();
+	fake_nimble::run();
+}
+
+// whole operate_async() sessions: connect, authenticate, lock, status and disconnect on the virtual clock
+void
+bench_sessions() {
+	fake_nimble::VirtualSesame sesame{sesame_address};
+	TEST_ASSERT_TRUE(sesame.begin(Sesame::model_t::sesame_5, SESAME_SECRET));
+	sesame.peripheral.hop_latency_us = 3'000;
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", SESAME_SECRET));
+	size_t sessions = 0;
+	size_t failures = 0;
+	uint64_t total_ms = 0;
+	static const auto cmd = SesameClient::Command::lock("bench");
+	libsesame3bt::sysclock::set_source(fake_nimble::now_us);
+	measure("operate_async() session (VirtualSesame)", 1, [&]() {
+		client.operate_async(cmd, [&](auto&, const SesameClient::OperationReport& report) {
+			sessions++;
+			failures += report.result != SesameClient::operation_result_t::success;
+			total_ms += report.total_ms;
+		});
+		while (client.is_operating()) {
+			fake_nimble::run(fake_nimble::now_us() + 1'000);
+			client.loop();
+		}
+		fake_nimble::run();
+	});
+	libsesame3bt::sysclock::set_source(nullptr);
+	TEST_ASSERT_EQUAL(0, failures);
+	TEST_ASSERT_EQUAL(sessions, sesame.peripheral.connects);
+	std::printf("%-44s %10.1f ms virtual connect->status\n", "", static_cast<double>(total_ms) / sessions);
+}
+
+// session logic without NimBLE stand-in: fragments queued by the peer and delivered by loop()
+class NullPeer : public libsesame3bt::LoopbackTransport::Peer {
+ public:
+	void on_write(libsesame3bt::LoopbackTransport&, const uint8_t*, size_t) override {}
+};
+
+void
+bench_loopback_notification() {
+	NullPeer peer;
+	libsesame3bt::LoopbackTransport link{peer};
+	SesameClient client;
+	TEST_ASSERT_TRUE(client.begin(sesame_address, Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", SESAME_SECRET));
+	TEST_ASSERT_TRUE(client.set_transport(&link));
+	TEST_ASSERT_TRUE(client.connect());
+	uint8_t initial[] = {0x03, 0x08, 0x0e, 0x01, 0x02, 0x03, 0x04};
+	measure("notification -> core (LoopbackTransport)", 1, [&]() {
+		link.notify(initial, sizeof(initial));
+		client.loop();
+	});
+	TEST_ASSERT_GREATER_THAN(0, client.get_rx_fragments().messages());
+	client.disconnect();
+}
+
+void
+bench_conversions() {
+	NimBLEUUID uuid{"f0e1d2c3-b4a5-9687-7869-5a4b3c2d1e0f"};
+	measure("SesameClient::uuid_to_ble_address", 1, [&uuid]() {
+		auto addr = SesameClient::uuid_to_ble_address(uuid);
+		keep(addr);
+	});
+	float volts[16];
+	for (size_t i = 0; i < std::size(volts); i++) {
+		volts[i] = 4.5f + i * 0.1f;
+	}
+	measure("Status::voltage_to_pct", std::size(volts), [&volts]() {
+		for (auto v : volts) {
+			auto pct = SesameClient::Status::voltage_to_pct(v);
+			keep(pct);
+		}
+	});
+	measure("SesameClient::Tag::uuid", 1, [&uuid]() {
+		auto tag = SesameClient::Tag::uuid(libsesame3bt::history_tag_type_t::remote, uuid);
+		keep(tag);
+	});
+	measure("SesameClient::Tag::text", 1, []() {
+		auto tag = SesameClient::Tag::text(u8"ラベルは21バイトまたは30バイトに収まるように");
+		keep(tag);
+	});
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(bench_scanner_on_result);
+	RUN_TEST(bench_client_notification);
+	RUN_TEST(bench_command_round_trip);
+	RUN_TEST(bench_sessions);
+	RUN_TEST(bench_loopback_notification);
+	RUN_TEST(bench_conversions);
+	return UNITY_END();
+}
@@ -0,0 +1,77 @@
+#include <NimBLEDevice.h>
+#include <unity.h>
+#include "SesameScanner.h"
+#include "bench.h"
+
+using libsesame3bt::Sesame;
+using libsesame3bt::SesameInfo;
+using libsesame3bt::SesameScanner;
+
+using bench::measure;
+
+// one SESAME in a hundred packets
+static constexpr uint8_t PACKETS = 100;
+
+void
+setUp() {
+	fake_nimble::reset();
+	NimBLEDevice::init("");
+}
+
+void
+tearDown() {
+	NimBLEDevice::deinit(true);
+}
+
+void
+bench_classifier() {
+	auto advs = bench::make_advertisements(PACKETS, PACKETS);
+	size_t legacy_hits = 0;
+	size_t fast_hits = 0;
+	measure("classify: isAdvertisingService(NimBLEUUID)", advs.size(), [&]() {
+		legacy_hits = 0;
+		for (const auto& adv : advs) {
+			if (adv.isAdvertisingService(NimBLEUUID(Sesame::SESAME3_SRV_UUID))) {
+				legacy_hits++;
+			}
+		}
+	});
+	measure("classify: is_sesame_payload", advs.size(), [&]() {
+		fast_hits = 0;
+		for (const auto& adv : advs) {
+			const auto& payload = adv.getPayload();
+			if (SesameScanner::is_sesame_payload(payload.data(), payload.size())) {
+				fast_hits++;
+			}
+		}
+	});
+	TEST_ASSERT_EQUAL(1, legacy_hits);
+	TEST_ASSERT_EQUAL(legacy_hits, fast_hits);
+}
+
+void
+bench_on_result() {
+	auto advs = bench::make_advertisements(PACKETS, PACKETS);
+	size_t found = 0;
+	TEST_ASSERT_TRUE(SesameScanner::get().scan_async(0, [&found](SesameScanner&, const SesameInfo* info) {
+		if (info) {
+			found++;
+		}
+	}));
+	auto* scan = NimBLEDevice::getScan();
+	measure("SesameScanner::onResult", advs.size(), [&]() {
+		for (const auto& adv : advs) {
+			scan->deliver(adv);
+		}
+	});
+	SesameScanner::get().stop();
+	TEST_ASSERT_GREATER_THAN(0, found);
+}
+
+int
+main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(bench_classifier);
+	RUN_TEST(bench_on_result);
+	return UNITY_END();
+}